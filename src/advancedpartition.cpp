@@ -649,6 +649,7 @@ void AdvancedPartitionWindow::onContinue() {
     g_installConfig.bootFormat = bootFormatCombo->currentText().toLower();
     g_installConfig.filesystem = rootFormatCombo->currentText().toLower();
     g_installConfig.enableSwap = !swapPartition.isEmpty();
+    g_installConfig.swapMode = swapPartition.isEmpty() ? SwapMode::None : SwapMode::Partition;
     
     UserConfigWindow *userConfigWindow = new UserConfigWindow();
     userConfigWindow->setPreviousWindow(this);
@@ -0,0 +1,124 @@
+#include "blockdecompressor.h"
+#include <cstring>
+#include <memory>
+#include <zlib.h>
+#include <lzma.h>
+#include <lz4.h>
+#include <zstd.h>
+
+namespace {
+
+struct ZstdContextDeleter {
+    void operator()(ZSTD_DCtx *ctx) const { ZSTD_freeDCtx(ctx); }
+};
+
+ZSTD_DCtx *threadZstdContext() {
+    thread_local std::unique_ptr<ZSTD_DCtx, ZstdContextDeleter> ctx(ZSTD_createDCtx());
+    return ctx.get();
+}
+
+bool decompressZlib(const char *src, size_t srcSize, char *dst, size_t dstCapacity, size_t *outSize) {
+    uLongf destLen = dstCapacity;
+    int ret = uncompress(reinterpret_cast<Bytef *>(dst), &destLen,
+                         reinterpret_cast<const Bytef *>(src), srcSize);
+    if (ret != Z_OK) {
+        return false;
+    }
+    *outSize = destLen;
+    return true;
+}
+
+bool decompressXz(const char *src, size_t srcSize, char *dst, size_t dstCapacity, size_t *outSize) {
+    uint64_t memlimit = UINT64_MAX;
+    size_t inPos = 0;
+    size_t outPos = 0;
+    lzma_ret ret = lzma_stream_buffer_decode(&memlimit, 0, nullptr,
+                                             reinterpret_cast<const uint8_t *>(src), &inPos, srcSize,
+                                             reinterpret_cast<uint8_t *>(dst), &outPos, dstCapacity);
+    if (ret != LZMA_OK) {
+        return false;
+    }
+    *outSize = outPos;
+    return true;
+}
+
+bool decompressLzma(const char *src, size_t srcSize, char *dst, size_t dstCapacity, size_t *outSize) {
+    // Legacy "lzma alone" streams as written by old mksquashfs builds
+    lzma_stream stream = LZMA_STREAM_INIT;
+    if (lzma_alone_decoder(&stream, UINT64_MAX) != LZMA_OK) {
+        return false;
+    }
+    stream.next_in = reinterpret_cast<const uint8_t *>(src);
+    stream.avail_in = srcSize;
+    stream.next_out = reinterpret_cast<uint8_t *>(dst);
+    stream.avail_out = dstCapacity;
+
+    lzma_ret ret = lzma_code(&stream, LZMA_FINISH);
+    size_t produced = dstCapacity - stream.avail_out;
+    lzma_end(&stream);
+
+    // The header may not carry an end marker, a full output buffer is fine too
+    if (ret != LZMA_STREAM_END && !(ret == LZMA_OK && produced > 0)) {
+        return false;
+    }
+    *outSize = produced;
+    return true;
+}
+
+bool decompressLz4(const char *src, size_t srcSize, char *dst, size_t dstCapacity, size_t *outSize) {
+    int ret = LZ4_decompress_safe(src, dst, static_cast<int>(srcSize), static_cast<int>(dstCapacity));
+    if (ret < 0) {
+        return false;
+    }
+    *outSize = static_cast<size_t>(ret);
+    return true;
+}
+
+bool decompressZstd(const char *src, size_t srcSize, char *dst, size_t dstCapacity, size_t *outSize) {
+    ZSTD_DCtx *ctx = threadZstdContext();
+    if (!ctx) {
+        return false;
+    }
+    size_t ret = ZSTD_decompressDCtx(ctx, dst, dstCapacity, src, srcSize);
+    if (ZSTD_isError(ret)) {
+        return false;
+    }
+    *outSize = ret;
+    return true;
+}
+
+} // namespace
+
+bool BlockDecompressor::decompress(Codec codec, const char *src, size_t srcSize,
+                                   char *dst, size_t dstCapacity, size_t *outSize) {
+    switch (codec) {
+        case Codec::None:
+            if (srcSize > dstCapacity) {
+                return false;
+            }
+            memcpy(dst, src, srcSize);
+            *outSize = srcSize;
+            return true;
+        case Codec::Zlib: return decompressZlib(src, srcSize, dst, dstCapacity, outSize);
+        case Codec::Lzma: return decompressLzma(src, srcSize, dst, dstCapacity, outSize);
+        case Codec::Xz:   return decompressXz(src, srcSize, dst, dstCapacity, outSize);
+        case Codec::Lz4:  return decompressLz4(src, srcSize, dst, dstCapacity, outSize);
+        case Codec::Zstd: return decompressZstd(src, srcSize, dst, dstCapacity, outSize);
+        case Codec::Unsupported:
+            break;
+    }
+    return false;
+}
+
+QString BlockDecompressor::codecName(Codec codec) {
+    switch (codec) {
+        case Codec::None: return "none";
+        case Codec::Zlib: return "gzip";
+        case Codec::Lzma: return "lzma";
+        case Codec::Xz:   return "xz";
+        case Codec::Lz4:  return "lz4";
+        case Codec::Zstd: return "zstd";
+        case Codec::Unsupported: break;
+    }
+    return "unsupported";
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <QString>
+#include <cstddef>
+
+// Stateless per-block decompression shared by the image readers.
+// Every call is thread-safe; codecs that need a context keep one per thread.
+class BlockDecompressor {
+public:
+    enum class Codec {
+        None,
+        Zlib,
+        Lzma,
+        Xz,
+        Lz4,
+        Zstd,
+        Unsupported
+    };
+
+    static bool decompress(Codec codec, const char *src, size_t srcSize,
+                           char *dst, size_t dstCapacity, size_t *outSize);
+    static QString codecName(Codec codec);
+};
@@ -0,0 +1,311 @@
+#include "blockimagedeployer.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+#include <QXmlStreamReader>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr qint64 COPY_CHUNK = 8 * 1024 * 1024;
+
+struct BlockRange {
+    qint64 first = 0;
+    qint64 last = 0;
+    QByteArray checksum;
+};
+
+struct BlockMap {
+    qint64 imageSize = 0;
+    qint64 blockSize = 0;
+    qint64 blocksCount = 0;
+    qint64 mappedBlocks = 0;
+    QCryptographicHash::Algorithm algorithm = QCryptographicHash::Sha256;
+    QString fileChecksum;
+    std::vector<BlockRange> ranges;
+};
+
+bool parseBlockMap(const QByteArray &xml, BlockMap *map, QString *error) {
+    QXmlStreamReader reader(xml);
+    QString version;
+    QString checksumType;
+
+    while (!reader.atEnd()) {
+        reader.readNext();
+        if (!reader.isStartElement()) {
+            continue;
+        }
+
+        if (reader.name() == QLatin1String("bmap")) {
+            version = reader.attributes().value("version").toString();
+        } else if (reader.name() == QLatin1String("ImageSize")) {
+            map->imageSize = reader.readElementText().trimmed().toLongLong();
+        } else if (reader.name() == QLatin1String("BlockSize")) {
+            map->blockSize = reader.readElementText().trimmed().toLongLong();
+        } else if (reader.name() == QLatin1String("BlocksCount")) {
+            map->blocksCount = reader.readElementText().trimmed().toLongLong();
+        } else if (reader.name() == QLatin1String("MappedBlocksCount")) {
+            map->mappedBlocks = reader.readElementText().trimmed().toLongLong();
+        } else if (reader.name() == QLatin1String("ChecksumType")) {
+            checksumType = reader.readElementText().trimmed();
+        } else if (reader.name() == QLatin1String("BmapFileChecksum") || reader.name() == QLatin1String("BmapFileSHA1")) {
+            map->fileChecksum = reader.readElementText().trimmed();
+        } else if (reader.name() == QLatin1String("Range")) {
+            BlockRange range;
+            // 1.x files use a "sha1" attribute, 2.0 files use "chksum"
+            QString checksum = reader.attributes().value("chksum").toString();
+            if (checksum.isEmpty()) {
+                checksum = reader.attributes().value("sha1").toString();
+            }
+            range.checksum = QByteArray::fromHex(checksum.toLatin1());
+
+            QStringList bounds = reader.readElementText().trimmed().split('-');
+            bool firstOk = false;
+            bool lastOk = false;
+            range.first = bounds[0].trimmed().toLongLong(&firstOk);
+            range.last = bounds.size() > 1 ? bounds[1].trimmed().toLongLong(&lastOk) : range.first;
+            if (bounds.size() == 1) {
+                lastOk = firstOk;
+            }
+            if (!firstOk || !lastOk || range.last < range.first) {
+                *error = "Invalid block range in bmap file";
+                return false;
+            }
+            map->ranges.push_back(range);
+        }
+    }
+
+    if (reader.hasError()) {
+        *error = QString("Cannot parse bmap file: %1").arg(reader.errorString());
+        return false;
+    }
+    if (!version.startsWith("1.") && !version.startsWith("2.")) {
+        *error = QString("Unsupported bmap version '%1'").arg(version);
+        return false;
+    }
+
+    if (checksumType.isEmpty() || checksumType == "sha1") {
+        map->algorithm = QCryptographicHash::Sha1;
+    } else if (checksumType == "sha256") {
+        map->algorithm = QCryptographicHash::Sha256;
+    } else {
+        *error = QString("Unsupported bmap checksum type '%1'").arg(checksumType);
+        return false;
+    }
+
+    if (map->blockSize <= 0 || map->imageSize <= 0 || map->ranges.empty()) {
+        *error = "Incomplete bmap file";
+        return false;
+    }
+    for (const BlockRange &range : map->ranges) {
+        if ((range.last + 1) * map->blockSize > map->imageSize + map->blockSize - 1) {
+            *error = "bmap range beyond the end of the image";
+            return false;
+        }
+    }
+    return true;
+}
+
+// The bmap checksum is computed over the file with its own value zeroed out
+bool verifyBmapFile(QByteArray xml, const BlockMap &map) {
+    if (map.fileChecksum.isEmpty()) {
+        return true;
+    }
+    QByteArray expected = map.fileChecksum.toLatin1();
+    qsizetype position = xml.indexOf(expected);
+    if (position < 0) {
+        return false;
+    }
+    xml.replace(position, expected.size(), QByteArray(expected.size(), '0'));
+    return QCryptographicHash::hash(xml, map.algorithm).toHex() == expected.toLower();
+}
+
+bool preadExact(int fd, char *buffer, size_t length, qint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + static_cast<qint64>(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const char *buffer, size_t length, qint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, buffer + done, length - done, offset + static_cast<qint64>(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+BlockImageDeployer::BlockImageDeployer(const QString &imagePath, const QString &bmapPath, const QString &device, QObject *parent)
+    : QObject(parent), imagePath(imagePath), bmapPath(bmapPath), device(device), thread(nullptr), cancelled(false) {
+}
+
+BlockImageDeployer::~BlockImageDeployer() {
+    cancel();
+    wait();
+    delete thread;
+}
+
+void BlockImageDeployer::start() {
+    if (thread) return;
+    thread = QThread::create([this]() {
+        QString message;
+        bool success = run(&message);
+        emit finished(success, message);
+    });
+    thread->start();
+}
+
+void BlockImageDeployer::cancel() {
+    cancelled = true;
+}
+
+void BlockImageDeployer::wait() {
+    if (thread) {
+        thread->wait();
+    }
+}
+
+bool BlockImageDeployer::run(QString *message) {
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile bmapFile(bmapPath);
+    if (!bmapFile.open(QIODevice::ReadOnly)) {
+        *message = QString("Cannot open bmap file %1").arg(bmapPath);
+        return false;
+    }
+    QByteArray xml = bmapFile.readAll();
+
+    BlockMap map;
+    if (!parseBlockMap(xml, &map, message)) {
+        return false;
+    }
+    if (!verifyBmapFile(xml, map)) {
+        *message = QString("Checksum mismatch in bmap file %1").arg(bmapPath);
+        return false;
+    }
+
+    int imageFd = open(imagePath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (imageFd < 0) {
+        *message = QString("Cannot open image %1: %2").arg(imagePath).arg(strerror(errno));
+        return false;
+    }
+    off_t actualSize = lseek(imageFd, 0, SEEK_END);
+    if (actualSize != map.imageSize) {
+        *message = QString("Image %1 is %2 bytes, bmap expects %3 (compressed images are not supported)")
+                   .arg(imagePath).arg(actualSize).arg(map.imageSize);
+        close(imageFd);
+        return false;
+    }
+    posix_fadvise(imageFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // O_EXCL on a block device fails if anything has it mounted
+    int deviceFd = open(device.toLocal8Bit().constData(), O_WRONLY | O_EXCL | O_CLOEXEC);
+    if (deviceFd < 0) {
+        *message = QString("Cannot open %1 for writing: %2").arg(device).arg(strerror(errno));
+        close(imageFd);
+        return false;
+    }
+    quint64 deviceSize = 0;
+    if (ioctl(deviceFd, BLKGETSIZE64, &deviceSize) != 0 || deviceSize < static_cast<quint64>(map.imageSize)) {
+        *message = QString("Partition %1 (%2 bytes) is smaller than the image (%3 bytes)")
+                   .arg(device).arg(deviceSize).arg(map.imageSize);
+        close(deviceFd);
+        close(imageFd);
+        return false;
+    }
+
+    qint64 bytesTotal = 0;
+    for (const BlockRange &range : map.ranges) {
+        bytesTotal += std::min(map.imageSize, (range.last + 1) * map.blockSize) - range.first * map.blockSize;
+    }
+    qDebug() << QString("[DEBUG] Deploying %1 to %2: %3 of %4 MB mapped in %5 ranges")
+                .arg(imagePath).arg(device)
+                .arg(bytesTotal / (1024 * 1024)).arg(map.imageSize / (1024 * 1024))
+                .arg(map.ranges.size());
+
+    std::vector<char> buffer(COPY_CHUNK);
+    qint64 bytesDone = 0;
+    QElapsedTimer sinceReport;
+    sinceReport.start();
+    bool ok = true;
+
+    for (const BlockRange &range : map.ranges) {
+        qint64 start = range.first * map.blockSize;
+        qint64 end = std::min(map.imageSize, (range.last + 1) * map.blockSize);
+        QCryptographicHash hash(map.algorithm);
+
+        for (qint64 offset = start; offset < end && ok; offset += COPY_CHUNK) {
+            if (cancelled) {
+                *message = "Deployment cancelled";
+                ok = false;
+                break;
+            }
+            size_t length = static_cast<size_t>(std::min(COPY_CHUNK, end - offset));
+            if (!preadExact(imageFd, buffer.data(), length, offset)) {
+                *message = QString("Read error in %1 at offset %2").arg(imagePath).arg(offset);
+                ok = false;
+                break;
+            }
+            if (!range.checksum.isEmpty()) {
+                hash.addData(buffer.data(), static_cast<qsizetype>(length));
+            }
+            if (!pwriteAll(deviceFd, buffer.data(), length, offset)) {
+                *message = QString("Write error on %1 at offset %2: %3").arg(device).arg(offset).arg(strerror(errno));
+                ok = false;
+                break;
+            }
+            bytesDone += static_cast<qint64>(length);
+
+            if (sinceReport.elapsed() >= 250) {
+                emit progressChanged(bytesDone, bytesTotal);
+                sinceReport.restart();
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        if (!range.checksum.isEmpty() && hash.result() != range.checksum) {
+            *message = QString("Checksum mismatch in %1, blocks %2-%3").arg(imagePath).arg(range.first).arg(range.last);
+            ok = false;
+            break;
+        }
+    }
+
+    close(imageFd);
+    if (ok && fdatasync(deviceFd) != 0) {
+        *message = QString("Cannot flush %1: %2").arg(device).arg(strerror(errno));
+        ok = false;
+    }
+    close(deviceFd);
+    if (!ok) {
+        return false;
+    }
+
+    emit progressChanged(bytesDone, bytesTotal);
+    double seconds = std::max<qint64>(1, timer.elapsed()) / 1000.0;
+    *message = QString("Deployed %1 MB to %2 in %3 s (%4 MB/s)")
+               .arg(bytesDone / (1024 * 1024)).arg(device)
+               .arg(seconds, 0, 'f', 1)
+               .arg(bytesDone / (1024.0 * 1024.0) / seconds, 0, 'f', 1);
+    qDebug() << "[DEBUG]" << *message;
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <atomic>
+
+class QThread;
+
+// Streams a prebuilt root filesystem image onto a partition.
+//
+// Only the blocks listed in the bmap sidecar (bmaptool format 1.x/2.0) are
+// read and written; every range is checked against its checksum while it is
+// copied. The caller grows the filesystem to the partition size afterwards.
+class BlockImageDeployer : public QObject {
+    Q_OBJECT
+
+public:
+    BlockImageDeployer(const QString &imagePath, const QString &bmapPath, const QString &device, QObject *parent = nullptr);
+    ~BlockImageDeployer();
+
+    void start();
+    void cancel();
+    void wait();
+
+signals:
+    void progressChanged(qint64 bytesDone, qint64 bytesTotal);
+    void finished(bool success, const QString &message);
+
+private:
+    bool run(QString *message);
+
+    QString imagePath;
+    QString bmapPath;
+    QString device;
+    QThread *thread;
+    std::atomic<bool> cancelled;
+};
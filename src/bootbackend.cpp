@@ -0,0 +1,78 @@
+#include "bootbackend.h"
+#include "settingsparser.h"
+#include <QDebug>
+
+BootBackend::Kind BootBackend::fromSettings() {
+    SettingsParser::loadSettings();
+    QString value = SettingsParser::getVariable("bootloader", "grub").trimmed().toLower();
+    if (value == "systemd-boot") {
+        return Kind::SystemdBoot;
+    }
+    if (value == "uki") {
+        return Kind::Uki;
+    }
+    if (value != "grub") {
+        qDebug() << "[WARNING] Unknown bootloader" << value << "- using GRUB";
+    }
+    return Kind::Grub;
+}
+
+QString BootBackend::name(Kind kind) {
+    switch (kind) {
+    case Kind::SystemdBoot: return "systemd-boot";
+    case Kind::Uki: return "UKI";
+    case Kind::Grub: break;
+    }
+    return "GRUB";
+}
+
+QString BootBackend::linuxPreset(Kind kind) {
+    QString preset = "ALL_config=\"/etc/mkinitcpio.conf\"\nALL_kver=\"/boot/vmlinuz-linux\"\n\nPRESETS=(\"default\" \"fallback\")\n\n";
+    if (kind == Kind::Grub) {
+        preset += "default_image=\"/boot/initramfs-linux.img\"\nfallback_image=\"/boot/initramfs-linux-fallback.img\"\n";
+    } else {
+        preset += QString("default_uki=\"%1%2\"\nfallback_uki=\"%1%3\"\n")
+                  .arg(espMountPoint()).arg(ukiLoader("default")).arg(ukiLoader("fallback"));
+    }
+    preset += "fallback_options=\"-S autodetect\"\n";
+    return preset;
+}
+
+QString BootBackend::ukiLoader(const QString &entry) {
+    return entry == "default" ? "/EFI/Linux/arch-linux.efi" : QString("/EFI/Linux/arch-linux-%1.efi").arg(entry);
+}
+
+QString BootBackend::espMountPoint() {
+    return "/boot/efi";
+}
+
+QString BootBackend::removableHookPath() {
+    return "/etc/initcpio/post/arch7z-removable-uki";
+}
+
+QString BootBackend::removableHook() {
+    // mkinitcpio passes the kernel, the initramfs image and the UKI it built
+    return QString("#!/bin/bash\n"
+                   "# Written by the Arch7z installer\n"
+                   "[ \"$3\" = \"%1%2\" ] || exit 0\n"
+                   "install -Dm644 \"$3\" %1/EFI/BOOT/BOOTX64.EFI\n").arg(espMountPoint()).arg(ukiLoader("default"));
+}
+
+QString BootBackend::kernelCmdline(const QString &rootUuid, const QString &rootSubvolume, const QStringList &arguments) {
+    QStringList cmdline;
+    cmdline << "root=UUID=" + rootUuid << "rw";
+    if (!rootSubvolume.isEmpty()) {
+        cmdline << "rootflags=subvol=" + rootSubvolume;
+    }
+    for (const QString &argument : arguments) {
+        if (!argument.trimmed().isEmpty()) {
+            cmdline << argument.trimmed();
+        }
+    }
+    return cmdline.join(" ");
+}
+
+QString BootBackend::loaderConfig(int timeout) {
+    // @saved follows the last entry picked in the menu
+    return QString("default @saved\ntimeout %1\nconsole-mode keep\neditor no\n").arg(timeout);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+
+// Which bootloader the installed system gets, from bootloader= in
+// final-settings.conf: grub (the default), systemd-boot or uki.
+//
+// Without GRUB, mkinitcpio builds Unified Kernel Images (kernel, initramfs
+// and the command line the installer assembles in /etc/kernel/cmdline) into
+// /EFI/Linux on the ESP. systemd-boot lists them without configuration
+// (Boot Loader Specification type #2); with uki there is no boot manager and
+// the firmware starts them through one boot entry per image. Kernel
+// arguments still come from GRUB_CMDLINE_LINUX(_DEFAULT) in
+// /etc/default/grub, where the final settings scripts put them. Both
+// backends report their timestamps through the Boot Loader Interface, so
+// systemd-analyze on the installed system shows firmware and loader time.
+class BootBackend {
+public:
+    enum class Kind { Grub, SystemdBoot, Uki };
+
+    static Kind fromSettings();
+    static QString name(Kind kind);
+
+    // /etc/mkinitcpio.d/linux.preset: images in /boot for GRUB, UKIs otherwise
+    static QString linuxPreset(Kind kind);
+    // Path of the UKI for a preset entry ("default", "fallback") on the ESP
+    static QString ukiLoader(const QString &entry);
+    static QString espMountPoint();
+    // mkinitcpio post hook keeping a copy of the default UKI at the removable
+    // path (/EFI/BOOT/BOOTX64.EFI), for firmware that lost or ignores its entries
+    static QString removableHookPath();
+    static QString removableHook();
+
+    // root=, rootflags= for a btrfs subvolume, then the GRUB kernel arguments
+    static QString kernelCmdline(const QString &rootUuid, const QString &rootSubvolume, const QStringList &arguments);
+    // systemd-boot's loader/loader.conf; timeout 0 boots without showing the menu
+    static QString loaderConfig(int timeout);
+};
@@ -0,0 +1,97 @@
+#include "btrfsencodedwriter.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/btrfs.h>
+#include <linux/magic.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#include <zstd.h>
+
+namespace {
+
+constexpr quint32 ZSTD_FRAME_MAGIC = 0xFD2FB528;
+
+// The kernel decompresses btrfs zstd extents with windowLog <= 17
+constexpr quint64 BTRFS_ZSTD_MAX_WINDOW = 1ULL << 17;
+
+} // namespace
+
+bool BtrfsEncodedWriter::isBtrfs(const QString &path) {
+    struct statfs fs;
+    if (statfs(path.toLocal8Bit().constData(), &fs) != 0) {
+        return false;
+    }
+    return static_cast<unsigned long>(fs.f_type) == BTRFS_SUPER_MAGIC;
+}
+
+bool BtrfsEncodedWriter::isPassthroughFrame(const char *frame, size_t frameSize, size_t decodedSize) {
+    if (frameSize < 6 || frameSize >= MaxExtentSize || frameSize > decodedSize || decodedSize > MaxExtentSize) {
+        return false;
+    }
+
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(frame);
+    quint32 magic = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<quint32>(p[3]) << 24);
+    if (magic != ZSTD_FRAME_MAGIC) {
+        return false;
+    }
+
+    // Frame header descriptor: no dictionary, and a window the kernel can handle
+    unsigned char descriptor = p[4];
+    bool singleSegment = descriptor & 0x20;
+    if (descriptor & 0x03) {
+        return false;
+    }
+    if (!singleSegment) {
+        unsigned char windowDescriptor = p[5];
+        quint64 windowBase = 1ULL << (10 + (windowDescriptor >> 3));
+        quint64 windowSize = windowBase + (windowBase / 8) * (windowDescriptor & 0x07);
+        if (windowSize > BTRFS_ZSTD_MAX_WINDOW) {
+            return false;
+        }
+    }
+
+    // Exactly one frame that decodes to exactly this block
+    unsigned long long contentSize = ZSTD_getFrameContentSize(frame, frameSize);
+    if (contentSize != decodedSize) {
+        return false;
+    }
+    size_t compressedSize = ZSTD_findFrameCompressedSize(frame, frameSize);
+    return !ZSTD_isError(compressedSize) && compressedSize == frameSize;
+}
+
+BtrfsEncodedWriter::Result BtrfsEncodedWriter::writeZstdFrame(int fd, const char *frame, size_t frameSize,
+                                                              quint64 offset, size_t decodedSize) {
+    if (!isPassthroughFrame(frame, frameSize, decodedSize)) {
+        return Result::Rejected;
+    }
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(frame);
+    iov.iov_len = frameSize;
+
+    struct btrfs_ioctl_encoded_io_args args;
+    memset(&args, 0, sizeof(args));
+    args.iov = &iov;
+    args.iovcnt = 1;
+    args.offset = static_cast<__s64>(offset);
+    args.len = decodedSize;
+    args.unencoded_len = decodedSize;
+    args.unencoded_offset = 0;
+    args.compression = BTRFS_ENCODED_IO_COMPRESSION_ZSTD;
+    args.encryption = BTRFS_ENCODED_IO_ENCRYPTION_NONE;
+
+    int ret;
+    do {
+        ret = ioctl(fd, BTRFS_IOC_ENCODED_WRITE, &args);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret >= 0 && static_cast<size_t>(ret) == frameSize) {
+        return Result::Written;
+    }
+    // Old kernels, other filesystems or missing CAP_SYS_ADMIN: stop trying
+    if (ret < 0 && (errno == ENOTTY || errno == EOPNOTSUPP || errno == EPERM)) {
+        return Result::Unsupported;
+    }
+    return Result::Rejected;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <QString>
+#include <cstddef>
+
+// Writes already-compressed zstd frames straight into btrfs extents with
+// BTRFS_IOC_ENCODED_WRITE, so data compressed in the source image is not
+// decompressed only for the kernel to compress it again.
+class BtrfsEncodedWriter {
+public:
+    enum class Result {
+        Written,     // extent written as-is
+        Rejected,    // this frame cannot be passed through, write it decoded
+        Unsupported  // kernel or filesystem cannot do encoded writes at all
+    };
+
+    // Largest decoded extent btrfs accepts for an encoded write
+    static constexpr size_t MaxExtentSize = 128 * 1024;
+
+    static bool isBtrfs(const QString &path);
+    static bool isPassthroughFrame(const char *frame, size_t frameSize, size_t decodedSize);
+    static Result writeZstdFrame(int fd, const char *frame, size_t frameSize,
+                                 quint64 offset, size_t decodedSize);
+};
@@ -0,0 +1,136 @@
+#include "btrfslayout.h"
+#include "settingsparser.h"
+#include <QDebug>
+#include <QRegularExpression>
+#include <algorithm>
+
+namespace {
+
+const char *standardLayout = "@home:/home,"
+                             "@log:/var/log,"
+                             "@cache:/var/cache/pacman/pkg,"
+                             "@snapshots:/.snapshots,"
+                             "@images:/var/lib/libvirt/images:nodatacow";
+
+} // namespace
+
+BtrfsLayout BtrfsLayout::fromSettings() {
+    SettingsParser::loadSettings();
+    BtrfsLayout layout;
+
+    QString spec = SettingsParser::getVariable("btrfs_layout", "standard");
+    if (spec == "standard") {
+        spec = standardLayout;
+    } else if (spec == "minimal") {
+        spec = "@home:/home";
+    }
+    QString error;
+    layout.extraSubvolumes = parse(spec, &error);
+    if (!error.isEmpty()) {
+        qDebug() << "[WARNING] Invalid btrfs_layout:" << error << "- using the standard layout";
+        layout.extraSubvolumes = parse(standardLayout, &error);
+    }
+
+    QString compress = SettingsParser::getVariable("btrfs_compress", "auto");
+    if (compress != "auto") {
+        layout.compression = compress;
+    }
+
+    for (const BtrfsSubvolume &subvolume : layout.extraSubvolumes) {
+        qDebug() << "[STORAGE] Subvolume" << subvolume.name << "->" << subvolume.mountPoint
+                 << (subvolume.nodatacow ? "(nodatacow)" : "");
+    }
+    return layout;
+}
+
+QList<BtrfsSubvolume> BtrfsLayout::parse(const QString &spec, QString *error) {
+    QList<BtrfsSubvolume> subvolumes;
+    QRegularExpression validName("^@[A-Za-z0-9_.-]*$");
+
+    for (const QString &item : spec.split(',', Qt::SkipEmptyParts)) {
+        QStringList fields = item.trimmed().split(':');
+        BtrfsSubvolume subvolume;
+        subvolume.name = fields.value(0);
+        subvolume.mountPoint = fields.value(1);
+        subvolume.nodatacow = fields.value(2) == "nodatacow";
+
+        if (fields.size() < 2 || fields.size() > 3 || (fields.size() == 3 && !subvolume.nodatacow)) {
+            *error = QString("'%1' is not @name:/mount/point[:nodatacow]").arg(item);
+            return {};
+        }
+        if (!validName.match(subvolume.name).hasMatch() || subvolume.name == "@") {
+            *error = QString("'%1' is not a subvolume name other than @").arg(subvolume.name);
+            return {};
+        }
+        if (!subvolume.mountPoint.startsWith('/') || subvolume.mountPoint == "/" || subvolume.mountPoint.contains(' ')) {
+            *error = QString("'%1' is not a mount point below /").arg(subvolume.mountPoint);
+            return {};
+        }
+        subvolumes << subvolume;
+    }
+
+    // /var/lib/libvirt/images must be mounted after /var/lib/libvirt, and so on
+    std::stable_sort(subvolumes.begin(), subvolumes.end(), [](const BtrfsSubvolume &a, const BtrfsSubvolume &b) {
+        return a.mountPoint.count('/') < b.mountPoint.count('/');
+    });
+    return subvolumes;
+}
+
+QStringList BtrfsLayout::createCommands(const QString &topLevel) const {
+    QStringList commands;
+    for (const BtrfsSubvolume &subvolume : extraSubvolumes) {
+        QString path = topLevel + "/" + subvolume.name;
+        QString inRoot = topLevel + "/@" + subvolume.mountPoint;
+        QString create = "btrfs subvolume create " + path;
+        if (subvolume.nodatacow) {
+            create += " && chattr +C " + path;
+        }
+        // A received or deployed @ already has files there; mounting the new
+        // subvolume over them would hide them and keep them in snapshots of @.
+        // A nested subvolume (inode 256) is moved as a whole, anything else
+        // is copied (reflinked where possible) and removed from @
+        commands << "if [ ! -d " + path + " ]; then "
+                    "if [ \"$(stat -c %i " + inRoot + " 2>/dev/null)\" = 256 ]; then mv " + inRoot + " " + path + "; "
+                    "else " + create + " && "
+                    "if [ -d " + inRoot + " ] && [ -n \"$(ls -A " + inRoot + ")\" ]; then "
+                    "cp -a --reflink=auto " + inRoot + "/. " + path + "/ && find " + inRoot + " -mindepth 1 -delete; fi; fi; fi";
+    }
+    return commands;
+}
+
+QString BtrfsLayout::mountOptions(const QString &device, const QString &subvolume) const {
+    QString options = FstabGenerator::mountOptions("btrfs", device, subvolume);
+    if (compression.isEmpty()) {
+        return options;
+    }
+
+    QStringList list;
+    for (const QString &option : options.split(',')) {
+        if (option.startsWith("compress=")) {
+            if (compression != "off") {
+                list << "compress=" + compression;
+            }
+        } else {
+            list << option;
+        }
+    }
+    return list.join(',');
+}
+
+QStringList BtrfsLayout::mountCommands(const QString &device, const QString &target, QList<FstabEntry> *mountTable) const {
+    QStringList commands;
+    *mountTable << FstabEntry{device, "/", "btrfs", mountOptions(device, "@")};
+    commands << QString("mount -o %1 %2 %3").arg(mountTable->last().options).arg(device).arg(target);
+
+    for (const BtrfsSubvolume &subvolume : extraSubvolumes) {
+        QString path = target + subvolume.mountPoint;
+        *mountTable << FstabEntry{device, subvolume.mountPoint, "btrfs", mountOptions(device, subvolume.name)};
+        commands << QString("mkdir -p %1").arg(path);
+        commands << QString("mount -o %1 %2 %3").arg(mountTable->last().options).arg(device).arg(path);
+        if (subvolume.nodatacow) {
+            // Only affects files created from now on, which is all of them in a new subvolume
+            commands << QString("chattr +C %1").arg(path);
+        }
+    }
+    return commands;
+}
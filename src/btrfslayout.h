@@ -0,0 +1,44 @@
+#pragma once
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "fstabgenerator.h"
+
+struct BtrfsSubvolume {
+    QString name;         // e.g. @log, at the top level of the filesystem
+    QString mountPoint;   // e.g. /var/log
+    bool nodatacow = false;
+};
+
+// Which subvolumes a btrfs root gets besides @, and how they are mounted.
+//
+// Logs, the package cache and VM images change constantly; in their own
+// subvolumes they stay out of snapshots of @. nodatacow subvolumes get +C on
+// their root directory so files created there are not copy-on-write (and not
+// compressed). Every subvolume is mounted with the same options, since btrfs
+// applies most of them to the whole filesystem anyway.
+//
+// The layout comes from btrfs_layout in final-settings.conf: "standard",
+// "minimal" (@home only) or a list such as
+// "@home:/home,@images:/var/lib/libvirt/images:nodatacow".
+// btrfs_compress overrides the storage profile's compression ("off",
+// "zstd:3", "lzo", ...).
+class BtrfsLayout {
+public:
+    static BtrfsLayout fromSettings();
+
+    // Subvolumes other than @, parents before children
+    QList<BtrfsSubvolume> subvolumes() const { return extraSubvolumes; }
+    // Creates missing subvolumes and moves what @ already holds at their
+    // mount points into them; runs with the top level mounted on topLevel
+    QStringList createCommands(const QString &topLevel) const;
+    // Mounts @ on target and every subvolume below it, and records the mounts
+    QStringList mountCommands(const QString &device, const QString &target, QList<FstabEntry> *mountTable) const;
+    QString mountOptions(const QString &device, const QString &subvolume) const;
+
+private:
+    static QList<BtrfsSubvolume> parse(const QString &spec, QString *error);
+
+    QList<BtrfsSubvolume> extraSubvolumes;
+    QString compression;   // empty keeps the storage profile's choice
+};
@@ -0,0 +1,180 @@
+#include "chrootsession.h"
+#include <QDebug>
+#include <QProcess>
+#include <QTimer>
+
+ChrootSession::ChrootSession(const QString &root, QObject *parent)
+    : QObject(parent), root(root), process(nullptr), nextId(1) {
+}
+
+ChrootSession::~ChrootSession() {
+    terminate();
+}
+
+void ChrootSession::start() {
+    if (process) return;
+
+    process = new QProcess(this);
+    connect(process, &QProcess::readyReadStandardOutput, this, &ChrootSession::onReadyRead);
+    connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &ChrootSession::onSessionFinished);
+
+    // A private mount namespace keeps the API mounts out of the host's view
+    QStringList args = QStringList() << "unshare" << "--mount" << "--propagation" << "private"
+                                     << "bash" << "-c" << sessionScript();
+    if (QProcess::execute("which", QStringList() << "pkexec") == 0) {
+        process->start("pkexec", args);
+    } else if (QProcess::execute("which", QStringList() << "sudo") == 0) {
+        process->start("sudo", args);
+    } else {
+        process->start(args.takeFirst(), args);
+    }
+    qDebug() << "[CHROOT] Session started for" << root;
+}
+
+int ChrootSession::run(const QString &script) {
+    start();
+    int id = nextId++;
+    pending.insert(id);
+    QByteArray line = QByteArray::number(id);
+    line += ' ';
+    line += script.toUtf8().toBase64();
+    line += '\n';
+    process->write(line);
+    qDebug() << "[CHROOT] Queued command" << id << ":" << script.left(200);
+    return id;
+}
+
+bool ChrootSession::isRunning() const {
+    return process && process->state() != QProcess::NotRunning;
+}
+
+void ChrootSession::close() {
+    if (!isRunning()) return;
+
+    qDebug() << "[CHROOT] Closing session," << pending.size() << "commands still running";
+    process->write("EXIT\n");
+    process->closeWriteChannel();
+    QTimer::singleShot(120000, this, [this]() {
+        if (isRunning()) {
+            qDebug() << "[WARNING] Chroot session did not close in time, killing it";
+            terminate();
+        }
+    });
+}
+
+void ChrootSession::terminate() {
+    if (!isRunning()) return;
+
+    // pkexec and sudo run the session as root, out of reach of kill(); it
+    // kills its scripts' process groups itself on ABORT or SIGTERM
+    process->write("ABORT\n");
+    process->terminate();
+    if (!process->waitForFinished(5000)) {
+        process->kill();
+        process->waitForFinished(5000);
+    }
+}
+
+void ChrootSession::onReadyRead() {
+    buffer += process->readAllStandardOutput();
+
+    qsizetype newline;
+    while ((newline = buffer.indexOf('\n')) >= 0) {
+        QByteArray line = buffer.left(newline);
+        buffer.remove(0, newline + 1);
+
+        // Reply: @@DONE <id> <status> <base64 output tail>
+        if (!line.startsWith("@@DONE ")) {
+            continue;
+        }
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.size() < 3) {
+            continue;
+        }
+        int id = fields[1].toInt();
+        int status = fields[2].toInt();
+        QString output = fields.size() > 3 ? QString::fromUtf8(QByteArray::fromBase64(fields[3])) : QString();
+        if (pending.remove(id)) {
+            emit commandFinished(id, status, output);
+        }
+    }
+}
+
+void ChrootSession::onSessionFinished() {
+    // Anything still queued will never report back
+    QString error = QString::fromUtf8(process->readAllStandardError()).trimmed();
+    const QSet<int> lost = pending;
+    pending.clear();
+    for (int id : lost) {
+        emit commandFinished(id, -1, QString("Chroot session ended before the command finished\n%1").arg(error));
+    }
+    qDebug() << "[CHROOT] Session closed:" << error;
+    emit closed();
+}
+
+QString ChrootSession::sessionScript() const {
+    return QString(R"(
+ROOT='%1'
+MOUNTS=()
+LOCK=$(mktemp)
+
+chroot_mount() {
+    local target="$ROOT$1"
+    shift
+    mount "$@" "$target" || { echo "Cannot mount $target" >&2; exit 1; }
+    MOUNTS=("$target" "${MOUNTS[@]}")
+}
+
+# Same API filesystems arch-chroot sets up, once for the whole session
+chroot_mount /proc -t proc proc -o nosuid,noexec,nodev
+chroot_mount /sys -t sysfs sys -o nosuid,noexec,nodev,ro
+if [ -d /sys/firmware/efi/efivars ]; then
+    chroot_mount /sys/firmware/efi/efivars -t efivarfs efivarfs -o nosuid,noexec,nodev
+fi
+chroot_mount /dev -t devtmpfs udev -o mode=0755,nosuid
+chroot_mount /dev/pts -t devpts devpts -o mode=0620,gid=5,nosuid,noexec
+chroot_mount /dev/shm -t tmpfs shm -o mode=1777,nosuid,nodev
+chroot_mount /run -t tmpfs run -o nosuid,nodev,mode=0755
+chroot_mount /tmp -t tmpfs tmp -o mode=1777,strictatime,nodev,nosuid
+if [ -f /etc/resolv.conf ]; then
+    touch "$ROOT/etc/resolv.conf"
+    chroot_mount /etc/resolv.conf --bind /etc/resolv.conf
+fi
+
+# Each script runs as its own job (process group); on abort the groups are
+# killed, which takes the chroot'ed processes below them along
+set -m
+abort_jobs() {
+    local job
+    for job in $(jobs -p); do
+        kill -KILL -- "-$job" 2>/dev/null
+    done
+    rm -f "$LOCK"
+    exit 1
+}
+trap abort_jobs TERM HUP INT
+
+run_command() {
+    local output status
+    output=$(chroot "$ROOT" /bin/bash -c "$2" 2>&1 </dev/null)
+    status=$?
+    # The tail of the output is enough to report a failure
+    output=$(printf '%s' "$output" | tail -c 16384 | base64 -w0)
+    flock "$LOCK" printf '@@DONE %s %s %s\n' "$1" "$status" "$output"
+}
+
+while read -r id payload; do
+    [ "$id" = "EXIT" ] && break
+    [ "$id" = "ABORT" ] && abort_jobs
+    script=$(printf '%s' "$payload" | base64 -d)
+    run_command "$id" "$script" &
+done
+wait
+
+for target in "${MOUNTS[@]}"; do
+    umount "$target" || umount -l "$target"
+done
+rm -f "$LOCK"
+echo "Unmounted ${#MOUNTS[@]} API filesystems from $ROOT" >&2
+)").arg(root);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <QObject>
+#include <QSet>
+#include <QString>
+
+class QProcess;
+
+// One long-lived privileged shell for every command that runs inside the
+// target system.
+//
+// The API filesystems are mounted into the root once, in a private mount
+// namespace, instead of once per arch-chroot call. Scripts are sent over
+// stdin, run concurrently, and report their exit status and output back.
+class ChrootSession : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ChrootSession(const QString &root, QObject *parent = nullptr);
+    ~ChrootSession();
+
+    void start();
+    // Queues a bash script to run inside the root; returns its id
+    int run(const QString &script);
+    bool isRunning() const;
+    // Lets queued scripts finish, then unmounts everything the session
+    // mounted; returns at once, closed() follows
+    void close();
+    // Kills the session and every script it runs; its mounts go away with
+    // the namespace
+    void terminate();
+
+signals:
+    void commandFinished(int id, int exitStatus, const QString &output);
+    void closed();
+
+private slots:
+    void onReadyRead();
+    void onSessionFinished();
+
+private:
+    QString sessionScript() const;
+
+    QString root;
+    QProcess *process;
+    QByteArray buffer;
+    QSet<int> pending;
+    int nextId;
+};
@@ -0,0 +1,87 @@
+#include "devicediscarder.h"
+#include "partitiontablewriter.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+DeviceDiscarder::DeviceDiscarder(const QString &device, Mode mode, QObject *parent)
+    : QObject(parent), device(device), mode(mode), thread(nullptr) {
+}
+
+DeviceDiscarder::~DeviceDiscarder() {
+    wait();
+    delete thread;
+}
+
+bool DeviceDiscarder::supports(const QString &device, Mode mode) {
+    QString name = QFileInfo(QFileInfo(device).canonicalFilePath()).fileName();
+    // Secure erase limits only exist on kernels that split them from discard (6.0+)
+    QFile limit(QString("/sys/class/block/%1/queue/%2").arg(name)
+                .arg(mode == Mode::SecureErase ? "max_secure_erase_sectors" : "discard_max_bytes"));
+    if (!limit.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    return limit.readAll().trimmed().toLongLong() > 0;
+}
+
+void DeviceDiscarder::start() {
+    if (thread) return;
+    thread = QThread::create([this]() {
+        QString message;
+        bool success = run(&message);
+        emit finished(success, message);
+    });
+    thread->start();
+}
+
+void DeviceDiscarder::wait() {
+    if (thread) {
+        thread->wait();
+    }
+}
+
+bool DeviceDiscarder::run(QString *message) {
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!PartitionTableWriter::releaseDevice(device, message)) {
+        return false;
+    }
+
+    int fd = open(device.toLocal8Bit().constData(), O_WRONLY | O_EXCL | O_CLOEXEC);
+    if (fd < 0) {
+        *message = QString("Cannot open %1 for discarding: %2").arg(device).arg(strerror(errno));
+        return false;
+    }
+
+    quint64 size = 0;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+        *message = QString("Cannot query the size of %1: %2").arg(device).arg(strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // The kernel splits the range into requests the device accepts
+    uint64_t range[2] = {0, size};
+    const char *what = (mode == Mode::SecureErase) ? "Secure erase" : "Discard";
+    if (ioctl(fd, mode == Mode::SecureErase ? BLKSECDISCARD : BLKDISCARD, &range) != 0) {
+        *message = QString("%1 of %2 failed: %3").arg(what).arg(device).arg(strerror(errno));
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    *message = QString("%1 of %2 (%3 GB) took %4 s")
+               .arg(what).arg(device)
+               .arg(size / (1000.0 * 1000.0 * 1000.0), 0, 'f', 1)
+               .arg(timer.elapsed() / 1000.0, 0, 'f', 1);
+    return true;
+}
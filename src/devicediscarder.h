@@ -0,0 +1,36 @@
+#pragma once
+#include <QObject>
+#include <QString>
+
+class QThread;
+
+// Discards (or securely erases) a whole block device on a worker thread.
+//
+// Used before a clean install on flash storage so the drive starts with every
+// block free. Anything mounted from the device is released first; the discard
+// itself cannot be interrupted once it has been handed to the kernel.
+class DeviceDiscarder : public QObject {
+    Q_OBJECT
+
+public:
+    enum class Mode { Discard, SecureErase };
+
+    DeviceDiscarder(const QString &device, Mode mode, QObject *parent = nullptr);
+    ~DeviceDiscarder();
+
+    // Whether the device advertises support for mode
+    static bool supports(const QString &device, Mode mode);
+
+    void start();
+    void wait();
+
+signals:
+    void finished(bool success, const QString &message);
+
+private:
+    bool run(QString *message);
+
+    QString device;
+    Mode mode;
+    QThread *thread;
+};
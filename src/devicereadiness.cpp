@@ -0,0 +1,40 @@
+#include "devicereadiness.h"
+
+namespace {
+
+QString elapsedReport(const QString &label) {
+    return QString("echo \"[DEVICE] %1 after $(( ($(date +%s%N) - START) / 1000000 )) ms\"").arg(label);
+}
+
+} // namespace
+
+QString DeviceReadiness::waitForDevices(const QStringList &devices, const QString &label, int timeoutSeconds) {
+    QString quoted = "'" + devices.join("' '") + "'";
+    QStringList script;
+    script << "START=$(date +%s%N)";
+    // udevadm wait (systemd 251+) blocks on udev events until each node is initialized
+    QString block = "if udevadm wait --help >/dev/null 2>&1; then"
+                    + QString(" udevadm wait --settle --timeout=%1 %2 || { echo 'Timed out after %1 s waiting for %3'; exit 1; }")
+                      .arg(timeoutSeconds).arg(quoted).arg(label);
+    // Older udev: settle returns as soon as the node shows up or the queue drains
+    block += QString("; else DEADLINE=$((SECONDS + %1)); for DEV in %2; do until [ -b \"$DEV\" ]; do"
+                      " [ $SECONDS -lt $DEADLINE ] || { echo \"Timed out after %1 s waiting for $DEV\"; exit 1; };"
+                      " udevadm settle --timeout=1 --exit-if-exists=\"$DEV\" 2>/dev/null || true;"
+                      " [ -b \"$DEV\" ] || sleep 0.05; done; done;"
+                      " udevadm settle --timeout=%1 || true; fi")
+             .arg(timeoutSeconds).arg(quoted);
+    script << block;
+    script << elapsedReport(label + " ready");
+    return "(" + script.join("; ") + ")";
+}
+
+QString DeviceReadiness::waitUntilUnused(const QString &mountPoint, const QString &label, int timeoutSeconds) {
+    QStringList script;
+    script << "START=$(date +%s%N)";
+    script << QString("DEADLINE=$((SECONDS + %1))").arg(timeoutSeconds);
+    // Killed processes are gone once fuser stops reporting them; give up quietly at the deadline
+    script << QString("while mountpoint -q '%1' && fuser -m '%1' >/dev/null 2>&1 && [ $SECONDS -lt $DEADLINE ]; do sleep 0.05; done")
+              .arg(mountPoint);
+    script << elapsedReport(label + " released");
+    return "(" + script.join("; ") + ")";
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+
+// Shell fragments that wait for storage to become usable instead of sleeping.
+//
+// Each fragment is a single subshell that can sit in a "&&" chain. It ends as
+// soon as the condition holds and prints a "[DEVICE] <label> ready after N ms"
+// line with the time it actually waited, which the installer logs.
+class DeviceReadiness {
+public:
+    // Waits until every device node exists and udev has finished processing it;
+    // fails once the timeout passes
+    static QString waitForDevices(const QStringList &devices, const QString &label, int timeoutSeconds = 30);
+    // Waits until no process uses the filesystem on mountPoint; never fails
+    static QString waitUntilUnused(const QString &mountPoint, const QString &label, int timeoutSeconds = 10);
+};
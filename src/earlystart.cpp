@@ -0,0 +1,115 @@
+#include "earlystart.h"
+#include "installer.h"
+#include "vminstaller.h"
+#include "vmdetection.h"
+#include "settingsparser.h"
+#include <QDebug>
+#include <QMessageBox>
+
+Installer *EarlyStart::installer = nullptr;
+InstallConfig EarlyStart::layout;
+EarlyStartStatus EarlyStart::status;
+
+bool EarlyStart::isEnabled() {
+    SettingsParser::loadSettings();
+    return SettingsParser::getVariable("early_start", "off") == "on";
+}
+
+bool EarlyStart::sameLayout(const InstallConfig &a, const InstallConfig &b) {
+    return a.partitioningMode == b.partitioningMode && a.selectedDisk == b.selectedDisk &&
+           a.filesystem == b.filesystem && a.enableSwap == b.enableSwap &&
+           a.swapMode == b.swapMode && a.swapSizeMiB == b.swapSizeMiB &&
+           a.hibernation == b.hibernation;
+}
+
+void EarlyStart::offer(QWidget *parent, const InstallConfig &config) {
+    if (!isEnabled()) {
+        return;
+    }
+    if (installer && !status.finished && sameLayout(layout, config)) {
+        qDebug() << "[DEBUG] Early start already running for" << config.selectedDisk;
+        return;
+    }
+    // A run for another layout must not go on, whatever the answer below
+    if (installer) {
+        qDebug() << "[DEBUG] Disk layout changed, abandoning early start";
+        abandon();
+    }
+    
+    QString message = QString("Partitioning %1 and copying the system can start now, "
+                              "while you finish the remaining settings.\n\n"
+                              "All data on %1 will be erased immediately. Start now?")
+                              .arg(config.selectedDisk);
+    int ret = QMessageBox::warning(parent, "Start Disk Preparation", message,
+                                   QMessageBox::Yes | QMessageBox::No, QMessageBox::No);
+    if (ret == QMessageBox::Yes) {
+        begin(config);
+    }
+}
+
+void EarlyStart::begin(const InstallConfig &config) {
+    if (installer) {
+        if (!status.finished && sameLayout(layout, config)) {
+            qDebug() << "[DEBUG] Early start already running for" << config.selectedDisk;
+            return;
+        }
+        qDebug() << "[DEBUG] Disk layout changed, restarting early start";
+        abandon();
+    }
+    
+    layout = config;
+    status = EarlyStartStatus();
+    
+    if (VMDetection::isVirtualMachine()) {
+        installer = new VMInstaller(config);
+    } else {
+        installer = new Installer(config);
+    }
+    
+    QObject::connect(installer, &Installer::progressChanged, [](int percentage, const QString &message) {
+        status.percentage = percentage;
+        status.message = message;
+    });
+    QObject::connect(installer, &Installer::installationFinished, [](bool success, const QString &message) {
+        status.finished = true;
+        status.success = success;
+        status.result = message;
+        if (!success) {
+            qDebug() << "[ERROR] Early start failed:" << message;
+        }
+    });
+    
+    qDebug() << "[DEBUG] Early start: preparing" << config.selectedDisk << "while the wizard is open";
+    installer->holdBeforeConfiguration();
+    installer->startInstallation();
+}
+
+Installer *EarlyStart::takeInstaller(QObject *parent, const InstallConfig &config, EarlyStartStatus *currentStatus) {
+    Installer *running = installer;
+    if (!running) {
+        return nullptr;
+    }
+    if (!sameLayout(layout, config)) {
+        qDebug() << "[WARNING] Early start prepared a different disk layout, abandoning it";
+        abandon();
+        return nullptr;
+    }
+    
+    QObject::disconnect(running, nullptr, nullptr, nullptr);
+    running->setParent(parent);
+    *currentStatus = status;
+    installer = nullptr;
+    return running;
+}
+
+void EarlyStart::abandon() {
+    if (!installer) {
+        return;
+    }
+    QObject::disconnect(installer, nullptr, nullptr, nullptr);
+    if (!status.finished) {
+        installer->cancelInstallation();
+    }
+    delete installer;
+    installer = nullptr;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <QString>
+#include "installconfig.h"
+
+class Installer;
+class QObject;
+class QWidget;
+
+struct EarlyStartStatus {
+    int percentage = 0;
+    QString message;
+    bool finished = false;
+    bool success = false;
+    QString result;
+};
+
+// Opt-in (early_start=on): partitioning, formatting, mounting and base system
+// installation start as soon as the disk layout is confirmed and run while the
+// user fills in the rest of the wizard. Tasks that need the user settings
+// wait until InstallProgressWindow takes the installer over.
+class EarlyStart {
+public:
+    static bool isEnabled();
+    // Called when a disk layout is confirmed: keeps a run for the same layout,
+    // otherwise drops it and asks before erasing the disk for the new one
+    static void offer(QWidget *parent, const InstallConfig &config);
+    static void begin(const InstallConfig &config);
+    // Hands the running installer to its new owner, nullptr if none was started
+    // or if it prepares a different layout than config
+    static Installer *takeInstaller(QObject *parent, const InstallConfig &config, EarlyStartStatus *status);
+    static void abandon();
+
+private:
+    static bool sameLayout(const InstallConfig &a, const InstallConfig &b);
+
+    static Installer *installer;
+    static InstallConfig layout;
+    static EarlyStartStatus status;
+};
@@ -0,0 +1,268 @@
+#include "efibootentry.h"
+#include "storageprofile.h"
+#include <QByteArray>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+
+const char *efivarsDirectory = "/sys/firmware/efi/efivars";
+const char *globalGuid = "8be4df61-93ca-11d2-aa0d-00e098032b8c";
+
+// EFI_VARIABLE_NON_VOLATILE | BOOTSERVICE_ACCESS | RUNTIME_ACCESS
+constexpr quint32 variableAttributes = 0x7;
+constexpr quint32 loadOptionActive = 0x1;
+
+void appendLe(QByteArray *data, quint64 value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        data->append(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+quint64 readLe(const QByteArray &data, int offset, int bytes) {
+    quint64 value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+    }
+    return value;
+}
+
+void appendUcs2(QByteArray *data, const QString &text) {
+    for (QChar c : text) {
+        appendLe(data, c.unicode(), 2);
+    }
+    appendLe(data, 0, 2);
+}
+
+QString variablePath(const QString &name) {
+    return QString("%1/%2-%3").arg(efivarsDirectory).arg(name).arg(globalGuid);
+}
+
+QString bootVariable(quint16 number) {
+    return "Boot" + QString("%1").arg(number, 4, 16, QChar('0')).toUpper();
+}
+
+// Variable data without the leading attributes
+bool readVariable(const QString &name, QByteArray *data) {
+    QFile file(variablePath(name));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray content = file.readAll();
+    if (content.size() < 4) {
+        return false;
+    }
+    *data = content.mid(4);
+    return true;
+}
+
+bool writeVariable(const QString &name, const QByteArray &data, QString *error) {
+    QByteArray path = variablePath(name).toLocal8Bit();
+
+    // efivarfs marks existing variables immutable
+    int fd = open(path.constData(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        int flags = 0;
+        if (ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 && (flags & FS_IMMUTABLE_FL)) {
+            flags &= ~FS_IMMUTABLE_FL;
+            ioctl(fd, FS_IOC_SETFLAGS, &flags);
+        }
+        close(fd);
+    }
+
+    // The attributes and the data have to arrive in a single write
+    QByteArray buffer;
+    appendLe(&buffer, variableAttributes, 4);
+    buffer.append(data);
+    fd = open(path.constData(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        *error = QString("Cannot open %1: %2").arg(variablePath(name)).arg(strerror(errno));
+        return false;
+    }
+    ssize_t written = write(fd, buffer.constData(), buffer.size());
+    int writeErrno = errno;
+    close(fd);
+    if (written != buffer.size()) {
+        *error = QString("Cannot write EFI variable %1: %2").arg(name).arg(strerror(writeErrno));
+        return false;
+    }
+    return true;
+}
+
+QString loadOptionLabel(const QByteArray &option) {
+    // attributes (4), file path list length (2), then the UCS-2 description
+    QString label;
+    for (int offset = 6; offset + 1 < option.size(); offset += 2) {
+        ushort c = static_cast<ushort>(readLe(option, offset, 2));
+        if (c == 0) {
+            break;
+        }
+        label += QChar(c);
+    }
+    return label;
+}
+
+qint64 readSysfsNumber(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    bool ok = false;
+    qint64 value = file.readAll().trimmed().toLongLong(&ok);
+    return ok ? value : -1;
+}
+
+// MEDIA_DEVICE_PATH / MEDIA_HARDDRIVE_DP for the partition
+bool hardDriveNode(const QString &partition, QByteArray *node, QString *error) {
+    QString name = QFileInfo(QFileInfo(partition).canonicalFilePath()).fileName();
+    QString sysPath = "/sys/class/block/" + name;
+    qint64 number = readSysfsNumber(sysPath + "/partition");
+    qint64 start = readSysfsNumber(sysPath + "/start");
+    qint64 size = readSysfsNumber(sysPath + "/size");
+    QString disk = StorageProfile::detect(partition).disk;
+    qint64 sectorSize = readSysfsNumber(QString("/sys/block/%1/queue/logical_block_size").arg(QFileInfo(disk).fileName()));
+    if (number <= 0 || start < 0 || size <= 0 || sectorSize <= 0) {
+        *error = QString("Cannot find %1 in sysfs").arg(partition);
+        return false;
+    }
+
+    int fd = open(disk.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = QString("Cannot open %1: %2").arg(disk).arg(strerror(errno));
+        return false;
+    }
+    QByteArray header(512, '\0');
+    QByteArray mbr(512, '\0');
+    bool ok = pread(fd, header.data(), header.size(), sectorSize) == header.size() &&
+              pread(fd, mbr.data(), mbr.size(), 0) == mbr.size();
+
+    QByteArray signature;
+    int format = 0;
+    if (ok && header.startsWith("EFI PART")) {
+        // The partition GUID from the GPT entry, already in EFI byte order
+        quint64 entriesLba = readLe(header, 72, 8);
+        quint64 entrySize = readLe(header, 84, 4);
+        QByteArray entry(128, '\0');
+        ok = entrySize >= 128 &&
+             pread(fd, entry.data(), entry.size(), entriesLba * sectorSize + (number - 1) * entrySize) == entry.size();
+        signature = entry.mid(16, 16);
+        format = 2;
+    } else if (ok) {
+        signature = mbr.mid(440, 4) + QByteArray(12, '\0');
+        format = 1;
+    }
+    close(fd);
+    if (!ok) {
+        *error = QString("Cannot read the partition table of %1").arg(disk);
+        return false;
+    }
+
+    node->clear();
+    node->append(static_cast<char>(0x04));   // media device path
+    node->append(static_cast<char>(0x01));   // hard drive
+    appendLe(node, 42, 2);
+    appendLe(node, number, 4);
+    appendLe(node, start * 512 / sectorSize, 8);
+    appendLe(node, size * 512 / sectorSize, 8);
+    node->append(signature);
+    node->append(static_cast<char>(format));
+    node->append(static_cast<char>(format == 2 ? 2 : 1));   // GUID or MBR signature
+    return true;
+}
+
+} // namespace
+
+bool EfiBootEntry::available() {
+    return !QDir(efivarsDirectory).entryList(QDir::Files).isEmpty();
+}
+
+bool EfiBootEntry::create(const QString &espPartition, const QString &loader, const QString &label, QString *error) {
+    QByteArray devicePath;
+    if (!hardDriveNode(espPartition, &devicePath, error)) {
+        return false;
+    }
+    // MEDIA_FILEPATH_DP with a backslash path, then the end node
+    QByteArray filePath;
+    appendUcs2(&filePath, QString(loader).replace('/', '\\'));
+    devicePath.append(static_cast<char>(0x04));
+    devicePath.append(static_cast<char>(0x04));
+    appendLe(&devicePath, 4 + filePath.size(), 2);
+    devicePath.append(filePath);
+    devicePath.append(static_cast<char>(0x7f));
+    devicePath.append(static_cast<char>(0xff));
+    appendLe(&devicePath, 4, 2);
+
+    QByteArray option;
+    appendLe(&option, loadOptionActive, 4);
+    appendLe(&option, devicePath.size(), 2);
+    appendUcs2(&option, label);
+    option.append(devicePath);
+
+    // Reuse the entry of an earlier installation with the same label,
+    // otherwise take the lowest free number
+    QStringList existing = QDir(efivarsDirectory).entryList(QStringList() << QString("Boot[0-9A-F][0-9A-F][0-9A-F][0-9A-F]-%1").arg(globalGuid), QDir::Files);
+    int number = -1;
+    QList<int> used;
+    for (const QString &file : existing) {
+        bool isNumber = false;
+        int candidate = file.mid(4, 4).toInt(&isNumber, 16);
+        if (!isNumber) {
+            continue;
+        }
+        used << candidate;
+        QByteArray current;
+        if (number < 0 && readVariable(bootVariable(candidate), &current) && loadOptionLabel(current) == label) {
+            number = candidate;
+        }
+    }
+    for (int candidate = 0; number < 0 && candidate <= 0xffff; ++candidate) {
+        if (!used.contains(candidate)) {
+            number = candidate;
+        }
+    }
+    if (number < 0) {
+        *error = "No free boot entry number";
+        return false;
+    }
+
+    QString variable = bootVariable(number);
+    if (!writeVariable(variable, option, error)) {
+        return false;
+    }
+
+    QByteArray order;
+    QByteArray currentOrder;
+    appendLe(&order, number, 2);
+    if (readVariable("BootOrder", &currentOrder)) {
+        for (int offset = 0; offset + 1 < currentOrder.size(); offset += 2) {
+            if (readLe(currentOrder, offset, 2) != static_cast<quint64>(number)) {
+                order.append(currentOrder.mid(offset, 2));
+            }
+        }
+    }
+    if (!writeVariable("BootOrder", order, error)) {
+        return false;
+    }
+
+    // Firmware may refuse writes silently (e.g. full NVRAM); read both back
+    QByteArray stored;
+    if (!readVariable(variable, &stored) || stored != option) {
+        *error = QString("%1 did not persist in NVRAM").arg(variable);
+        return false;
+    }
+    if (!readVariable("BootOrder", &stored) || stored.size() < 2 || readLe(stored, 0, 2) != static_cast<quint64>(number)) {
+        *error = QString("BootOrder does not start with %1").arg(variable);
+        return false;
+    }
+    qDebug() << QString("[EFI] %1 \"%2\" -> %3 on %4, first in BootOrder").arg(variable).arg(label).arg(loader).arg(espPartition);
+    return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <QString>
+
+// Creates UEFI boot entries by writing Boot#### and BootOrder through
+// efivarfs, as efibootmgr --create does, without running anything.
+//
+// The entry is a hard drive media path (partition number, start, size and
+// GPT partition GUID or MBR signature) followed by the loader's file path.
+// An entry with the same label is replaced rather than duplicated.
+class EfiBootEntry {
+public:
+    // The system was booted in UEFI mode and efivarfs is mounted
+    static bool available();
+    // Points a boot entry named label at loader (e.g. /EFI/arch7z/grubx64.efi)
+    // on espPartition, puts it first in BootOrder and reads both back
+    static bool create(const QString &espPartition, const QString &loader, const QString &label, QString *error);
+};
@@ -0,0 +1,223 @@
+#include "foreignosprober.h"
+#include "storageprofile.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QThread>
+#include <QTimer>
+#include <atomic>
+#include <memory>
+#include <unistd.h>
+
+namespace {
+
+struct ProbeState {
+    QMutex mutex;
+    QThread *thread = nullptr;
+    std::atomic<bool> cancelled{false};
+    bool available = false;
+    QMap<QString, QList<ForeignOs>> cache;   // by partition
+};
+
+ProbeState &state() {
+    static ProbeState probe;
+    return probe;
+}
+
+// Returns false if the program failed or the probe was cancelled
+bool runProbe(const QString &program, const QStringList &arguments, QString *output) {
+    QProcess process;
+    process.start(program, arguments);
+    if (!process.waitForStarted()) {
+        return false;
+    }
+    while (!process.waitForFinished(200)) {
+        if (state().cancelled) {
+            process.terminate();
+            process.waitForFinished(5000);
+            return false;
+        }
+    }
+    *output = QString::fromUtf8(process.readAllStandardOutput());
+    return process.exitStatus() == QProcess::NormalExit;
+}
+
+BlockIdentity readIdentity(const QString &device) {
+    BlockIdentity identity;
+    QString output;
+    if (!runProbe("blkid", QStringList() << "-o" << "export" << device, &output)) {
+        return identity;
+    }
+    for (const QString &line : output.split('\n', Qt::SkipEmptyParts)) {
+        if (line.startsWith("UUID=")) {
+            identity.uuid = line.mid(5);
+        } else if (line.startsWith("TYPE=")) {
+            identity.fsType = line.mid(5);
+        } else if (line.startsWith("PART_ENTRY_SCHEME=")) {
+            identity.partitionMap = line.mid(18) == "dos" ? "msdos" : line.mid(18);
+        }
+    }
+    return identity;
+}
+
+void runOsProber() {
+    ProbeState &probe = state();
+
+    if (geteuid() != 0) {
+        qDebug() << "[OSPROBER] Not running as root, other systems are probed by grub-mkconfig";
+        return;
+    }
+    QString osProber = QStandardPaths::findExecutable("os-prober");
+    if (osProber.isEmpty()) {
+        qDebug() << "[OSPROBER] os-prober not found";
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QString output;
+    // os-prober exits 0 with no output when it finds nothing
+    if (!runProbe(osProber, QStringList(), &output)) {
+        qDebug() << "[OSPROBER] os-prober did not complete";
+        return;
+    }
+
+    QMap<QString, QList<ForeignOs>> found;
+    for (const QString &line : output.split('\n', Qt::SkipEmptyParts)) {
+        // device[@loader]:long name:short name:type
+        QStringList fields = line.split(':');
+        if (fields.size() < 4) {
+            continue;
+        }
+        ForeignOs os;
+        os.line = line;
+        os.partition = fields[0].section('@', 0, 0);
+        os.loader = fields[0].section('@', 1);
+        os.disk = StorageProfile::detect(os.partition).disk;
+        os.longName = fields[1].isEmpty() ? fields[2] : fields[1];
+        os.shortName = fields[2];
+        os.type = fields[3];
+        os.volumes.insert(os.partition, readIdentity(os.partition));
+
+        if (os.type == "linux") {
+            QString bootEntries;
+            if (runProbe("linux-boot-prober", QStringList() << os.partition, &bootEntries)) {
+                os.bootEntries = bootEntries.split('\n', Qt::SkipEmptyParts);
+            }
+            // root:boot:label:kernel:initrd:parameters
+            for (const QString &entry : os.bootEntries) {
+                QString boot = entry.section(':', 1, 1);
+                if (!boot.isEmpty() && !os.volumes.contains(boot)) {
+                    os.volumes.insert(boot, readIdentity(boot));
+                }
+            }
+        }
+        if (probe.cancelled) {
+            return;
+        }
+        qDebug() << QString("[OSPROBER] %1 on %2 (%3)").arg(os.longName).arg(os.partition).arg(os.type);
+        found[os.partition] << os;
+    }
+
+    qDebug() << QString("[OSPROBER] Probed in %1 ms, %2 other systems found").arg(timer.elapsed()).arg(found.size());
+    QMutexLocker locker(&probe.mutex);
+    probe.cache = found;
+    probe.available = true;
+}
+
+} // namespace
+
+void ForeignOsProber::start() {
+    ProbeState &probe = state();
+    QMutexLocker locker(&probe.mutex);
+    if (probe.thread) return;
+
+    probe.cancelled = false;
+    probe.available = false;
+    probe.cache.clear();
+    probe.thread = QThread::create(runOsProber);
+    probe.thread->start(QThread::LowPriority);
+}
+
+void ForeignOsProber::wait() {
+    ProbeState &probe = state();
+    QThread *thread = nullptr;
+    {
+        QMutexLocker locker(&probe.mutex);
+        thread = probe.thread;
+    }
+    if (thread && !thread->isFinished()) {
+        // os-prober has other disks' partitions mounted while it runs
+        qDebug() << "[OSPROBER] Waiting for os-prober to finish before touching the disks";
+        thread->wait();
+    }
+}
+
+void ForeignOsProber::whenFinished(QObject *context, const std::function<void()> &callback) {
+    ProbeState &probe = state();
+    QThread *thread = nullptr;
+    {
+        QMutexLocker locker(&probe.mutex);
+        thread = probe.thread;
+    }
+    if (!thread || thread->isFinished()) {
+        callback();
+        return;
+    }
+    
+    // finished() may fire between connecting and checking; call back only once
+    auto called = std::make_shared<bool>(false);
+    auto once = [called, callback]() {
+        if (!*called) {
+            *called = true;
+            callback();
+        }
+    };
+    QObject::connect(thread, &QThread::finished, context, once, Qt::QueuedConnection);
+    if (thread->isFinished()) {
+        QTimer::singleShot(0, context, once);
+    }
+}
+
+void ForeignOsProber::shutdown() {
+    ProbeState &probe = state();
+    QThread *thread = nullptr;
+    {
+        QMutexLocker locker(&probe.mutex);
+        thread = probe.thread;
+        probe.thread = nullptr;
+    }
+    if (thread) {
+        probe.cancelled = true;
+        thread->wait();
+        delete thread;
+    }
+}
+
+bool ForeignOsProber::available() {
+    wait();
+    ProbeState &probe = state();
+    QMutexLocker locker(&probe.mutex);
+    return probe.available;
+}
+
+QList<ForeignOs> ForeignOsProber::results(const QStringList &excluded) {
+    wait();
+    ProbeState &probe = state();
+    QMutexLocker locker(&probe.mutex);
+
+    QList<ForeignOs> systems;
+    for (auto it = probe.cache.constBegin(); it != probe.cache.constEnd(); ++it) {
+        // The cache predates partitioning; entries on rewritten disks are gone
+        const ForeignOs &first = it.value().first();
+        if (excluded.contains(it.key()) || excluded.contains(first.disk)) {
+            qDebug() << "[OSPROBER] Dropping entries on" << it.key() << "(overwritten by the installation)";
+            continue;
+        }
+        systems << it.value();
+    }
+    return systems;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+class QObject;
+
+// What GRUB needs to find a partition
+struct BlockIdentity {
+    QString uuid;
+    QString fsType;           // as blkid reports it, e.g. ntfs or vfat
+    QString partitionMap;     // gpt or msdos
+};
+
+// An operating system os-prober found on another partition
+struct ForeignOs {
+    QString partition;        // e.g. /dev/nvme0n1p1 (the ESP for efi entries)
+    QString disk;             // the disk holding partition, when probed
+    QString loader;           // EFI loader path on the partition, efi entries only
+    QString longName;         // e.g. "Windows Boot Manager"
+    QString shortName;        // e.g. "Windows"
+    QString type;             // efi, chain, linux, macosx or hurd
+    QString line;             // the os-prober output line itself
+    QStringList bootEntries;  // linux-boot-prober lines, linux entries only
+    // partition and, for linux entries, every boot partition they name
+    QMap<QString, BlockIdentity> volumes;
+};
+
+// Runs os-prober while the wizard is open.
+//
+// Started at application launch. os-prober mounts and inspects every
+// partition of every disk, which takes long on machines with several drives;
+// done up front, grub.cfg is generated from the cached results instead. The
+// probe has to be finished before the installer touches any disk; the
+// installer learns about it through whenFinished() rather than blocking.
+class ForeignOsProber {
+public:
+    static void start();
+    static void wait();
+    static void shutdown();
+    // Calls callback on context's thread once the probe ended (at once if it
+    // never started or already ended), without blocking the caller
+    static void whenFinished(QObject *context, const std::function<void()> &callback);
+
+    // False when os-prober is missing, could not run as root or was cut short
+    static bool available();
+    // Everything found, minus entries on excluded partitions or on partitions
+    // of excluded disks
+    static QList<ForeignOs> results(const QStringList &excluded = QStringList());
+};
@@ -0,0 +1,156 @@
+#include "fstabgenerator.h"
+#include "storageprofile.h"
+#include <QDebug>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr qint64 EXT4_SUPERBLOCK = 1024;
+constexpr qint64 BTRFS_SUPERBLOCK = 64 * 1024;
+
+bool readAt(int fd, qint64 offset, unsigned char *buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + static_cast<qint64>(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+QString formatUuid(const unsigned char *bytes) {
+    QString hex = QString::fromLatin1(QByteArray(reinterpret_cast<const char *>(bytes), 16).toHex());
+    return QString("%1-%2-%3-%4-%5").arg(hex.mid(0, 8)).arg(hex.mid(8, 4)).arg(hex.mid(12, 4))
+                                    .arg(hex.mid(16, 4)).arg(hex.mid(20, 12));
+}
+
+bool isNullUuid(const unsigned char *bytes) {
+    return std::all_of(bytes, bytes + 16, [](unsigned char b) { return b == 0; });
+}
+
+} // namespace
+
+QString FstabGenerator::mountOptions(const QString &type, const QString &device, const QString &subvolume) {
+    QString options = StorageProfile::detect(device).mountOptions(type);
+    if (type == "btrfs" && !subvolume.isEmpty()) {
+        options += ",subvol=/" + subvolume;
+    }
+    return options;
+}
+
+bool FstabGenerator::readUuid(const QString &device, const QString &type, QString *uuid, QString *error) {
+    int fd = open(device.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = QString("Cannot open %1: %2").arg(device).arg(strerror(errno));
+        return false;
+    }
+
+    // Only the expected superblock is read: a reformatted partition may
+    // still carry a stale signature of its previous filesystem elsewhere
+    unsigned char block[4096];
+    bool found = false;
+
+    if (type == "ext4") {
+        // Magic 0xEF53 at 0x38, s_uuid at 0x68
+        if (readAt(fd, EXT4_SUPERBLOCK, block, 1024) && block[0x38] == 0x53 && block[0x39] == 0xEF) {
+            *uuid = formatUuid(block + 0x68);
+            found = !isNullUuid(block + 0x68);
+        }
+    } else if (type == "btrfs") {
+        // "_BHRfS_M" at 0x40, fsid at 0x20
+        if (readAt(fd, BTRFS_SUPERBLOCK, block, 4096) && memcmp(block + 0x40, "_BHRfS_M", 8) == 0) {
+            *uuid = formatUuid(block + 0x20);
+            found = !isNullUuid(block + 0x20);
+        }
+    } else if (type == "swap") {
+        // "SWAPSPACE2" at the end of the first page, UUID at 1024 + 12
+        for (long page : {sysconf(_SC_PAGESIZE), 4096L, 16384L, 65536L}) {
+            if (page < 4096 || page > 65536) continue;
+            unsigned char signature[10];
+            if (readAt(fd, page - 10, signature, 10) && memcmp(signature, "SWAPSPACE2", 10) == 0 &&
+                readAt(fd, 1024 + 12, block, 16)) {
+                *uuid = formatUuid(block);
+                found = !isNullUuid(block);
+                break;
+            }
+        }
+    } else if (type == "vfat") {
+        // Volume serial at 0x43 (FAT32) or 0x27 (FAT12/16), shown as XXXX-XXXX
+        if (readAt(fd, 0, block, 512) && block[510] == 0x55 && block[511] == 0xAA) {
+            int serial = -1;
+            if (memcmp(block + 0x52, "FAT32   ", 8) == 0) {
+                serial = 0x43;
+            } else if (memcmp(block + 0x36, "FAT1", 4) == 0) {
+                serial = 0x27;
+            }
+            if (serial >= 0) {
+                *uuid = QString("%1%2-%3%4")
+                        .arg(block[serial + 3], 2, 16, QChar('0')).arg(block[serial + 2], 2, 16, QChar('0'))
+                        .arg(block[serial + 1], 2, 16, QChar('0')).arg(block[serial], 2, 16, QChar('0'))
+                        .toUpper();
+                found = true;
+            }
+        }
+    }
+
+    close(fd);
+    if (!found) {
+        *error = QString("No %1 filesystem with a UUID on %2").arg(type).arg(device);
+    }
+    return found;
+}
+
+QString FstabGenerator::generate(const QList<FstabEntry> &entries, QString *error) {
+    // Parents before children, swap last
+    QList<FstabEntry> sorted = entries;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const FstabEntry &a, const FstabEntry &b) {
+        if ((a.type == "swap") != (b.type == "swap")) {
+            return b.type == "swap";
+        }
+        return a.mountPoint < b.mountPoint;
+    });
+
+    QStringList uuids;
+    for (const FstabEntry &entry : sorted) {
+        if (entry.file) {
+            uuids << QString();
+            continue;
+        }
+        QString uuid;
+        if (!readUuid(entry.device, entry.type, &uuid, error)) {
+            return QString();
+        }
+        qDebug() << "[DEBUG] fstab:" << entry.device << "->" << entry.mountPoint << entry.type << "UUID=" + uuid;
+        uuids << uuid;
+    }
+    return render(sorted, uuids);
+}
+
+QString FstabGenerator::render(const QList<FstabEntry> &entries, const QStringList &uuids) {
+    QString fstab = "# Static information about the filesystems.\n"
+                    "# See fstab(5) for details.\n\n"
+                    "# <file system> <dir> <type> <options> <dump> <pass>\n";
+
+    for (int i = 0; i < entries.size() && i < uuids.size(); ++i) {
+        const FstabEntry &entry = entries[i];
+        // btrfs checks itself at mount time, fsck only ext4 and FAT
+        int pass = 0;
+        if (entry.type == "ext4" || entry.type == "vfat") {
+            pass = entry.mountPoint == "/" ? 1 : 2;
+        }
+        if (entry.file) {
+            fstab += QString("\n%1\t%2\t%3\t%4\t0 0\n")
+                     .arg(entry.device).arg(entry.mountPoint).arg(entry.type).arg(entry.options);
+            continue;
+        }
+        fstab += QString("\n# %1\nUUID=%2\t%3\t%4\t%5\t0 %6\n")
+                 .arg(entry.device).arg(uuids[i]).arg(entry.mountPoint)
+                 .arg(entry.type).arg(entry.options).arg(pass);
+    }
+    return fstab;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <QList>
+#include <QString>
+
+// One filesystem the installer mounted (or swap it enabled) on the target
+struct FstabEntry {
+    QString device;
+    QString mountPoint;   // "none" for swap
+    QString type;         // btrfs, ext4, vfat or swap
+    QString options;
+    bool file = false;    // device is a path on the target (swap files)
+};
+
+// Builds /etc/fstab from the installer's own mount table.
+//
+// UUIDs come straight from the superblocks on the devices, so nothing is
+// scanned and the output only depends on the entries and what mkfs wrote.
+// mountOptions() is used for the live mounts as well, so the installed system
+// boots with the options the installer ran with.
+class FstabGenerator {
+public:
+    // Options from the device's storage profile, plus the btrfs subvolume
+    static QString mountOptions(const QString &type, const QString &device, const QString &subvolume = QString());
+    // Reads the UUID (the volume serial for vfat) from the superblock of type
+    static bool readUuid(const QString &device, const QString &type, QString *uuid, QString *error);
+    // Returns an empty string and sets error if a device cannot be identified
+    static QString generate(const QList<FstabEntry> &entries, QString *error);
+    // Formats entries whose devices are already resolved to UUIDs (empty for
+    // file entries), in entry order
+    static QString render(const QList<FstabEntry> &entries, const QStringList &uuids);
+};
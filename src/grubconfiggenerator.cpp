@@ -0,0 +1,637 @@
+#include "grubconfiggenerator.h"
+#include "storageprofile.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSet>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+const char *stubDirectory = "/usr/local/sbin";
+
+// Templates whose output generate() reproduces; 20_linux_xen only adds
+// entries when Xen is installed
+const QStringList stockScripts = {"00_header", "10_linux", "20_linux_xen", "25_bli", "30_os-prober",
+                                  "30_uefi-firmware", "40_custom", "41_custom"};
+
+const QStringList supportedKeys = {"GRUB_DEFAULT", "GRUB_SAVEDEFAULT", "GRUB_TIMEOUT", "GRUB_TIMEOUT_STYLE",
+                                   "GRUB_DISTRIBUTOR", "GRUB_CMDLINE_LINUX", "GRUB_CMDLINE_LINUX_DEFAULT",
+                                   "GRUB_CMDLINE_LINUX_RECOVERY", "GRUB_PRELOAD_MODULES", "GRUB_TERMINAL",
+                                   "GRUB_TERMINAL_INPUT", "GRUB_TERMINAL_OUTPUT", "GRUB_GFXMODE",
+                                   "GRUB_GFXPAYLOAD_LINUX", "GRUB_THEME", "GRUB_DISABLE_RECOVERY",
+                                   "GRUB_DISABLE_SUBMENU", "GRUB_DISABLE_OS_PROBER"};
+
+// Keys that are only fine with their default behaviour
+const QMap<QString, QString> fixedKeys = {{"GRUB_ENABLE_CRYPTODISK", "n"},
+                                          {"GRUB_DISABLE_LINUX_UUID", "false"},
+                                          {"GRUB_DISABLE_LINUX_PARTUUID", "true"}};
+
+QString quoted(const QString &text) {
+    // grub_quote: single quotes, with embedded ones closed and escaped
+    return "'" + QString(text).replace("'", "'\\''") + "'";
+}
+
+QString grubModule(const QString &fsType) {
+    if (fsType == "ext2" || fsType == "ext3" || fsType == "ext4") {
+        return "ext2";
+    }
+    if (fsType == "vfat") {
+        return "fat";
+    }
+    return fsType;
+}
+
+// prepare_grub_to_access_device, without the BIOS drive hints
+QStringList accessDevice(const QString &partitionMap, const QString &fsType, const QString &uuid) {
+    QStringList lines;
+    if (!partitionMap.isEmpty()) {
+        lines << "insmod part_" + partitionMap;
+    }
+    lines << "insmod " + grubModule(fsType);
+    lines << "search --no-floppy --fs-uuid --set=root " + uuid;
+    return lines;
+}
+
+QString indented(const QStringList &lines, const QString &indent) {
+    QString text;
+    for (const QString &line : lines) {
+        text += indent + line + "\n";
+    }
+    return text;
+}
+
+QString joined(const QStringList &parts) {
+    QStringList nonEmpty;
+    for (const QString &part : parts) {
+        if (!part.trimmed().isEmpty()) {
+            nonEmpty << part.trimmed();
+        }
+    }
+    return nonEmpty.join(" ");
+}
+
+QString section(const QString &script, const QString &body) {
+    return QString("### BEGIN /etc/grub.d/%1 ###\n%2### END /etc/grub.d/%1 ###\n\n").arg(script).arg(body);
+}
+
+QString timeoutCode(const QString &style, const QString &timeout) {
+    QString code = QString("if [ x$feature_timeout_style = xy ] ; then\n"
+                           "  set timeout_style=%1\n"
+                           "  set timeout=%2\n").arg(style).arg(timeout);
+    if (style == "countdown" || style == "hidden") {
+        code += QString("# Fallback hidden-timeout code in case the timeout_style feature is\n"
+                        "# unavailable.\n"
+                        "elif sleep%1 --interruptible %2 ; then\n"
+                        "  set timeout=0\n"
+                        "fi\n").arg(style == "countdown" ? " --verbose" : "").arg(timeout);
+    } else {
+        code += QString("# Fallback normal timeout code in case the timeout_style feature is\n"
+                        "# unavailable.\n"
+                        "else\n"
+                        "  set timeout=%1\n"
+                        "fi\n").arg(timeout);
+    }
+    return code;
+}
+
+QString readLang(const QString &root) {
+    QFile file(root + "/etc/locale.conf");
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return QString();
+    }
+    for (const QString &line : QString::fromUtf8(file.readAll()).split('\n')) {
+        if (line.startsWith("LANG=")) {
+            return line.mid(5).remove('"').section('.', 0, 0);
+        }
+    }
+    return QString();
+}
+
+} // namespace
+
+QString GrubConfigGenerator::configPath() {
+    return "/boot/grub/grub.cfg";
+}
+
+QString GrubConfigGenerator::partitionMap(const QString &device) {
+    QString disk = StorageProfile::detect(device).disk;
+    int fd = open(disk.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return "msdos";
+    }
+    // The GPT header is in LBA 1, on 512-byte or 4 KiB sector disks
+    bool gpt = false;
+    for (off_t offset : {off_t(512), off_t(4096)}) {
+        char signature[8];
+        if (pread(fd, signature, sizeof(signature), offset) == sizeof(signature) &&
+            memcmp(signature, "EFI PART", sizeof(signature)) == 0) {
+            gpt = true;
+            break;
+        }
+    }
+    close(fd);
+    return gpt ? "gpt" : "msdos";
+}
+
+bool GrubConfigGenerator::readDefaults(const QString &root, QMap<QString, QString> *settings, QString *error) {
+    QFile file(root + "/etc/default/grub");
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        *error = "Cannot read /etc/default/grub";
+        return false;
+    }
+
+    QRegularExpression assignment("^(GRUB_[A-Z0-9_]+)=(.*)$");
+    for (QString line : QString::fromUtf8(file.readAll()).split('\n')) {
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QRegularExpressionMatch match = assignment.match(line);
+        if (!match.hasMatch()) {
+            *error = "/etc/default/grub has shell code: " + line;
+            return false;
+        }
+        QString key = match.captured(1);
+        QString value = match.captured(2);
+        if (value.size() >= 2 && (value.startsWith('"') || value.startsWith('\'')) && value.endsWith(value[0])) {
+            value = value.mid(1, value.size() - 2);
+        }
+        if (value.contains('$') || value.contains('`') || value.contains('"') || value.contains('\'')) {
+            *error = QString("%1 in /etc/default/grub needs the shell to expand").arg(key);
+            return false;
+        }
+        if (fixedKeys.contains(key)) {
+            if (!value.isEmpty() && value != fixedKeys.value(key)) {
+                *error = QString("%1=%2 is not supported").arg(key).arg(value);
+                return false;
+            }
+            continue;
+        }
+        if (!supportedKeys.contains(key) && !value.isEmpty()) {
+            *error = QString("%1 is not supported").arg(key);
+            return false;
+        }
+        settings->insert(key, value);
+    }
+    return true;
+}
+
+QString GrubConfigGenerator::generate(const QString &root, const GrubTarget &target,
+                                      const QList<ForeignOs> &foreign, QString *error) {
+    QMap<QString, QString> settings;
+    if (!readDefaults(root, &settings, error)) {
+        return QString();
+    }
+
+    // grub-mkconfig runs the executable scripts, minus editor backups
+    QSet<QString> scripts;
+    for (const QFileInfo &script : QDir(root + "/etc/grub.d").entryInfoList(QDir::Files, QDir::Name)) {
+        QString name = script.fileName();
+        if (!script.isExecutable() || name.endsWith('~') || (name.startsWith('#') && name.endsWith('#'))) {
+            continue;
+        }
+        if (!stockScripts.contains(name)) {
+            *error = QString("/etc/grub.d/%1 is not a stock template").arg(name);
+            return QString();
+        }
+        scripts.insert(name);
+    }
+    if (scripts.contains("20_linux_xen") && !QDir(root + "/boot").entryList(QStringList() << "xen*", QDir::Files).isEmpty()) {
+        *error = "Xen is installed";
+        return QString();
+    }
+    if (scripts.contains("30_uefi-firmware")) {
+        // Older templates call fwsetup unconditionally
+        QFile firmware(root + "/etc/grub.d/30_uefi-firmware");
+        if (!firmware.open(QIODevice::ReadOnly) || !firmware.readAll().contains("--is-supported")) {
+            *error = "30_uefi-firmware is from an older GRUB";
+            return QString();
+        }
+    }
+    for (const ForeignOs &os : foreign) {
+        if (os.type != "efi" && os.type != "chain" && os.type != "linux") {
+            *error = QString("%1 on %2 is a %3 entry").arg(os.longName).arg(os.partition).arg(os.type);
+            return QString();
+        }
+    }
+
+    // Newest first, as version_find_latest orders them
+    QStringList kernels = QDir(root + "/boot").entryList(QStringList() << "vmlinuz-*", QDir::Files, QDir::Name);
+    std::reverse(kernels.begin(), kernels.end());
+    if (kernels.isEmpty() || !scripts.contains("00_header") || !scripts.contains("10_linux")) {
+        *error = "No kernel in /boot or the header and Linux templates are disabled";
+        return QString();
+    }
+
+    // Paths as GRUB sees them on the root filesystem
+    QString prefix = target.rootSubvolume.isEmpty() ? QString() : "/" + target.rootSubvolume;
+    QStringList rootAccess = accessDevice(target.partitionMap, target.rootFsType, target.rootUuid);
+    bool saveDefault = settings.value("GRUB_SAVEDEFAULT") == "true";
+    QString defaultEntry = settings.value("GRUB_DEFAULT", "0");
+    if (defaultEntry == "saved") {
+        defaultEntry = "${saved_entry}";
+    }
+
+    QString config = "#\n"
+                     "# DO NOT EDIT THIS FILE\n"
+                     "#\n"
+                     "# It was generated by the installer from /etc/default/grub following the\n"
+                     "# templates in /etc/grub.d; grub-mkconfig regenerates it\n"
+                     "#\n\n";
+
+    // 00_header
+    QString header;
+    for (const QString &module : settings.value("GRUB_PRELOAD_MODULES").split(' ', Qt::SkipEmptyParts)) {
+        header += "insmod " + module + "\n";
+    }
+    header += QString(R"CFG(if [ -s $prefix/grubenv ]; then
+  load_env
+fi
+if [ "${next_entry}" ] ; then
+   set default="${next_entry}"
+   set next_entry=
+   save_env next_entry
+   set boot_once=true
+else
+   set default="%1"
+fi
+
+if [ x"${feature_menuentry_id}" = xy ]; then
+  menuentry_id_option="--id"
+else
+  menuentry_id_option=""
+fi
+
+export menuentry_id_option
+
+if [ "${prev_saved_entry}" ]; then
+  set saved_entry="${prev_saved_entry}"
+  save_env saved_entry
+  set prev_saved_entry=
+  save_env prev_saved_entry
+  set boot_once=true
+fi
+
+function savedefault {
+  if [ -z "${boot_once}" ]; then
+    saved_entry="${chosen}"
+    save_env saved_entry
+  fi
+}
+
+function load_video {
+  if [ x$feature_all_video_module = xy ]; then
+    insmod all_video
+  else
+    insmod efi_gop
+    insmod efi_uga
+    insmod ieee1275_fb
+    insmod vbe
+    insmod vga
+    insmod video_bochs
+    insmod video_cirrus
+  fi
+}
+
+)CFG").arg(defaultEntry);
+
+    QString terminalInput = settings.value("GRUB_TERMINAL", settings.value("GRUB_TERMINAL_INPUT"));
+    QString terminalOutput = settings.value("GRUB_TERMINAL", settings.value("GRUB_TERMINAL_OUTPUT"));
+    if (terminalOutput.isEmpty()) {
+        terminalOutput = "gfxterm";
+    }
+    bool gfxterm = terminalOutput.split(' ').contains("gfxterm");
+    if (gfxterm) {
+        QString fontPath;
+        for (const char *directory : {"/usr/share/grub", "/boot/grub"}) {
+            for (const char *name : {"unicode", "unifont", "ascii"}) {
+                if (fontPath.isEmpty() && QFile::exists(root + directory + "/" + name + ".pf2")) {
+                    fontPath = QString("%1/%2.pf2").arg(directory).arg(name);
+                }
+            }
+        }
+        if (fontPath.isEmpty()) {
+            header += "if loadfont unicode ; then\n";
+        } else {
+            header += "if [ x$feature_default_font_path = xy ] ; then\n   font=unicode\nelse\n";
+            header += indented(rootAccess, "");
+            header += QString("    font=\"%1\"\nfi\n\nif loadfont $font ; then\n").arg(prefix + fontPath);
+        }
+        header += QString("  set gfxmode=%1\n  load_video\n  insmod gfxterm\n").arg(settings.value("GRUB_GFXMODE", "auto"));
+        QString lang = readLang(root);
+        if (!lang.isEmpty()) {
+            header += QString("  set locale_dir=$prefix/locale\n  set lang=%1\n  insmod gettext\n").arg(lang);
+        }
+        header += "fi\n";
+    }
+    if (!terminalInput.isEmpty()) {
+        header += "terminal_input " + terminalInput + "\n";
+    }
+    header += "terminal_output " + terminalOutput + "\n";
+
+    QString theme = settings.value("GRUB_THEME");
+    if (gfxterm && !theme.isEmpty() && QFile::exists(root + theme)) {
+        header += indented(rootAccess, "");
+        header += "insmod gfxmenu\n";
+        QString themeDirectory = QFileInfo(theme).path();
+        for (const QString &directory : {themeDirectory, themeDirectory + "/f"}) {
+            for (const QString &font : QDir(root + directory).entryList(QStringList() << "*.pf2", QDir::Files, QDir::Name)) {
+                header += QString("loadfont ($root)%1\n").arg(prefix + directory + "/" + font);
+            }
+        }
+        QDir themeFiles(root + themeDirectory);
+        if (!themeFiles.entryList(QStringList() << "*.jpg" << "*.jpeg", QDir::Files).isEmpty()) {
+            header += "insmod jpeg\n";
+        }
+        if (!themeFiles.entryList(QStringList() << "*.png", QDir::Files).isEmpty()) {
+            header += "insmod png\n";
+        }
+        if (!themeFiles.entryList(QStringList() << "*.tga", QDir::Files).isEmpty()) {
+            header += "insmod tga\n";
+        }
+        header += QString("set theme=($root)%1\nexport theme\n").arg(prefix + theme);
+    }
+    header += timeoutCode(settings.value("GRUB_TIMEOUT_STYLE", "menu"), settings.value("GRUB_TIMEOUT", "5"));
+    config += section("00_header", header);
+
+    // 10_linux
+    QString distributor = settings.value("GRUB_DISTRIBUTOR");
+    QString osName = distributor.isEmpty() ? "Linux" : distributor + " Linux";
+    QString classes = "--class gnu-linux --class gnu --class os";
+    if (!distributor.isEmpty()) {
+        QString distributorClass = distributor.toLower().section(' ', 0, 0);
+        distributorClass.replace(QRegularExpression("[^a-z0-9_]"), "_");
+        classes = "--class " + distributorClass + " " + classes;
+    }
+    QString rootFlags = prefix.isEmpty() ? QString() : "rootflags=subvol=" + target.rootSubvolume;
+    QString normalArgs = joined({rootFlags, settings.value("GRUB_CMDLINE_LINUX"), settings.value("GRUB_CMDLINE_LINUX_DEFAULT")});
+    QString recoveryArgs = joined({settings.value("GRUB_CMDLINE_LINUX_RECOVERY", "single"), rootFlags, settings.value("GRUB_CMDLINE_LINUX")});
+    QString gfxPayload = settings.value("GRUB_GFXPAYLOAD_LINUX");
+    bool submenus = settings.value("GRUB_DISABLE_SUBMENU") != "true";
+    bool recovery = settings.value("GRUB_DISABLE_RECOVERY") != "true";
+
+    QStringList earlyImages;
+    for (const char *image : {"intel-uc.img", "intel-ucode.img", "amd-uc.img", "amd-ucode.img", "early_ucode.cpio", "microcode.cpio"}) {
+        if (QFile::exists(root + "/boot/" + image)) {
+            earlyImages << prefix + "/boot/" + image;
+        }
+    }
+
+    // linux_entry: type is simple, advanced, fallback or recovery
+    auto linuxEntry = [&](const QString &version, const QString &type, const QString &initrd,
+                          const QString &args, const QString &indent) {
+        QString title;
+        QString id;
+        if (type == "simple") {
+            title = osName;
+            id = "gnulinux-simple-" + target.rootUuid;
+        } else {
+            title = QString("%1, with Linux %2").arg(osName).arg(version);
+            if (type == "fallback") {
+                title += " (fallback initramfs)";
+            } else if (type == "recovery") {
+                title += " (recovery mode)";
+            }
+            id = QString("gnulinux-%1-%2-%3").arg(version).arg(type).arg(target.rootUuid);
+        }
+
+        QStringList body;
+        if (saveDefault && type != "recovery") {
+            body << "savedefault";
+        }
+        if (gfxPayload.isEmpty()) {
+            body << "load_video";
+        } else {
+            if (gfxPayload != "text") {
+                body << "load_video";
+            }
+            body << "set gfxpayload=" + gfxPayload;
+        }
+        body << "insmod gzio";
+        body << rootAccess;
+        body << "echo\t" + quoted(QString("Loading Linux %1 ...").arg(version));
+        body << QString("linux\t%1/boot/vmlinuz-%2 root=UUID=%3 rw %4").arg(prefix).arg(version).arg(target.rootUuid).arg(args).trimmed();
+        QStringList images = earlyImages;
+        if (!initrd.isEmpty()) {
+            images << prefix + "/boot/" + initrd;
+        }
+        if (!images.isEmpty()) {
+            body << "echo\t" + quoted("Loading initial ramdisk ...");
+            body << "initrd\t" + images.join(" ");
+        }
+        return QString("%1menuentry %2 %3 $menuentry_id_option '%4' {\n%5%1}\n")
+            .arg(indent).arg(quoted(title)).arg(classes).arg(id).arg(indented(body, indent + "\t"));
+    };
+
+    QString linuxEntries;
+    for (int i = 0; i < kernels.size(); ++i) {
+        QString version = kernels[i].mid(QString("vmlinuz-").size());
+        QString initrd = QString("initramfs-%1.img").arg(version);
+        if (!QFile::exists(root + "/boot/" + initrd)) {
+            initrd.clear();
+        }
+        QString indent = submenus ? "\t" : "";
+        if (i == 0 && submenus) {
+            linuxEntries += linuxEntry(version, "simple", initrd, normalArgs, "");
+            linuxEntries += QString("submenu %1 $menuentry_id_option 'gnulinux-advanced-%2' {\n")
+                     .arg(quoted("Advanced options for " + osName)).arg(target.rootUuid);
+        }
+        linuxEntries += linuxEntry(version, "advanced", initrd, normalArgs, indent);
+        QString fallback = QString("initramfs-%1-fallback.img").arg(version);
+        if (QFile::exists(root + "/boot/" + fallback)) {
+            linuxEntries += linuxEntry(version, "fallback", fallback, normalArgs, indent);
+        }
+        if (recovery) {
+            linuxEntries += linuxEntry(version, "recovery", initrd, recoveryArgs, indent);
+        }
+    }
+    if (submenus) {
+        linuxEntries += "}\n";
+    }
+    config += section("10_linux", linuxEntries + "\n");
+
+    if (scripts.contains("20_linux_xen")) {
+        config += section("20_linux_xen", QString());
+    }
+    if (scripts.contains("25_bli")) {
+        config += section("25_bli", "if [ \"$grub_platform\" = \"efi\" ]; then\n  insmod bli\nfi\n");
+    }
+
+    // 30_os-prober, from the cached probe
+    if (scripts.contains("30_os-prober")) {
+        QString probed;
+        if (settings.value("GRUB_DISABLE_OS_PROBER") == "false") {
+            QString saved = saveDefault ? "\tsavedefault\n" : QString();
+            for (const ForeignOs &os : foreign) {
+                BlockIdentity volume = os.volumes.value(os.partition);
+                if (volume.uuid.isEmpty()) {
+                    qDebug() << "[WARNING] No UUID for" << os.partition << "- skipping" << os.longName;
+                    continue;
+                }
+                QString on = QString("(on %1)").arg(os.partition);
+
+                if (os.type == "efi") {
+                    probed += QString("menuentry %1 --class windows --class os $menuentry_id_option 'osprober-efi-%2' {\n")
+                              .arg(quoted(os.longName + " " + on)).arg(volume.uuid);
+                    probed += saved + indented(accessDevice(volume.partitionMap, volume.fsType, volume.uuid), "\t");
+                    probed += "\tchainloader " + os.loader + "\n}\n";
+                } else if (os.type == "chain") {
+                    probed += QString("menuentry %1 --class windows --class os $menuentry_id_option 'osprober-chain-%2' {\n")
+                              .arg(quoted(os.longName + " " + on)).arg(volume.uuid);
+                    probed += saved + indented(accessDevice(volume.partitionMap, volume.fsType, volume.uuid), "\t");
+                    if (volume.partitionMap == "msdos") {
+                        probed += "\tparttool ${root} hidden-\n";
+                    }
+                    if (!os.longName.startsWith("Windows Vista") && !os.longName.startsWith("Windows 7") &&
+                        !os.longName.startsWith("Windows Server 2008")) {
+                        probed += "\tdrivemap -s (hd0) ${root}\n";
+                    }
+                    probed += "\tchainloader +1\n}\n";
+                } else {
+                    bool topLevel = true;
+                    QSet<QString> usedIds;
+                    for (const QString &entry : os.bootEntries) {
+                        // root:boot:label:kernel:initrd:parameters, spaces as ^
+                        QString bootDevice = entry.section(':', 1, 1);
+                        QString label = entry.section(':', 2, 2).replace('^', ' ');
+                        QString kernel = entry.section(':', 3, 3);
+                        QString initrd = entry.section(':', 4, 4);
+                        QString parameters = entry.section(':', 5).replace('^', ' ');
+                        if (label.isEmpty()) {
+                            label = os.longName;
+                        }
+                        if (entry.section(':', 0, 0) != bootDevice) {
+                            kernel = kernel.startsWith("/boot") ? kernel.mid(5) : kernel;
+                            initrd = initrd.startsWith("/boot") ? initrd.mid(5) : initrd;
+                        }
+                        BlockIdentity boot = os.volumes.value(bootDevice);
+                        if (boot.uuid.isEmpty()) {
+                            continue;
+                        }
+                        QStringList access = accessDevice(boot.partitionMap, boot.fsType, boot.uuid);
+                        QStringList load;
+                        load << "linux " + kernel + " " + parameters;
+                        if (!initrd.isEmpty()) {
+                            load << "initrd " + initrd;
+                        }
+
+                        QString recoveryParameters = parameters.contains("single") || parameters.contains("recovery") ? parameters : QString();
+                        int counter = 1;
+                        while (usedIds.contains(QString("%1-%2-%3").arg(kernel).arg(recoveryParameters).arg(counter))) {
+                            ++counter;
+                        }
+                        usedIds.insert(QString("%1-%2-%3").arg(kernel).arg(recoveryParameters).arg(counter));
+
+                        if (topLevel && submenus) {
+                            probed += QString("menuentry %1 --class gnu-linux --class gnu --class os $menuentry_id_option 'osprober-gnulinux-simple-%2' {\n")
+                                      .arg(quoted(os.longName + " " + on)).arg(volume.uuid);
+                            probed += saved + indented(access, "\t") + indented(load, "\t") + "}\n";
+                            probed += QString("submenu %1 $menuentry_id_option 'osprober-gnulinux-advanced-%2' {\n")
+                                      .arg(quoted("Advanced options for " + os.longName + " " + on)).arg(volume.uuid);
+                            topLevel = false;
+                        }
+                        probed += QString("\tmenuentry %1 --class gnu-linux --class gnu --class os $menuentry_id_option 'osprober-gnulinux-%2-%3-%4-%5' {\n")
+                                  .arg(quoted(label + " " + on)).arg(kernel).arg(recoveryParameters).arg(counter).arg(volume.uuid);
+                        probed += (saveDefault ? "\t\tsavedefault\n" : QString()) + indented(access, "\t\t") + indented(load, "\t\t") + "\t}\n";
+                    }
+                    if (!topLevel) {
+                        probed += "}\n";
+                    }
+                    probed += "\n";
+                }
+            }
+        }
+        config += section("30_os-prober", probed);
+    }
+
+    if (scripts.contains("30_uefi-firmware")) {
+        config += section("30_uefi-firmware", R"CFG(if [ "$grub_platform" = "efi" ]; then
+	fwsetup --is-supported
+	if [ "$?" = 0 ]; then
+		menuentry 'UEFI Firmware Settings' $menuentry_id_option 'uefi-firmware' {
+			fwsetup
+		}
+	fi
+fi
+)CFG");
+    }
+    if (scripts.contains("40_custom")) {
+        // The template is "exec tail -n +3 $0" followed by the entries
+        QFile custom(root + "/etc/grub.d/40_custom");
+        QString entries;
+        if (custom.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QStringList lines = QString::fromUtf8(custom.readAll()).split('\n');
+            entries = lines.mid(2).join('\n');
+            if (!entries.isEmpty() && !entries.endsWith('\n')) {
+                entries += '\n';
+            }
+        }
+        config += section("40_custom", entries);
+    }
+    if (scripts.contains("41_custom")) {
+        config += section("41_custom", R"CFG(if [ -f  ${config_directory}/custom.cfg ]; then
+  source ${config_directory}/custom.cfg
+elif [ -z "${config_directory}" -a -f  $prefix/custom.cfg ]; then
+  source $prefix/custom.cfg
+fi
+)CFG");
+    }
+    return config;
+}
+
+QString GrubConfigGenerator::deferScript() {
+    // grub.cfg is generated after the final settings; other outputs still work
+    return QString(R"SH(
+mkdir -p %1
+cat > %1/grub-mkconfig <<'STUB'
+#!/bin/bash
+output=
+for arg in "$@"; do
+    case "$arg" in
+        -o|--output) next=1; continue ;;
+        --output=*) output="${arg#--output=}" ;;
+    esac
+    [ -n "$next" ] && output="$arg" && next=
+done
+if [ "$output" = %2 ]; then
+    echo "[GRUB] grub-mkconfig $* deferred until the end of the installation"
+    exit 0
+fi
+exec /usr/bin/grub-mkconfig "$@"
+STUB
+chmod 755 %1/grub-mkconfig
+export PATH=%1:$PATH
+)SH").arg(stubDirectory).arg(configPath());
+}
+
+QString GrubConfigGenerator::restoreScript() {
+    return QString("rm -f %1/grub-mkconfig\n").arg(stubDirectory);
+}
+
+QString GrubConfigGenerator::cachedProberScript(const QList<ForeignOs> &foreign) {
+    QString osProberOutput;
+    QString bootProberCases;
+    for (const ForeignOs &os : foreign) {
+        osProberOutput += os.line + "\n";
+        if (!os.bootEntries.isEmpty()) {
+            bootProberCases += QString("    %1) cat <<'EOF'\n%2\nEOF\n        ;;\n").arg(os.partition).arg(os.bootEntries.join('\n'));
+        }
+    }
+
+    QString script = QString("mkdir -p %1\n").arg(stubDirectory);
+    script += QString("cat > %1/os-prober <<'STUB'\n#!/bin/bash\ncat <<'EOF'\n%2EOF\nSTUB\n").arg(stubDirectory).arg(osProberOutput);
+    script += QString("cat > %1/linux-boot-prober <<'STUB'\n#!/bin/bash\ncase \"$1\" in\n%2esac\nSTUB\n").arg(stubDirectory).arg(bootProberCases);
+    script += QString("chmod 755 %1/os-prober %1/linux-boot-prober\n").arg(stubDirectory);
+    script += QString("export PATH=%1:$PATH\n").arg(stubDirectory);
+    return script;
+}
+
+QString GrubConfigGenerator::cachedProberRestoreScript() {
+    return QString("rm -f %1/os-prober %1/linux-boot-prober\n").arg(stubDirectory);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <QList>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include "foreignosprober.h"
+
+// The installed system as GRUB sees it
+struct GrubTarget {
+    QString rootUuid;
+    QString rootFsType;       // btrfs or ext4
+    QString rootSubvolume;    // e.g. @; empty when / is the top of the filesystem
+    QString partitionMap;     // gpt or msdos
+};
+
+// Writes /boot/grub/grub.cfg without running grub-mkconfig.
+//
+// The output follows the stock /etc/grub.d templates (00_header, 10_linux,
+// 25_bli, 30_os-prober, 30_uefi-firmware, 40_custom and 41_custom) for the
+// settings in /etc/default/grub, with other systems taken from the
+// background os-prober run instead of probing every partition again.
+// Anything the templates would do that is not reproduced here (extra
+// /etc/grub.d scripts, shell expansions or unknown keys in
+// /etc/default/grub, Xen kernels) makes generate() refuse, and the caller
+// falls back to grub-mkconfig. grub-mkconfig replaces the file as usual on
+// the next kernel or GRUB update.
+class GrubConfigGenerator {
+public:
+    // Returns an empty string and sets error if grub-mkconfig has to be used
+    static QString generate(const QString &root, const GrubTarget &target,
+                            const QList<ForeignOs> &foreign, QString *error);
+    static QString configPath();
+    // gpt or msdos, read from the disk holding device
+    static QString partitionMap(const QString &device);
+
+    // Shadows grub-mkconfig while the final settings run; the configuration
+    // is generated once afterwards
+    static QString deferScript();
+    static QString restoreScript();
+    // Shadows os-prober and linux-boot-prober with stubs that print the
+    // cached results, for runs of the real grub-mkconfig
+    static QString cachedProberScript(const QList<ForeignOs> &foreign);
+    static QString cachedProberRestoreScript();
+
+private:
+    static bool readDefaults(const QString &root, QMap<QString, QString> *settings, QString *error);
+};
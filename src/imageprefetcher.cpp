@@ -0,0 +1,218 @@
+#include "imageprefetcher.h"
+#include "installsource.h"
+#include "systemresources.h"
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr qint64 CHUNK_SIZE = 4 * 1024 * 1024;
+constexpr qint64 MB = 1024 * 1024;
+
+struct PrefetchState {
+    QMutex mutex;
+    QThread *thread = nullptr;
+    std::atomic<bool> cancelled{false};
+    std::atomic<qint64> cached{0};
+    QString sourcePath;
+    QString ramPath;
+};
+
+PrefetchState &state() {
+    static PrefetchState prefetch;
+    return prefetch;
+}
+
+qint64 lowWatermarkKb() {
+    // Below this the prefetcher pauses (page cache) or drops its RAM copy
+    return std::max<qint64>(512 * 1024, SystemResources::memTotalKb() / 10);
+}
+
+qint64 shmAvailableBytes() {
+    struct statvfs fs;
+    if (statvfs("/dev/shm", &fs) != 0) {
+        return 0;
+    }
+    return static_cast<qint64>(fs.f_bavail) * static_cast<qint64>(fs.f_frsize);
+}
+
+void runPrefetch() {
+    PrefetchState &prefetch = state();
+
+    InstallImage image = InstallSource::locate();
+    if (!image.isValid()) {
+        qDebug() << "[PREFETCH] No install image found, nothing to prefetch";
+        return;
+    }
+    if (image.path.startsWith("/run/archiso/copytoram/")) {
+        qDebug() << "[PREFETCH] Image already in RAM (copytoram):" << image.path;
+        return;
+    }
+
+    qint64 imageSize = QFileInfo(image.path).size();
+    qint64 availableBytes = SystemResources::memAvailableKb() * 1024;
+    qint64 reserveBytes = std::max<qint64>(2048 * MB, SystemResources::memTotalKb() * 1024 / 4);
+
+    // A RAM copy must leave room for extraction itself; otherwise only warm
+    // the page cache with as much of the image as comfortably fits
+    bool ramCopy = availableBytes - imageSize > reserveBytes && shmAvailableBytes() > imageSize + 64 * MB;
+    qint64 budget = ramCopy ? imageSize : std::min(imageSize, availableBytes / 2);
+
+    qDebug() << QString("[PREFETCH] %1 (%2 MB), MemAvailable %3 MB: %4, budget %5 MB")
+                .arg(image.path).arg(imageSize / MB).arg(availableBytes / MB)
+                .arg(ramCopy ? "copying to RAM" : "warming page cache").arg(budget / MB);
+
+    int in = open(image.path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        qDebug() << "[PREFETCH] Cannot open" << image.path << ":" << strerror(errno);
+        return;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    QString ramPath = "/dev/shm/arch7z-" + QFileInfo(image.path).fileName();
+    QString partialPath = ramPath + ".partial";
+    int out = -1;
+    if (ramCopy) {
+        out = open(partialPath.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            qDebug() << "[PREFETCH] Cannot create" << partialPath << "- warming page cache instead";
+            ramCopy = false;
+            budget = std::min(imageSize, availableBytes / 2);
+        }
+    }
+
+    std::vector<char> buffer(CHUNK_SIZE);
+    qint64 offset = 0;
+    qint64 nextLog = 256 * MB;
+
+    while (!prefetch.cancelled && offset < budget) {
+        if ((offset / CHUNK_SIZE) % 16 == 0 && SystemResources::memAvailableKb() < lowWatermarkKb()) {
+            if (ramCopy) {
+                qDebug() << "[PREFETCH] Memory getting tight, dropping the RAM copy";
+                close(out);
+                out = -1;
+                unlink(partialPath.toLocal8Bit().constData());
+                ramCopy = false;
+                budget = offset;
+                break;
+            }
+            qDebug() << "[PREFETCH] Memory getting tight, pausing at" << offset / MB << "MB";
+            while (!prefetch.cancelled && SystemResources::memAvailableKb() < lowWatermarkKb()) {
+                QThread::msleep(500);
+            }
+            continue;
+        }
+
+        ssize_t n = pread(in, buffer.data(), static_cast<size_t>(std::min(CHUNK_SIZE, budget - offset)), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (ramCopy && write(out, buffer.data(), static_cast<size_t>(n)) != n) {
+            qDebug() << "[PREFETCH] Write to" << partialPath << "failed, warming page cache instead";
+            close(out);
+            out = -1;
+            unlink(partialPath.toLocal8Bit().constData());
+            ramCopy = false;
+        }
+        offset += n;
+        prefetch.cached = offset;
+
+        if (offset >= nextLog) {
+            qDebug() << QString("[PREFETCH] %1 / %2 MB cached").arg(offset / MB).arg(budget / MB);
+            nextLog += 256 * MB;
+        }
+    }
+    bool complete = offset >= imageSize;
+    close(in);
+
+    if (out >= 0) {
+        close(out);
+        if (complete && rename(partialPath.toLocal8Bit().constData(), ramPath.toLocal8Bit().constData()) == 0) {
+            QMutexLocker locker(&prefetch.mutex);
+            prefetch.sourcePath = image.path;
+            prefetch.ramPath = ramPath;
+            qDebug() << "[PREFETCH] RAM copy ready:" << ramPath;
+            return;
+        }
+        unlink(partialPath.toLocal8Bit().constData());
+    }
+
+    qDebug() << QString("[PREFETCH] %1 after %2 MB in page cache")
+                .arg(prefetch.cancelled ? "Stopped" : "Finished").arg(offset / MB);
+}
+
+} // namespace
+
+void ImagePrefetcher::start() {
+    PrefetchState &prefetch = state();
+    QMutexLocker locker(&prefetch.mutex);
+    if (prefetch.thread) return;
+
+    prefetch.cancelled = false;
+    prefetch.thread = QThread::create(runPrefetch);
+    // Keep the wizard responsive while the USB stick is busy
+    prefetch.thread->start(QThread::LowPriority);
+}
+
+QString ImagePrefetcher::claim(const QString &imagePath) {
+    PrefetchState &prefetch = state();
+    QThread *thread = nullptr;
+    {
+        QMutexLocker locker(&prefetch.mutex);
+        thread = prefetch.thread;
+    }
+    if (thread) {
+        // Extraction reads the same medium; competing with it would only slow it down
+        prefetch.cancelled = true;
+        thread->wait();
+    }
+
+    QMutexLocker locker(&prefetch.mutex);
+    if (!prefetch.ramPath.isEmpty() && prefetch.sourcePath == imagePath && QFileInfo(prefetch.ramPath).isFile()) {
+        qDebug() << "[PREFETCH] Installing from RAM copy" << prefetch.ramPath << "instead of" << imagePath;
+        return prefetch.ramPath;
+    }
+    qDebug() << "[PREFETCH] Installing from" << imagePath << "with" << prefetch.cached / MB << "MB prefetched";
+    return imagePath;
+}
+
+void ImagePrefetcher::release() {
+    PrefetchState &prefetch = state();
+    QMutexLocker locker(&prefetch.mutex);
+    if (!prefetch.ramPath.isEmpty()) {
+        QFile::remove(prefetch.ramPath);
+        qDebug() << "[PREFETCH] Released RAM copy" << prefetch.ramPath;
+        prefetch.ramPath.clear();
+    }
+}
+
+void ImagePrefetcher::shutdown() {
+    PrefetchState &prefetch = state();
+    QThread *thread = nullptr;
+    {
+        QMutexLocker locker(&prefetch.mutex);
+        thread = prefetch.thread;
+        prefetch.thread = nullptr;
+    }
+    if (thread) {
+        prefetch.cancelled = true;
+        thread->wait();
+        delete thread;
+    }
+    release();
+}
+
+qint64 ImagePrefetcher::bytesCached() {
+    return state().cached;
+}
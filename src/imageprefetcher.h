@@ -0,0 +1,22 @@
+#pragma once
+#include <QString>
+#include <QtGlobal>
+
+// Warms the install image while the wizard is open.
+//
+// Started at application launch. When MemAvailable leaves enough headroom the
+// image is copied into /dev/shm, otherwise as much of it as fits is streamed
+// into the page cache. Reading backs off when memory gets tight and a RAM copy
+// is dropped again if the system runs short.
+class ImagePrefetcher {
+public:
+    static void start();
+    // Stops prefetching and returns the path extraction should read from:
+    // the RAM copy when it completed for this image, imagePath otherwise
+    static QString claim(const QString &imagePath);
+    // Frees the RAM copy once the image is no longer needed
+    static void release();
+    static void shutdown();
+
+    static qint64 bytesCached();
+};
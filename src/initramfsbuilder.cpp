@@ -0,0 +1,213 @@
+#include "initramfsbuilder.h"
+#include "settingsparser.h"
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+const char *mkinitcpioPath = "/usr/bin/mkinitcpio";
+const char *realMkinitcpioPath = "/usr/bin/mkinitcpio.arch7z-real";
+
+// Sources each preset the way mkinitcpio -p does and prints one line per
+// image: "<preset>-<entry>\t<mkinitcpio arguments>"
+const char *listPresetImages = R"SH(
+list_preset_images() {
+    local preset_file
+    for preset_file in /etc/mkinitcpio.d/*.preset; do
+        [ -e "$preset_file" ] || continue
+        (
+            . "$preset_file"
+            name=$(basename "$preset_file" .preset)
+            for p in "${PRESETS[@]}"; do
+                kver_var="${p}_kver"; config_var="${p}_config"
+                image_var="${p}_image"; uki_var="${p}_uki"; options_var="${p}_options"
+                args="-k $(printf '%q' "${!kver_var:-$ALL_kver}") -c $(printf '%q' "${!config_var:-${ALL_config:-/etc/mkinitcpio.conf}}")"
+                [ -n "${!image_var}" ] && args="$args -g $(printf '%q' "${!image_var}")"
+                [ -n "${!uki_var}" ] && args="$args -U $(printf '%q' "${!uki_var}")"
+                [ -n "${!image_var}${!uki_var}" ] || continue
+                case " $SKIP_ENTRIES " in *" $p "*) continue ;; esac
+                printf '%s-%s\t%s %s\n' "$name" "$p" "$args" "${!options_var}"
+            done
+        )
+    done
+}
+)SH";
+
+// SKIP_ENTRIES lists preset entries left out, separated by spaces
+QString skipDeclaration(const QStringList &skip) {
+    return QString("SKIP_ENTRIES='%1'\n").arg(skip.join(' '));
+}
+
+QString moduleOf(const QString &devicePath) {
+    // Built-in drivers have no module link
+    QString module = QFileInfo(devicePath + "/driver/module").canonicalFilePath();
+    return module.isEmpty() ? QString() : QFileInfo(module).fileName();
+}
+
+} // namespace
+
+bool InitramfsBuilder::hostOnlyEnabled() {
+    SettingsParser::loadSettings();
+    return SettingsParser::getVariable("initramfs", "generic") == "hostonly";
+}
+
+QStringList InitramfsBuilder::deferredEntries() {
+    return hostOnlyEnabled() ? QStringList{"fallback"} : QStringList();
+}
+
+QString InitramfsBuilder::buildScript(const QStringList &skip) {
+    QString script = listPresetImages;
+    script += skipDeclaration(skip);
+    script += R"SH(
+set -e
+names=(); pids=()
+while IFS=$'\t' read -r name args; do
+    [ -n "$name" ] || continue
+    (
+        start=$(date +%s%N)
+        eval "/usr/bin/mkinitcpio $args" >"/tmp/mkinitcpio-$name.log" 2>&1
+        echo "[INITRAMFS] $name built in $(( ($(date +%s%N) - start) / 1000000 )) ms"
+    ) &
+    names+=("$name"); pids+=($!)
+done < <(list_preset_images)
+
+if [ ${#pids[@]} -eq 0 ]; then
+    echo 'No mkinitcpio presets found in /etc/mkinitcpio.d'
+    exit 1
+fi
+
+failed=0
+for i in "${!pids[@]}"; do
+    if ! wait "${pids[$i]}"; then
+        echo "mkinitcpio failed for ${names[$i]}:"
+        cat "/tmp/mkinitcpio-${names[$i]}.log"
+        failed=1
+    fi
+    rm -f "/tmp/mkinitcpio-${names[$i]}.log"
+done
+exit $failed
+)SH";
+    return script;
+}
+
+QStringList InitramfsBuilder::hostModules(const QString &device) {
+    QStringList modules;
+    QString name = QFileInfo(QFileInfo(device).canonicalFilePath()).fileName();
+    QString path = QFileInfo("/sys/class/block/" + name).canonicalFilePath();
+
+    // e.g. nvme0n1p2 -> nvme0n1 -> nvme0 -> 0000:3d:00.0 (nvme), or
+    // sda2 -> sda -> 0:0:0:0 (sd_mod) -> ... -> 0000:00:17.0 (ahci)
+    while (path.startsWith("/sys/devices/") && path != "/sys/devices") {
+        QString module = moduleOf(path);
+        if (!module.isEmpty() && !modules.contains(module)) {
+            modules << module;
+        }
+        path = QFileInfo(path).path();
+    }
+    return modules;
+}
+
+QString InitramfsBuilder::hostOnlyConfigPath() {
+    return "/etc/mkinitcpio.conf.d/50-arch7z-hostonly.conf";
+}
+
+QString InitramfsBuilder::hostOnlyConfig(const QStringList &modules) {
+    return QString("# Written by the Arch7z installer: host-only images for the machine it ran on.\n"
+                   "# autodetect already limits the image to this hardware; the root device's\n"
+                   "# drivers are listed so they load first.\n"
+                   "MODULES+=(%1)\n"
+                   "# Stored uncompressed inside the image, which zstd then compresses as a whole\n"
+                   "MODULES_DECOMPRESS=\"yes\"\n"
+                   "COMPRESSION=\"zstd\"\n"
+                   "COMPRESSION_OPTIONS=(-T0 -3)\n").arg(modules.join(' '));
+}
+
+QString InitramfsBuilder::deferredBuildUnitName() {
+    return "arch7z-deferred-initramfs.service";
+}
+
+QString InitramfsBuilder::deferredBuildScriptPath() {
+    return "/usr/local/lib/arch7z/deferred-initramfs";
+}
+
+QString InitramfsBuilder::deferredBuildScript(const QStringList &entries) {
+    QString script = "#!/bin/bash\n# Written by the Arch7z installer; disables itself once every image is built\n";
+    script += listPresetImages;
+    script += skipDeclaration(QStringList());
+    script += QString(R"SH(
+failed=0
+while IFS=$'\t' read -r name args; do
+    case " %1 " in
+        *" ${name##*-} "*)
+            eval "/usr/bin/mkinitcpio $args" || { echo "mkinitcpio failed for $name" >&2; failed=1; } ;;
+    esac
+done < <(list_preset_images)
+# Stays enabled, and shows up in systemctl --failed, until every image is built
+if [ $failed -ne 0 ]; then
+    exit 1
+fi
+# grub-mkconfig only lists images that exist
+if [ -f /boot/grub/grub.cfg ] && command -v grub-mkconfig >/dev/null; then
+    grub-mkconfig -o /boot/grub/grub.cfg
+fi
+systemctl disable %2
+)SH").arg(entries.join(' ')).arg(deferredBuildUnitName());
+    return script;
+}
+
+QString InitramfsBuilder::deferredBuildUnit() {
+    return QString("[Unit]\n"
+                   "Description=Build the initramfs images deferred by the installer\n"
+                   "\n"
+                   "[Service]\n"
+                   "Type=oneshot\n"
+                   "Nice=19\n"
+                   "IOSchedulingClass=idle\n"
+                   "ExecStart=%1\n"
+                   "\n"
+                   "[Install]\n"
+                   "WantedBy=multi-user.target\n").arg(deferredBuildScriptPath());
+}
+
+QString InitramfsBuilder::deferredLog() {
+    return "/var/lib/arch7z-installer/mkinitcpio-deferred";
+}
+
+QString InitramfsBuilder::deferScript() {
+    // Preset builds (including the pacman hook's) are recorded, anything else
+    // such as a one-off -g still runs. The binary itself is moved aside so
+    // absolute /usr/bin/mkinitcpio calls are caught as well; the trap puts it
+    // back if a command exits the script early
+    return QString(R"SH(
+mkdir -p "$(dirname %3)"
+mv -f %1 %2
+cat > %1 <<'STUB'
+#!/bin/bash
+# arch7z-mkinitcpio-stub
+for arg in "$@"; do
+    case "$arg" in
+        -P|--allpresets|-p*|--preset*)
+            echo "$*" >> %3
+            echo "[INITRAMFS] mkinitcpio $* deferred until the end of the installation"
+            exit 0 ;;
+    esac
+done
+exec %2 "$@"
+STUB
+chmod 755 %1
+restore_mkinitcpio() {
+    [ -e %2 ] || return 0
+    # A mkinitcpio upgrade during the scripts has already replaced the stub
+    if grep -q arch7z-mkinitcpio-stub %1 2>/dev/null; then
+        mv -f %2 %1
+    else
+        rm -f %2
+    fi
+}
+trap restore_mkinitcpio EXIT
+)SH").arg(mkinitcpioPath).arg(realMkinitcpioPath).arg(deferredLog());
+}
+
+QString InitramfsBuilder::restoreScript() {
+    return "restore_mkinitcpio\ntrap - EXIT\n";
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+
+// Builds the target's initramfs images once, after the last step that can
+// change them.
+//
+// Every image named by the presets in /etc/mkinitcpio.d is built by its own
+// mkinitcpio process, so default and fallback images are generated side by
+// side. While the final settings scripts run, a stub takes the place of
+// /usr/bin/mkinitcpio and only records preset builds; the installer builds
+// everything afterwards.
+// All scripts run inside the target.
+//
+// With initramfs=hostonly in final-settings.conf the images carry the
+// storage drivers of the installing machine, uncompressed modules and
+// multi-threaded zstd, and the generic fallback image is built on the
+// first boot instead of during the install.
+class InitramfsBuilder {
+public:
+    static bool hostOnlyEnabled();
+    // Preset entries (e.g. "fallback") that are not built during the install
+    static QStringList deferredEntries();
+
+    // Builds every preset image except skip concurrently; fails if any build fails
+    static QString buildScript(const QStringList &skip = QStringList());
+
+    // Kernel modules on the path from the root device to its host controller
+    static QStringList hostModules(const QString &device);
+    // /etc/mkinitcpio.conf.d drop-in for a host-only build
+    static QString hostOnlyConfig(const QStringList &modules);
+    static QString hostOnlyConfigPath();
+    // Oneshot unit and script that build the deferred entries on the first boot
+    static QString deferredBuildUnit();
+    static QString deferredBuildUnitName();
+    static QString deferredBuildScript(const QStringList &entries);
+    static QString deferredBuildScriptPath();
+    // Shadows mkinitcpio with the deferring stub, and removes it again
+    static QString deferScript();
+    static QString restoreScript();
+    // Where the stub records deferred runs, relative to the target root
+    static QString deferredLog();
+};
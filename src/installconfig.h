@@ -6,6 +6,13 @@ enum class PartitioningMode {
     Manual
 };
 
+enum class SwapMode {
+    Partition,
+    Swapfile,
+    Zram,
+    None
+};
+
 enum class InstallationSource {
     AutomaticInstall,
     CustomPartitioning
@@ -22,10 +29,13 @@ struct InstallConfig {
     // Disk settings
     QString selectedDisk;
     QString diskSize;
-    bool enableSwap;
+    bool enableSwap;            // the layout has a swap partition
     QString filesystem;
     QString efiSize;
     QString swapSize;
+    SwapMode swapMode;
+    qint64 swapSizeMiB;         // 0 sizes swap from installed RAM
+    bool hibernation;
     PartitioningMode partitioningMode;
     
     // Advanced partition settings
@@ -49,7 +59,7 @@ struct InstallConfig {
     bool isVirtualMachine;
     QString virtualizationType;
     
-    InstallConfig() : enableSwap(true), samePassword(true), filesystem("ext4"), partitioningMode(PartitioningMode::Automatic), installationSource(InstallationSource::AutomaticInstall), isVirtualMachine(false) {}
+    InstallConfig() : enableSwap(true), samePassword(true), filesystem("ext4"), swapMode(SwapMode::Partition), swapSizeMiB(0), hibernation(false), partitioningMode(PartitioningMode::Automatic), installationSource(InstallationSource::AutomaticInstall), isVirtualMachine(false) {}
     
     void reset() {
         installationSource = InstallationSource::AutomaticInstall;
@@ -1,5 +1,23 @@
 #include "installer.h"
 #include "vmdetection.h"
+#include "systemresources.h"
+#include "squashfsextractor.h"
+#include "installsource.h"
+#include "blockimagedeployer.h"
+#include "devicediscarder.h"
+#include "efibootentry.h"
+#include "treecopier.h"
+#include "chrootsession.h"
+#include "targetconfigwriter.h"
+#include "devicereadiness.h"
+#include "partitiontablewriter.h"
+#include "storageprofile.h"
+#include "swappolicy.h"
+#include "btrfslayout.h"
+#include "initramfsbuilder.h"
+#include "imageprefetcher.h"
+#include "foreignosprober.h"
+#include "grubconfiggenerator.h"
 #include <QDebug>
 #include <QDir>
 #include <QTextStream>
@@ -8,50 +26,246 @@
 #include <QDateTime>
 #include <QRegularExpression>
 #include <QCoreApplication>
+#include <algorithm>
 #include <unistd.h>
 
 Installer::Installer(const InstallConfig &config, QObject *parent)
-    : QObject(parent), config(config), currentProcess(nullptr), currentStep(0), totalSteps(8) {
-    
-    installSteps << "Partitioning disk"
-                << "Formatting partitions" 
-                << "Mounting partitions"
-                << "Installing base system"
-                << "Configuring system"
-                << "Installing bootloader"
-                << "Running custom scripts"
-                << "Cleanup";
-                
-    progressTimer = new QTimer(this);
-    progressTimer->setSingleShot(true);
-    connect(progressTimer, &QTimer::timeout, this, &Installer::executeNextStep);
+    : QObject(parent), config(config), diskDiscarded(false), extractor(nullptr), deployer(nullptr), discarder(nullptr), copier(nullptr), chrootSession(nullptr), holdAtBarrier(false), failed(false) {
+}
+
+QList<InstallTask> Installer::buildTaskGraph() {
+    QList<InstallTask> graph;
+    graph << InstallTask{"partition", "Partitioning disk", {"foreign-os"}, {"partitions"},
+                         [this]() { partitionDisk(); }};
+    graph << InstallTask{"format-efi", "Formatting EFI partition", {"partitions"}, {"efi-formatted"},
+                         [this]() { formatEfiPartition(); }};
+    graph << InstallTask{"format-swap", "Formatting swap partition", {"partitions"}, {"swap-formatted"},
+                         [this]() { formatSwapPartition(); }};
+    graph << InstallTask{"format-root", "Formatting root partition", {"partitions"}, {"root-formatted"},
+                         [this]() { formatRootPartition(); }};
+    // Swap is part of the mount table that fstab is built from
+    graph << InstallTask{"mount", "Mounting partitions", {"root-formatted", "efi-formatted", "swap-formatted"}, {"root-mounted", "efi-mounted"},
+                         [this]() { mountPartitions(); }};
+    graph << InstallTask{"base-system", "Installing base system", {"root-mounted", "efi-mounted"}, {"base-system"},
+                         [this]() { installBaseSystem(); }};
+    graph << configurationTasks({"target-config"});
+    return graph;
+}
+
+QList<InstallTask> Installer::configurationTasks(const QStringList &bootloaderInputs) {
+    QList<InstallTask> graph;
+    // Swap files and zram are set up on the target and end up in fstab
+    graph << InstallTask{"swap", "Setting up swap", {"base-system"}, {"swap"},
+                         [this]() { setupSwap(); }};
+    graph << InstallTask{"target-config", "Configuring system", {"base-system", "swap"}, {"target-config"},
+                         [this]() { configureSystem(); }};
+    // Built once, after the last step that may change its configuration
+    graph << InstallTask{"initramfs", "Generating initramfs", {"target-config", "custom-scripts"}, {"initramfs"},
+                         [this]() { generateInitramfs(); }};
+    graph << InstallTask{"repo-sync", "Syncing package databases", {"base-system"}, {"repo-sync"},
+                         [this]() { syncPackageDatabases(); }};
+    graph << InstallTask{"users", "Creating users", {"base-system", "user-config"}, {"users"},
+                         [this]() { createUsers(); }};
+    graph << InstallTask{"bootloader", "Installing bootloader", bootloaderInputs, {"bootloader"},
+                         [this]() { installBootloader(); }};
+    graph << InstallTask{"custom-scripts", "Running custom scripts", {"bootloader", "users", "repo-sync"}, {"custom-scripts"},
+                         [this]() { runCustomScripts(); }};
+    // Generated once the kernels, initramfs images and GRUB settings are final
+    graph << InstallTask{"grub-config", "Generating GRUB configuration", {"custom-scripts", "initramfs", "foreign-os"}, {"grub-config"},
+                         [this]() { generateGrubConfig(); }};
+    graph << InstallTask{"cleanup", "Cleanup", {"grub-config"}, {"cleanup"},
+                         [this]() { cleanup(); }};
+    return graph;
 }
 
 void Installer::startInstallation() {
-    currentStep = 0;
+    tasks = buildTaskGraph();
+    knownFacts.clear();
+    startedTasks.clear();
+    finishedTasks.clear();
+    failed = false;
+    if (!holdAtBarrier) {
+        knownFacts.insert("user-config");
+    }
+    
+    // Every input must come from some task, or the graph can never finish
+    QSet<QString> producible = {"user-config", "foreign-os"};
+    for (const InstallTask &task : tasks) {
+        for (const QString &output : task.outputs) {
+            producible.insert(output);
+        }
+    }
+    for (const InstallTask &task : tasks) {
+        for (const QString &input : task.inputs) {
+            if (!producible.contains(input)) {
+                failInstallation(QString("Installation task '%1' needs '%2', which no task provides").arg(task.id).arg(input));
+                return;
+            }
+        }
+    }
+    
+    // os-prober mounts partitions of every disk while it runs; the disk tasks
+    // and grub.cfg wait for it without blocking the event loop
+    ForeignOsProber::whenFinished(this, [this]() {
+        if (!knownFacts.contains("foreign-os")) {
+            knownFacts.insert("foreign-os");
+            QTimer::singleShot(0, this, &Installer::scheduleTasks);
+        }
+    });
+    
+    qDebug() << "[DEBUG] Installation graph has" << tasks.size() << "tasks";
     updateProgress(0, "Starting installation...");
-    progressTimer->start(1000);
+    QTimer::singleShot(0, this, &Installer::scheduleTasks);
+}
+
+void Installer::holdBeforeConfiguration() {
+    holdAtBarrier = true;
+}
+
+void Installer::releaseBarrier(const InstallConfig &userConfig) {
+    // Disk, layout and locale settings were fixed when the early start began
+    config.hostname = userConfig.hostname;
+    config.username = userConfig.username;
+    config.password = userConfig.password;
+    config.rootPassword = userConfig.rootPassword;
+    config.samePassword = userConfig.samePassword;
+    config.shell = userConfig.shell;
+    
+    holdAtBarrier = false;
+    if (!knownFacts.contains("user-config")) {
+        qDebug() << "[DEBUG] User configuration received, resuming installation";
+        knownFacts.insert("user-config");
+        QTimer::singleShot(0, this, &Installer::scheduleTasks);
+    }
+}
+
+void Installer::cancelInstallation() {
+    qDebug() << "[DEBUG] cancelInstallation() - Installation cancelled with" << finishedTasks.size() << "of" << tasks.size() << "tasks done";
+    holdAtBarrier = false;
+    terminateInstallation();
+}
+
+void Installer::scheduleTasks() {
+    if (failed) {
+        return;
+    }
+    
+    for (const InstallTask &task : tasks) {
+        if (failed) {
+            return;
+        }
+        if (startedTasks.contains(task.id)) {
+            continue;
+        }
+        bool ready = std::all_of(task.inputs.begin(), task.inputs.end(),
+                                 [this](const QString &input) { return knownFacts.contains(input); });
+        if (!ready) {
+            continue;
+        }
+        
+        startedTasks.insert(task.id);
+        taskTimers[task.id].start();
+        qDebug() << QString("[DEBUG] Starting task %1 (%2), %3/%4 done")
+                    .arg(task.id).arg(task.label).arg(finishedTasks.size()).arg(tasks.size());
+        updateProgress(completedPercentage(), taskLabel(task.id));
+        
+        startingTask = task.id;
+        task.run();
+        startingTask.clear();
+        
+        // Tasks with nothing left to wait for are done as soon as they return
+        if (!failed && !finishedTasks.contains(task.id) && !taskHasWork(task.id)) {
+            completeTask(task.id);
+            return;
+        }
+    }
+    
+    if (failed || !taskProcesses.isEmpty() || !taskWorkers.isEmpty() || finishedTasks.size() == tasks.size()) {
+        return;
+    }
+    if (!knownFacts.contains("foreign-os")) {
+        qDebug() << "[OSPROBER] Waiting for os-prober to finish before touching the disks";
+        updateProgress(completedPercentage(), "Waiting for the scan for other systems");
+        return;
+    }
+    if (!knownFacts.contains("user-config")) {
+        qDebug() << "[DEBUG] Disk work finished early, waiting for user configuration";
+        updateProgress(completedPercentage(), "Waiting for user configuration");
+        return;
+    }
+    failInstallation("Installation tasks cannot make progress (dependency cycle in the task graph)");
 }
 
-void Installer::executeNextStep() {
-    QString stepMessage = installSteps[currentStep];
-    int percentage = (currentStep * 100) / totalSteps;
-    qDebug() << QString("[DEBUG] Step %1/%2: %3 (%4%)").arg(currentStep+1).arg(totalSteps).arg(stepMessage).arg(percentage);
-    updateProgress(percentage, stepMessage);
+void Installer::completeTask(const QString &taskId) {
+    finishedTasks.insert(taskId);
+    for (const InstallTask &task : tasks) {
+        if (task.id == taskId) {
+            for (const QString &output : task.outputs) {
+                knownFacts.insert(output);
+            }
+        }
+    }
+    qDebug() << QString("[SUCCESS] Task %1 completed in %2 ms").arg(taskLabel(taskId)).arg(taskTimers.value(taskId).elapsed());
+    
+    // Proactive memory cleanup after the base system is in place
+    if (taskId == "base-system") {
+        qDebug() << "[DEBUG] Performing memory cleanup after base system installation";
+        ImagePrefetcher::release();
+        QProcess::execute("sync");
+        QProcess::execute("bash", QStringList() << "-c" << "echo 1 > /proc/sys/vm/drop_caches 2>/dev/null || true");
+    }
+    
+    // Check memory status
+    qint64 memAvailable = SystemResources::memAvailableKb();
+    qDebug() << "[MEMORY] Available:" << memAvailable << "KB";
+    
+    // Emergency cleanup if memory is low
+    if (memAvailable > 0 && memAvailable < 512000) {
+        qDebug() << "[WARNING] Low memory detected, forcing cleanup";
+        QProcess::execute("bash", QStringList() << "-c" << "echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true");
+    }
     
-    switch (currentStep) {
-        case 0: qDebug() << "[DEBUG] Starting partitionDisk()"; partitionDisk(); break;
-        case 1: qDebug() << "[DEBUG] Starting formatPartitions()"; formatPartitions(); break;
-        case 2: qDebug() << "[DEBUG] Starting mountPartitions()"; mountPartitions(); break;
-        case 3: qDebug() << "[DEBUG] Starting installBaseSystem()"; installBaseSystem(); break;
-        case 4: qDebug() << "[DEBUG] Starting configureSystem()"; configureSystem(); break;
-        case 5: qDebug() << "[DEBUG] Starting installBootloader()"; installBootloader(); break;
-        case 6: qDebug() << "[DEBUG] Starting runCustomScripts()"; runCustomScripts(); break;
-        case 7: qDebug() << "[DEBUG] Starting cleanup()"; cleanup(); break;
-        default:
-            qDebug() << "[ERROR] Invalid step:" << currentStep;
-            emit installationFinished(false, "Invalid installation step");
-            break;
+    if (finishedTasks.size() == tasks.size()) {
+        qDebug() << "[DEBUG] Installation completed successfully!";
+        updateProgress(100, "Installation completed successfully!");
+        emit installationFinished(true, "Installation completed successfully!");
+        return;
+    }
+    
+    QTimer::singleShot(0, this, &Installer::scheduleTasks);
+}
+
+bool Installer::taskHasWork(const QString &taskId) const {
+    for (const QString &owner : taskProcesses) {
+        if (owner == taskId) return true;
+    }
+    for (const QString &owner : taskWorkers) {
+        if (owner == taskId) return true;
+    }
+    for (const QString &owner : taskChrootCommands) {
+        if (owner == taskId) return true;
+    }
+    return false;
+}
+
+int Installer::completedPercentage() const {
+    return tasks.isEmpty() ? 0 : (finishedTasks.size() * 100) / tasks.size();
+}
+
+QString Installer::taskLabel(const QString &taskId) const {
+    for (const InstallTask &task : tasks) {
+        if (task.id == taskId) {
+            return task.label;
+        }
+    }
+    return taskId;
+}
+
+void Installer::setTaskLabel(const QString &taskId, const QString &label) {
+    for (InstallTask &task : tasks) {
+        if (task.id == taskId) {
+            task.label = label;
+        }
     }
 }
 
@@ -68,8 +282,7 @@ void Installer::partitionDisk() {
         // Validate manual partitioning configuration
         if (config.bootPartition.isEmpty() || config.rootPartition.isEmpty()) {
             QString errorMsg = "Manual partitioning mode requires both boot and root partitions to be assigned";
-            qDebug() << "[FATAL]" << errorMsg;
-            emit installationFinished(false, errorMsg);
+            failInstallation(errorMsg);
             return;
         }
         
@@ -99,8 +312,32 @@ void Installer::partitionDisk() {
     // Validate automatic partitioning configuration
     if (config.selectedDisk.isEmpty()) {
         QString errorMsg = "Automatic partitioning mode requires a disk to be selected";
-        qDebug() << "[FATAL]" << errorMsg;
-        emit installationFinished(false, errorMsg);
+        failInstallation(errorMsg);
+        return;
+    }
+    
+    if (geteuid() == 0) {
+        discardThen([this]() {
+            // GPT written in-process; the kernel learns about each new partition directly
+            QList<PartitionSpec> layout;
+            layout << PartitionSpec{PartitionSpec::Type::EfiSystem, "EFI system partition", 2047};
+            if (config.enableSwap) {
+                layout << PartitionSpec{PartitionSpec::Type::LinuxSwap, "Linux swap", swapSizeMiB()};
+            }
+            layout << PartitionSpec{PartitionSpec::Type::LinuxFilesystem, "Linux root", 0};
+            
+            QStringList devices;
+            QString error;
+            if (!PartitionTableWriter::write(config.selectedDisk, PartitionTableWriter::Scheme::Gpt, layout, &devices, &error)) {
+                failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+                return;
+            }
+            createdPartitions.insert("efi", devices.first());
+            createdPartitions.insert("root", devices.last());
+            if (config.enableSwap) {
+                createdPartitions.insert("swap", devices.at(1));
+            }
+        });
         return;
     }
     
@@ -122,8 +359,9 @@ void Installer::partitionDisk() {
     partedCommands << "set" << "1" << "esp" << "on";
     
     if (config.enableSwap) {
-        partedCommands << "mkpart" << "primary" << "linux-swap" << "2GiB" << "11010MiB";
-        partedCommands << "mkpart" << "primary" << fsType << "11010MiB" << "100%";
+        QString swapEnd = QString("%1MiB").arg(2048 + swapSizeMiB());
+        partedCommands << "mkpart" << "primary" << "linux-swap" << "2GiB" << swapEnd;
+        partedCommands << "mkpart" << "primary" << fsType << swapEnd << "100%";
     } else {
         partedCommands << "mkpart" << "primary" << fsType << "2GiB" << "100%";
     }
@@ -132,13 +370,18 @@ void Installer::partitionDisk() {
     QString partedScript = partedCommands.join(" ");
     partitionCommands << QString("parted %1 --script %2").arg(config.selectedDisk).arg(partedScript);
     
-    // Wait for kernel to recognize new partitions
-    partitionCommands << "partprobe";
-    partitionCommands << "sleep 2";
-    
     // Validate partitions were created
     QString efiPartition = getPartitionName(config.selectedDisk, 1);
     QString rootPartition = getPartitionName(config.selectedDisk, config.enableSwap ? 3 : 2);
+    QStringList newPartitions = {efiPartition, rootPartition};
+    if (config.enableSwap) {
+        newPartitions << getPartitionName(config.selectedDisk, 2);
+    }
+    
+    // Wait for kernel and udev to expose the new partitions
+    partitionCommands << QString("partprobe %1").arg(config.selectedDisk);
+    partitionCommands << DeviceReadiness::waitForDevices(newPartitions, "new partitions");
+    
     partitionCommands << QString("test -b %1 || (echo 'Failed to create EFI partition: %1' && exit 1)").arg(efiPartition);
     partitionCommands << QString("test -b %1 || (echo 'Failed to create root partition: %1' && exit 1)").arg(rootPartition);
     
@@ -154,7 +397,32 @@ void Installer::partitionDisk() {
     executeCommand("bash", QStringList() << "-c" << fullScript);
 }
 
-QString Installer::getPartitionName(const QString &disk, int partitionNumber) {
+QString Installer::targetPartition(const QString &role) const {
+    if (config.partitioningMode == PartitioningMode::Manual) {
+        return role == "efi" ? config.bootPartition : (role == "root" ? config.rootPartition : config.swapPartition);
+    }
+    if (createdPartitions.contains(role)) {
+        return createdPartitions.value(role);
+    }
+    
+    // Partitioned by parted: derive the node names from the layout
+    if (role == "efi") {
+        return getPartitionName(config.selectedDisk, 1);
+    }
+    if (role == "swap") {
+        return config.enableSwap ? getPartitionName(config.selectedDisk, 2) : QString();
+    }
+    return getPartitionName(config.selectedDisk, config.enableSwap ? 3 : 2);
+}
+
+qint64 Installer::swapSizeMiB() const {
+    if (config.swapSizeMiB > 0) {
+        return config.swapSizeMiB;
+    }
+    return SwapPolicy::recommendedSizeMiB(SwapPolicy::installedRamMiB(), config.hibernation);
+}
+
+QString Installer::getPartitionName(const QString &disk, int partitionNumber) const {
     // NVMe drives: /dev/nvme0n1 -> /dev/nvme0n1p1
     // MMC/eMMC: /dev/mmcblk0 -> /dev/mmcblk0p1  
     // Loop devices: /dev/loop0 -> /dev/loop0p1
@@ -163,75 +431,225 @@ QString Installer::getPartitionName(const QString &disk, int partitionNumber) {
     return needsP.match(disk).hasMatch() ? disk + "p" + QString::number(partitionNumber) : disk + QString::number(partitionNumber);
 }
 
-void Installer::formatPartitions() {
-    qDebug() << "[DEBUG] formatPartitions() - Starting partition formatting";
+// EFI, swap and root are separate tasks, so their mkfs runs overlap
+void Installer::formatEfiPartition() {
+    QString efiPartition = targetPartition("efi");
+    qDebug() << "[DEBUG] formatEfiPartition() - EFI partition:" << efiPartition;
     
-    QString efiPartition, rootPartition, swapPartition;
+    QStringList formatCommands;
+    formatCommands << DeviceReadiness::waitForDevices(QStringList() << efiPartition, "EFI partition");
+    formatCommands << QString("test -b %1 || (echo 'EFI partition not found: %1' && exit 1)").arg(efiPartition);
+    formatCommands << QString("mkfs.fat -F32 %1").arg(efiPartition);
+    executeCommand("bash", QStringList() << "-c" << formatCommands.join(" && "));
+}
+
+void Installer::formatSwapPartition() {
+    QString swapPartition = targetPartition("swap");
+    if (swapPartition.isEmpty()) {
+        qDebug() << "[DEBUG] formatSwapPartition() - No swap partition";
+        return;
+    }
+    qDebug() << "[DEBUG] formatSwapPartition() - Swap partition:" << swapPartition;
     
-    if (config.partitioningMode == PartitioningMode::Manual) {
-        efiPartition = config.bootPartition;
-        rootPartition = config.rootPartition;
-        swapPartition = config.swapPartition;
-        qDebug() << "[DEBUG] Manual partitioning - using assigned partitions";
-    } else {
-        efiPartition = getPartitionName(config.selectedDisk, 1);
-        rootPartition = getPartitionName(config.selectedDisk, config.enableSwap ? 3 : 2);
-        if (config.enableSwap) {
-            swapPartition = getPartitionName(config.selectedDisk, 2);
+    QStringList formatCommands;
+    formatCommands << DeviceReadiness::waitForDevices(QStringList() << swapPartition, "swap partition");
+    formatCommands << QString("test -b %1 || (echo 'Swap partition not found: %1' && exit 1)").arg(swapPartition);
+    formatCommands << QString("mkswap %1").arg(swapPartition);
+    formatCommands << QString("swapon %1").arg(swapPartition);
+    mountTable << FstabEntry{swapPartition, "none", "swap", FstabGenerator::mountOptions("swap", swapPartition)};
+    executeCommand("bash", QStringList() << "-c" << formatCommands.join(" && "));
+}
+
+void Installer::setupSwap() {
+    if (config.swapMode == SwapMode::Zram && !SwapPolicy::zramAvailable("/mnt")) {
+        // zram was picked but cannot work; a swap file keeps the system from running without swap
+        qDebug() << "[WARNING] zram-generator is not installed on the target, using a swap file instead";
+        config.swapMode = SwapMode::Swapfile;
+    }
+    
+    if (config.swapMode == SwapMode::Swapfile) {
+        QString fsType = (config.filesystem == "btrfs") ? "btrfs" : "ext4";
+        qint64 sizeMiB = swapSizeMiB();
+        qDebug() << "[DEBUG] setupSwap() - Swap file of" << sizeMiB << "MiB at" << SwapPolicy::swapfilePath(fsType);
+        
+        mountTable << FstabEntry{SwapPolicy::swapfilePath(fsType), "none", "swap", "defaults", true};
+        QStringList swapCommands = SwapPolicy::swapfileCommands("/mnt", fsType, sizeMiB);
+        executeCommand("bash", QStringList() << "-c" << swapCommands.join(" && "));
+        return;
+    }
+    
+    if (config.swapMode == SwapMode::Zram) {
+        qDebug() << "[DEBUG] setupSwap() - Compressed swap in zram";
+        if (geteuid() == 0) {
+            TargetConfigWriter writer("/mnt");
+            writer.writeFile("/etc/systemd/zram-generator.conf", SwapPolicy::zramGeneratorConfig());
+            writer.writeFile("/etc/sysctl.d/99-vm-zram-parameters.conf", SwapPolicy::zramSysctlConfig());
+            QString error;
+            if (!writer.commit(&error)) {
+                failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+            }
+            return;
         }
-        qDebug() << "[DEBUG] Automatic partitioning - using generated partition names";
+        QStringList zramCommands;
+        zramCommands << QString("printf '%s' '%1' > /etc/systemd/zram-generator.conf").arg(SwapPolicy::zramGeneratorConfig());
+        zramCommands << QString("printf '%s' '%1' > /etc/sysctl.d/99-vm-zram-parameters.conf").arg(SwapPolicy::zramSysctlConfig());
+        executeInChroot(zramCommands.join(" && "));
+        return;
     }
     
-    qDebug() << "[DEBUG] EFI partition:" << efiPartition;
-    qDebug() << "[DEBUG] Root partition:" << rootPartition;
+    // A swap partition is set up by format-swap
+    qDebug() << "[DEBUG] setupSwap() - Nothing to set up on the target";
+}
+
+void Installer::formatRootPartition() {
+    QString rootPartition = targetPartition("root");
+    StorageProfile profile = StorageProfile::detect(rootPartition);
+    qDebug() << "[DEBUG] formatRootPartition() - Root partition:" << rootPartition;
+    qDebug() << "[STORAGE]" << profile.disk << "profile:" << profile.summary();
+    
+    // Clean installs can stream a prebuilt root filesystem instead of mkfs + extraction
+    QString bmapPath;
+    QString blockImage;
+    if (config.partitioningMode == PartitioningMode::Automatic) {
+        SettingsParser::loadSettings();
+        blockImage = InstallSource::findBlockImage(config.filesystem == "btrfs" ? "btrfs" : "ext4", &bmapPath);
+        if (!blockImage.isEmpty() && SettingsParser::getVariable("block_deploy", "auto") == "off") {
+            qDebug() << "[DEBUG] Block image" << blockImage << "found but block_deploy=off";
+            blockImage.clear();
+        } else if (!blockImage.isEmpty() && geteuid() != 0) {
+            qDebug() << "[DEBUG] Block image" << blockImage << "found but installer is not running as root";
+            blockImage.clear();
+        }
+    }
+    if (!blockImage.isEmpty()) {
+        // The extraction image will not be read; stop warming it and free its RAM copy
+        ImagePrefetcher::shutdown();
+    }
     
-    // Build complete formatting script that includes waiting and validation
     QStringList formatCommands;
+    formatCommands << DeviceReadiness::waitForDevices(QStringList() << rootPartition, "root partition");
+    formatCommands << QString("test -b %1 || (echo 'Root partition not found: %1' && exit 1)").arg(rootPartition);
     
-    // Wait for partitions to be available
-    formatCommands << "sleep 2";
+    // Format root partition, or grow the deployed image to fill it
+    if (!blockImage.isEmpty()) {
+        formatCommands << deployedRootCommands(rootPartition);
+    } else if (config.filesystem == "btrfs") {
+        QStringList mkfs = QStringList() << "mkfs.btrfs -f" << profile.mkfsOptions("btrfs", diskDiscarded) << rootPartition;
+        qDebug() << "[STORAGE]" << mkfs.join(" ");
+        formatCommands << mkfs.join(" ");
+    } else {
+        QStringList mkfs = QStringList() << "mkfs.ext4 -F" << profile.mkfsOptions("ext4", diskDiscarded) << rootPartition;
+        qDebug() << "[STORAGE]" << mkfs.join(" ");
+        formatCommands << mkfs.join(" ");
+    }
+    QString formatScript = formatCommands.join(" && ");
     
-    // Verify partitions exist before formatting
-    formatCommands << QString("test -b %1 || (echo 'EFI partition not found: %1' && exit 1)").arg(efiPartition);
-    formatCommands << QString("test -b %1 || (echo 'Root partition not found: %1' && exit 1)").arg(rootPartition);
+    if (!blockImage.isEmpty()) {
+        // The remaining formatting runs once the image is on the partition
+        deployedImage = blockImage;
+        postDeployScript = formatScript;
+        setTaskLabel(startingTask, "Deploying system image");
+        setTaskLabel("base-system", "Finishing system image");
+        updateProgress(completedPercentage(), taskLabel(startingTask));
+        
+        deployer = new BlockImageDeployer(blockImage, bmapPath, rootPartition, this);
+        taskWorkers.insert(deployer, startingTask);
+        connect(deployer, &BlockImageDeployer::progressChanged, this, &Installer::onDeployProgress);
+        connect(deployer, &BlockImageDeployer::finished, this, &Installer::onDeployFinished);
+        deployer->start();
+        return;
+    }
     
-    // Format EFI partition
-    formatCommands << QString("mkfs.fat -F32 %1").arg(efiPartition);
+    executeCommand("bash", QStringList() << "-c" << formatScript);
+}
+
+QString Installer::selectBtrfsStream() {
+    if (config.filesystem != "btrfs" || !deployedImage.isEmpty()) {
+        return QString();
+    }
+    
+    // btrfs_stream=auto uses a shipped stream, off disables it, anything else is a path
+    SettingsParser::loadSettings();
+    QString setting = SettingsParser::getVariable("btrfs_stream", "auto");
+    if (setting == "off") {
+        return QString();
+    }
+    QString stream = (setting == "auto") ? InstallSource::findBtrfsStream() : setting;
+    if (!stream.isEmpty() && !QFileInfo(stream).isFile()) {
+        qDebug() << "[WARNING] Configured btrfs stream" << stream << "not found, falling back to image extraction";
+        return QString();
+    }
+    if (!stream.isEmpty()) {
+        qDebug() << "[DEBUG] Using btrfs send stream:" << stream;
+        ImagePrefetcher::shutdown();
+    }
+    return stream;
+}
+
+QStringList Installer::rootSubvolumeCommands() {
+    // Runs with the btrfs top level mounted on /mnt
+    QStringList commands;
+    receivedStream = selectBtrfsStream();
+    if (receivedStream.isEmpty()) {
+        commands << "([ -d /mnt/@ ] || btrfs subvolume create /mnt/@)";
+        return commands;
+    }
     
-    // Handle swap partition if enabled
-    if ((config.partitioningMode == PartitioningMode::Manual && !swapPartition.isEmpty()) || 
-        (config.partitioningMode == PartitioningMode::Automatic && config.enableSwap)) {
-        formatCommands << QString("test -b %1 || (echo 'Swap partition not found: %1' && exit 1)").arg(swapPartition);
-        formatCommands << QString("mkswap %1").arg(swapPartition);
-        formatCommands << QString("swapon %1").arg(swapPartition);
+    QString decompressor;
+    if (receivedStream.endsWith(".zst")) {
+        decompressor = "zstd -dc -T0";
+    } else if (receivedStream.endsWith(".xz")) {
+        decompressor = "xz -dc -T0";
+    } else if (receivedStream.endsWith(".gz")) {
+        decompressor = "gzip -dc";
     }
     
-    // Format root partition
-    if (config.filesystem == "btrfs") {
-        formatCommands << QString("mkfs.btrfs -f %1").arg(rootPartition);
+    setTaskLabel(startingTask, "Mounting partitions and receiving system image");
+    updateProgress(completedPercentage(), taskLabel(startingTask));
+    
+    // Receive keeps compressed extents from v2 streams as they are
+    commands << "mkdir -p /mnt/.arch7z-receive";
+    if (decompressor.isEmpty()) {
+        commands << QString("btrfs receive -f '%1' /mnt/.arch7z-receive").arg(receivedStream);
     } else {
-        formatCommands << QString("mkfs.ext4 -F %1").arg(rootPartition);
+        commands << QString("(set -o pipefail; %1 '%2' | btrfs receive /mnt/.arch7z-receive)").arg(decompressor).arg(receivedStream);
     }
     
-    // Execute all formatting in one script
-    QString formatScript = formatCommands.join(" && ");
-    executeCommand("bash", QStringList() << "-c" << formatScript);
+    // The received snapshot is read-only and carries a received UUID: make it a plain @
+    commands << "RECEIVED=$(ls -A /mnt/.arch7z-receive)";
+    commands << "([ -n \"$RECEIVED\" ] && [ $(ls -A /mnt/.arch7z-receive | wc -l) -eq 1 ] || (echo 'Send stream must contain exactly one subvolume' && exit 1))";
+    commands << "btrfs property set -f -ts \"/mnt/.arch7z-receive/$RECEIVED\" ro false";
+    commands << "([ ! -e /mnt/@ ] || btrfs subvolume delete /mnt/@)";
+    commands << "mv \"/mnt/.arch7z-receive/$RECEIVED\" /mnt/@";
+    commands << "rmdir /mnt/.arch7z-receive";
+    return commands;
 }
 
-void Installer::mountPartitions() {
-    qDebug() << "[DEBUG] mountPartitions() - Starting partition mounting";
-    
-    QString efiPartition, rootPartition;
+QStringList Installer::deployedRootCommands(const QString &rootPartition) const {
+    QStringList commands;
     
-    if (config.partitioningMode == PartitioningMode::Manual) {
-        efiPartition = config.bootPartition;
-        rootPartition = config.rootPartition;
-        qDebug() << "[DEBUG] Manual partitioning - using assigned partitions";
+    // Every install from the same image would otherwise share one filesystem UUID
+    if (config.filesystem == "btrfs") {
+        commands << QString("btrfstune -m %1").arg(rootPartition);
+        commands << "mkdir -p /tmp/deploy-root";
+        commands << QString("mount %1 /tmp/deploy-root").arg(rootPartition);
+        commands << "btrfs filesystem resize max /tmp/deploy-root";
+        commands << "umount /tmp/deploy-root";
+        commands << "rmdir /tmp/deploy-root";
     } else {
-        efiPartition = getPartitionName(config.selectedDisk, 1);
-        rootPartition = getPartitionName(config.selectedDisk, config.enableSwap ? 3 : 2);
-        qDebug() << "[DEBUG] Automatic partitioning - using generated partition names";
+        // e2fsck exits 1 when it fixed something, which is fine here
+        commands << QString("(e2fsck -fy %1 || [ $? -le 1 ])").arg(rootPartition);
+        commands << QString("tune2fs -U random %1").arg(rootPartition);
+        commands << QString("resize2fs %1").arg(rootPartition);
     }
+    return commands;
+}
+
+void Installer::mountPartitions() {
+    qDebug() << "[DEBUG] mountPartitions() - Starting partition mounting";
+    
+    QString efiPartition = targetPartition("efi");
+    QString rootPartition = targetPartition("root");
     
     qDebug() << "[DEBUG] Mounting root partition:" << rootPartition << "to /mnt";
     qDebug() << "[DEBUG] Mounting EFI partition:" << efiPartition << "to /mnt/boot/efi";
@@ -247,22 +665,28 @@ void Installer::mountPartitions() {
     
     if (config.filesystem == "btrfs") {
         // Btrfs with subvolumes
+        BtrfsLayout layout = BtrfsLayout::fromSettings();
         mountCommands << QString("mount %1 /mnt").arg(rootPartition);
-        mountCommands << "btrfs subvolume create /mnt/@";
-        mountCommands << "btrfs subvolume create /mnt/@home";
+        // A deployed image already carries its subvolumes
+        mountCommands << rootSubvolumeCommands();
+        mountCommands << layout.createCommands("/mnt");
         mountCommands << "umount /mnt";
-        mountCommands << QString("mount -o subvol=@,compress=zstd %1 /mnt").arg(rootPartition);
-        mountCommands << "mkdir -p /mnt/home";
-        mountCommands << QString("mount -o subvol=@home,compress=zstd %1 /mnt/home").arg(rootPartition);
+        mountCommands << layout.mountCommands(rootPartition, "/mnt", &mountTable);
     } else {
         // Ext4 simple mount
-        mountCommands << QString("mount %1 /mnt").arg(rootPartition);
+        mountTable << FstabEntry{rootPartition, "/", "ext4", FstabGenerator::mountOptions("ext4", rootPartition)};
+        mountCommands << QString("mount -o %1 %2 /mnt").arg(mountTable.last().options).arg(rootPartition);
         mountCommands << "mkdir -p /mnt/home";
     }
     
     // Mount EFI partition
     mountCommands << "mkdir -p /mnt/boot/efi";
-    mountCommands << QString("mount %1 /mnt/boot/efi").arg(efiPartition);
+    mountTable << FstabEntry{efiPartition, "/boot/efi", "vfat", FstabGenerator::mountOptions("vfat", efiPartition)};
+    mountCommands << QString("mount -o %1 %2 /mnt/boot/efi").arg(mountTable.last().options).arg(efiPartition);
+    
+    for (const FstabEntry &entry : mountTable) {
+        qDebug() << "[STORAGE]" << entry.mountPoint << "mounted with" << entry.options;
+    }
     
     // Validate mounts were successful
     mountCommands << "mountpoint -q /mnt || (echo 'Failed to mount root partition' && exit 1)";
@@ -281,8 +705,60 @@ void Installer::mountPartitions() {
 void Installer::installBaseSystem() {
     qDebug() << "[DEBUG] installBaseSystem() - Starting base system installation";
     
+    if (!deployedImage.isEmpty() || !receivedStream.isEmpty()) {
+        qDebug() << "[DEBUG] Root filesystem already populated from"
+                 << (deployedImage.isEmpty() ? receivedStream : deployedImage) << "- skipping extraction";
+        executeCommand("bash", QStringList() << "-c" << "set -e\n" + postExtractionScript());
+        return;
+    }
+    
+    // Size extraction workers and queues from the cores and memory we actually have
+    ExtractionTuning tuning = SystemResources::extractionTuning();
+    
+    InstallImage image = InstallSource::locate();
+    if (image.isValid()) {
+        // Read from the RAM copy if the prefetcher finished one while the wizard was open
+        image.path = ImagePrefetcher::claim(image.path);
+    }
+    
+    // Prefer in-process work: the SquashFS extractor reads the image once in on-disk
+    // order and writes with all cores; anything it cannot decode (EROFS, LZO SquashFS)
+    // is mounted by the kernel and copied by the parallel tree copier. Both need root.
+    QString reason;
+    if (geteuid() != 0) {
+        reason = "installer is not running as root";
+    } else if (!image.isValid()) {
+        reason = "no install image found";
+    } else if (QProcess::execute("mountpoint", QStringList() << "-q" << "/mnt") != 0 ||
+               QProcess::execute("mountpoint", QStringList() << "-q" << "/mnt/boot/efi") != 0) {
+        reason = "/mnt or /mnt/boot/efi is not mounted";
+    } else if (image.format == InstallImage::Format::Squashfs && SquashfsExtractor::canExtract(image.path, &reason)) {
+        qDebug() << "[DEBUG] Using in-process extraction for" << image.path;
+        extractor = new SquashfsExtractor(image.path, "/mnt", this);
+        taskWorkers.insert(extractor, startingTask);
+        extractor->setWorkerCount(tuning.processors);
+        extractor->setQueueBudgetMb(tuning.dataQueueMb + tuning.fragmentQueueMb);
+        connect(extractor, &SquashfsExtractor::progressChanged, this, &Installer::onExtractionProgress);
+        connect(extractor, &SquashfsExtractor::finished, this, &Installer::onExtractionFinished);
+        extractor->start();
+        return;
+    } else {
+        if (!reason.isEmpty()) {
+            qDebug() << "[DEBUG] In-process extraction unavailable (" << reason << "), copying from the mounted image";
+        }
+        startTreeCopy(image, QStringList(), postExtractionScript());
+        return;
+    }
+    
+    if (image.format == InstallImage::Format::Erofs) {
+        // EROFS decodes fast enough in the kernel: mount it and copy the tree
+        executeCommand("bash", QStringList() << "-c" << erofsCopyScript(image.path) + postExtractionScript());
+        return;
+    }
+    qDebug() << "[DEBUG] In-process extraction unavailable (" << reason << "), falling back to unsquashfs";
+    
     // Create a proper shell script instead of joining with &&
-    QString installScript = R"(
+    QString installScript = (QString(R"(
 #!/bin/bash
 set -e
 
@@ -295,8 +771,10 @@ test -d /mnt/boot/efi || (echo '/mnt/boot/efi is not mounted' && exit 1)
 mountpoint -q /mnt/boot/efi || (echo '/mnt/boot/efi is not mounted' && exit 1)
 
 # Try multiple possible SquashFS locations with bootmnt as primary fallback
-SQUASHFS_PATH=''
-if [ -f /run/archiso/copytoram/airootfs.sfs ]; then
+SQUASHFS_PATH='%4'
+if [ -n "$SQUASHFS_PATH" ] && [ -f "$SQUASHFS_PATH" ]; then
+    echo "Using located SquashFS"
+elif [ -f /run/archiso/copytoram/airootfs.sfs ]; then
     SQUASHFS_PATH='/run/archiso/copytoram/airootfs.sfs'
     echo 'Using copytoram SquashFS'
 elif [ -f /run/archiso/bootmnt/arch/x86_64/airootfs.sfs ]; then
@@ -329,9 +807,10 @@ else
     # Extract directly without mounting to save memory
     if command -v unsquashfs >/dev/null 2>&1; then
         echo 'Using unsquashfs for direct extraction'
+        echo 'Extraction settings: processors=%1 data_queue=%2MB fragment_queue=%3MB'
         cd /mnt
-        # Extract with memory limits and progress
-        unsquashfs -f -d . -p 1 "$SQUASHFS_PATH"
+        # Extract with adaptive worker count and queue sizes
+        unsquashfs -f -d . -p %1 -da %2 -fr %3 "$SQUASHFS_PATH"
         
         # Clean cache every few seconds during extraction
         echo 1 > /proc/sys/vm/drop_caches &
@@ -340,8 +819,8 @@ else
         mkdir -p /tmp/squashfs-root
         mount -t squashfs -o loop,ro "$SQUASHFS_PATH" /tmp/squashfs-root
         
-        # Use cp instead of rsync for lower memory usage
-        cp -a /tmp/squashfs-root/* /mnt/ 2>/dev/null || true
+        # Use cp instead of rsync for lower memory usage; "/." includes dotfiles
+        cp -a /tmp/squashfs-root/. /mnt/
         
         # Immediate cleanup
         umount /tmp/squashfs-root
@@ -357,6 +836,17 @@ else
     echo "Memory after extraction: ${MEM_AFTER}KB"
 fi
 
+)") + postExtractionScript())
+    .arg(tuning.processors)
+    .arg(tuning.dataQueueMb)
+    .arg(tuning.fragmentQueueMb)
+    .arg(image.path);
+    
+    executeCommand("bash", QStringList() << "-c" << installScript);
+}
+
+QString Installer::postExtractionScript() {
+    return QString(R"(
 # Copy kernel - prioritize SquashFS source over live environment
 mkdir -p /mnt/boot
 if [ -f /mnt/usr/lib/modules/$(uname -r)/vmlinuz ]; then
@@ -377,14 +867,202 @@ mkdir -p /mnt/{dev,proc,sys,run}
 # Verify installation
 test -d /mnt/etc || (echo 'System installation failed - /mnt/etc missing' && exit 1)
 test -d /mnt/usr || (echo 'System installation failed - /mnt/usr missing' && exit 1)
-)";
+)");
+}
+
+QString Installer::erofsCopyScript(const QString &imagePath) {
+    return QString(R"(
+#!/bin/bash
+set -e
+
+# Validate that /mnt exists and is mounted
+mountpoint -q /mnt || (echo '/mnt is not mounted' && exit 1)
+mountpoint -q /mnt/boot/efi || (echo '/mnt/boot/efi is not mounted' && exit 1)
+
+EROFS_PATH='%1'
+echo "Using EROFS image: $EROFS_PATH"
+grep -qw erofs /proc/filesystems || modprobe erofs
+
+mkdir -p /tmp/erofs-root
+mount -t erofs -o loop,ro "$EROFS_PATH" /tmp/erofs-root
+trap 'umount /tmp/erofs-root 2>/dev/null; rmdir /tmp/erofs-root 2>/dev/null' EXIT
+
+# Plain page-cache reads; reflink/sparse keep the copy cheap on the target
+cp -a --reflink=auto --sparse=always /tmp/erofs-root/. /mnt/
+
+umount /tmp/erofs-root
+rmdir /tmp/erofs-root
+trap - EXIT
+sync
+)").arg(imagePath);
+}
+
+void Installer::onExtractionProgress(qint64 bytesDone, qint64 bytesTotal, quint32 inodesDone, quint32 inodesTotal) {
+    updateStepProgress(taskWorkers.value(extractor), bytesDone, bytesTotal, QString("%1 / %2 MB, %3 / %4 files")
+                       .arg(bytesDone / (1024 * 1024))
+                       .arg(bytesTotal / (1024 * 1024))
+                       .arg(inodesDone)
+                       .arg(inodesTotal));
+}
+
+void Installer::onExtractionFinished(bool success, const QString &message) {
+    extractor->wait();
+    QString task = taskWorkers.take(extractor);
+    extractor->deleteLater();
+    extractor = nullptr;
+
+    if (!success) {
+        failInstallation(QString("FAILED: %1\n\nIn-process SquashFS extraction failed:\n%2")
+                         .arg(taskLabel(task)).arg(message));
+        return;
+    }
+
+    qDebug() << "[SUCCESS]" << message;
+    // Kernel copy and layout checks still go through the privileged shell path
+    executeTaskCommand(task, "bash", QStringList() << "-c" << "set -e\nsync\n" + postExtractionScript());
+}
+
+void Installer::startTreeCopy(const InstallImage &image, const QStringList &excludes, const QString &postScript) {
+    const QString mountPoint = "/tmp/arch7z-image";
+    QDir().mkpath(mountPoint);
+    if (QProcess::execute("mount", QStringList() << "-t" << image.mountType() << "-o" << "loop,ro"
+                          << image.path << mountPoint) != 0) {
+        failInstallation(QString("FAILED: %1\n\nCannot mount %2 image %3")
+                         .arg(taskLabel(startingTask)).arg(image.mountType()).arg(image.path));
+        return;
+    }
     
-    executeCommand("bash", QStringList() << "-c" << installScript);
+    copyMountPoint = mountPoint;
+    afterCopyScript = postScript;
+    
+    // Copying is mostly metadata and I/O latency: use more workers than cores on small machines
+    copier = new TreeCopier(mountPoint, "/mnt", this);
+    taskWorkers.insert(copier, startingTask);
+    copier->setWorkerCount(std::max(4, SystemResources::cpuCount()));
+    copier->setExcludes(excludes);
+    connect(copier, &TreeCopier::progressChanged, this, &Installer::onCopyProgress);
+    connect(copier, &TreeCopier::finished, this, &Installer::onCopyFinished);
+    copier->start();
+}
+
+void Installer::onCopyProgress(qint64 bytesDone, quint64 filesDone, double bytesPerSecond, double filesPerSecond) {
+    updateStepProgress(taskWorkers.value(copier), 0, 0, QString("%1 MB, %2 files (%3 MB/s, %4 files/s)")
+                       .arg(bytesDone / (1024 * 1024))
+                       .arg(filesDone)
+                       .arg(bytesPerSecond / (1024 * 1024), 0, 'f', 1)
+                       .arg(filesPerSecond, 0, 'f', 0));
+}
+
+void Installer::onCopyFinished(bool success, const QString &message) {
+    copier->wait();
+    QString task = taskWorkers.take(copier);
+    copier->deleteLater();
+    copier = nullptr;
+    
+    QProcess::execute("umount", QStringList() << copyMountPoint);
+    QDir().rmdir(copyMountPoint);
+    copyMountPoint.clear();
+
+    if (!success) {
+        failInstallation(QString("FAILED: %1\n\nCopying the system image failed:\n%2")
+                         .arg(taskLabel(task)).arg(message));
+        return;
+    }
+
+    qDebug() << "[SUCCESS]" << message;
+    executeTaskCommand(task, "bash", QStringList() << "-c" << "set -e\nsync\n" + afterCopyScript);
+}
+
+void Installer::onDeployProgress(qint64 bytesDone, qint64 bytesTotal) {
+    updateStepProgress(taskWorkers.value(deployer), bytesDone, bytesTotal, QString("%1 / %2 MB")
+                       .arg(bytesDone / (1024 * 1024))
+                       .arg(bytesTotal / (1024 * 1024)));
+}
+
+void Installer::onDeployFinished(bool success, const QString &message) {
+    deployer->wait();
+    QString task = taskWorkers.take(deployer);
+    deployer->deleteLater();
+    deployer = nullptr;
+
+    if (!success) {
+        failInstallation(QString("FAILED: %1\n\nBlock image deployment failed:\n%2")
+                         .arg(taskLabel(task)).arg(message));
+        return;
+    }
+
+    qDebug() << "[SUCCESS]" << message;
+    executeTaskCommand(task, "bash", QStringList() << "-c" << postDeployScript);
+}
+
+void Installer::discardThen(const std::function<void()> &next) {
+    SettingsParser::loadSettings();
+    QString setting = SettingsParser::getVariable("disk_discard", "auto");
+    if (setting == "off") {
+        next();
+        return;
+    }
+    
+    // HDDs have nothing to discard (virtual disks often claim to be rotational
+    // but still pass discard through); disks without discard do not advertise it
+    StorageProfile profile = StorageProfile::detect(config.selectedDisk);
+    bool hdd = profile.rotational && profile.kind != StorageProfile::Kind::VirtualDisk;
+    if (hdd || !profile.discard) {
+        qDebug() << "[STORAGE] Skipping whole-disk discard on" << profile.summary();
+        next();
+        return;
+    }
+    
+    DeviceDiscarder::Mode mode = DeviceDiscarder::Mode::Discard;
+    if (setting == "secure") {
+        if (DeviceDiscarder::supports(config.selectedDisk, DeviceDiscarder::Mode::SecureErase)) {
+            mode = DeviceDiscarder::Mode::SecureErase;
+        } else {
+            qDebug() << "[WARNING]" << config.selectedDisk << "does not support secure erase, discarding instead";
+        }
+    }
+    
+    setTaskLabel(startingTask, mode == DeviceDiscarder::Mode::SecureErase ? "Securely erasing disk" : "Discarding disk");
+    updateProgress(completedPercentage(), taskLabel(startingTask));
+    
+    afterDiscard = next;
+    discarder = new DeviceDiscarder(config.selectedDisk, mode, this);
+    taskWorkers.insert(discarder, startingTask);
+    connect(discarder, &DeviceDiscarder::finished, this, &Installer::onDiscardFinished);
+    discarder->start();
+}
+
+void Installer::onDiscardFinished(bool success, const QString &message) {
+    discarder->wait();
+    QString task = taskWorkers.take(discarder);
+    discarder->deleteLater();
+    discarder = nullptr;
+    
+    if (failed) {
+        return;
+    }
+    
+    // The disk is still usable when the discard is refused, just not pre-trimmed
+    if (success) {
+        qDebug() << "[STORAGE]" << message;
+        diskDiscarded = true;
+    } else {
+        qDebug() << "[WARNING] Whole-disk discard failed, continuing:" << message;
+    }
+    
+    std::function<void()> next = afterDiscard;
+    afterDiscard = nullptr;
+    startingTask = task;
+    next();
+    startingTask.clear();
+    
+    if (!failed && !taskHasWork(task)) {
+        completeTask(task);
+    }
 }
 
 void Installer::configureSystem() {
     qDebug() << "[DEBUG] configureSystem() - Starting system configuration";
-    qDebug() << "[DEBUG] === BEFORE FINAL SETTINGS ===";
     qDebug() << "[DEBUG] Partitioning mode:" << (config.partitioningMode == PartitioningMode::Manual ? "Manual" : "Automatic");
     qDebug() << "[DEBUG] Filesystem:" << config.filesystem;
     qDebug() << "[DEBUG] System state check:";
@@ -392,77 +1070,306 @@ void Installer::configureSystem() {
     qDebug() << "[DEBUG] - /mnt/etc exists:" << QDir("/mnt/etc").exists();
     qDebug() << "[DEBUG] - /mnt/boot exists:" << QDir("/mnt/boot").exists();
     
-    // Build complete configuration script
-    QStringList configCommands;
-    
-    // Validate base system is installed
-    configCommands << "test -d /mnt/etc || (echo 'Base system not installed - /mnt/etc missing' && exit 1)";
+    QStringList chrootCommands;
+    chrootCommands << "set -e";
     
     // Write configuration files
     QString langCode = config.language.split(" ").first();
-    configCommands << QString("echo '%1' > /mnt/etc/locale.gen").arg(config.language);
-    configCommands << QString("echo 'LANG=%1' > /mnt/etc/locale.conf").arg(langCode);
-    configCommands << QString("echo '%1' > /mnt/etc/hostname").arg(config.hostname);
-    configCommands << QString("echo -e '127.0.0.1\\tlocalhost\\n::1\\t\\tlocalhost\\n127.0.1.1\\t%1' > /mnt/etc/hosts").arg(config.hostname);
-    configCommands << QString("echo 'KEYMAP=%1' > /mnt/etc/vconsole.conf").arg(config.keyboardLayout);
+    QString localeGen = config.language + "\n";
+    QString localeConf = QString("LANG=%1\n").arg(langCode);
+    QString vconsoleConf = QString("KEYMAP=%1\n").arg(config.keyboardLayout);
+    // Ensure linux.preset exists and is properly configured (overwrite to fix archiso references)
+    QString linuxPreset = BootBackend::linuxPreset(bootBackend());
+    bool vmTuning = VMDetection::isVirtualMachine();
+    if (vmTuning) {
+        qDebug() << "[DEBUG] Detected virtual machine:" << VMDetection::getVirtualizationType() << "- applying kernel optimizations only";
+    }
     
-    // Generate fstab with UUIDs
-    configCommands << "genfstab -U /mnt > /mnt/etc/fstab";
+    // Host-only images carry the drivers of the disk the system is installed to
+    bool hostOnly = InitramfsBuilder::hostOnlyEnabled();
+    QStringList deferredImages = deferredInitramfsImages();
+    QStringList hostModules;
+    if (hostOnly) {
+        for (const FstabEntry &entry : mountTable) {
+            if (entry.mountPoint == "/") {
+                hostModules = InitramfsBuilder::hostModules(entry.device);
+            }
+        }
+        hostModules << ((config.filesystem == "btrfs") ? "btrfs" : "ext4");
+        qDebug() << "[INITRAMFS] Host-only modules:" << hostModules.join(" ") << "- deferred to first boot:" << deferredImages;
+    }
     
-    // Verify fstab was created properly
-    configCommands << "test -s /mnt/etc/fstab || (echo 'Failed to generate fstab' && exit 1)";
+    // fstab is generated on the host, everything else inside the target
+    QStringList hostCommands;
+    if (geteuid() == 0) {
+        // Built from what the installer mounted, with UUIDs read from the superblocks
+        QString error;
+        QString fstab = FstabGenerator::generate(mountTable, &error);
+        if (fstab.isEmpty()) {
+            failInstallation(QString("FAILED: %1\n\nFailed to generate fstab:\n%2").arg(taskLabel(startingTask)).arg(error));
+            return;
+        }
+        
+        TargetConfigWriter writer("/mnt");
+        writer.writeFile("/etc/fstab", fstab);
+        writer.writeFile("/etc/locale.gen", localeGen);
+        writer.writeFile("/etc/locale.conf", localeConf);
+        writer.writeFile("/etc/vconsole.conf", vconsoleConf);
+        writer.writeFile("/etc/mkinitcpio.d/linux.preset", linuxPreset);
+        if (hostOnly) {
+            writer.writeFile(InitramfsBuilder::hostOnlyConfigPath(), InitramfsBuilder::hostOnlyConfig(hostModules));
+        }
+        if (!deferredImages.isEmpty()) {
+            writer.writeFile(InitramfsBuilder::deferredBuildScriptPath(), InitramfsBuilder::deferredBuildScript(deferredImages), 0755);
+            writer.writeFile("/etc/systemd/system/" + InitramfsBuilder::deferredBuildUnitName(), InitramfsBuilder::deferredBuildUnit());
+        }
+        // VM-optimized kernel parameters only
+        if (vmTuning && writer.assignment("/etc/default/grub", "GRUB_CMDLINE_LINUX_DEFAULT") == "\"quiet\"") {
+            writer.setAssignment("/etc/default/grub", "GRUB_CMDLINE_LINUX_DEFAULT", "\"quiet elevator=noop\"");
+        }
+        if (!writer.commit(&error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+            return;
+        }
+    } else {
+        hostCommands << "test -d /mnt/etc || (echo 'Base system not installed - /mnt/etc missing' && exit 1)";
+        
+        // Generate fstab with UUIDs
+        hostCommands << "genfstab -U /mnt > /mnt/etc/fstab";
+        
+        // Verify fstab was created properly
+        hostCommands << "test -s /mnt/etc/fstab || (echo 'Failed to generate fstab' && exit 1)";
+        
+        // genfstab only sees active swap; swap files are not enabled during the install
+        for (const FstabEntry &entry : mountTable) {
+            if (entry.file) {
+                hostCommands << QString("printf '%1\\t%2\\t%3\\t%4\\t0 0\\n' >> /mnt/etc/fstab")
+                                .arg(entry.device).arg(entry.mountPoint).arg(entry.type).arg(entry.options);
+            }
+        }
+        
+        chrootCommands << QString("printf '%s' '%1' > /etc/locale.gen").arg(localeGen);
+        chrootCommands << QString("printf '%s' '%1' > /etc/locale.conf").arg(localeConf);
+        chrootCommands << QString("printf '%s' '%1' > /etc/vconsole.conf").arg(vconsoleConf);
+        chrootCommands << QString("printf '%s' '%1' > /etc/mkinitcpio.d/linux.preset").arg(linuxPreset);
+        // Heredocs keep the quoting of the generated files intact
+        if (hostOnly) {
+            chrootCommands << "mkdir -p /etc/mkinitcpio.conf.d";
+            chrootCommands << QString("cat > %1 <<'ARCH7Z_EOF'\n%2ARCH7Z_EOF").arg(InitramfsBuilder::hostOnlyConfigPath()).arg(InitramfsBuilder::hostOnlyConfig(hostModules));
+        }
+        if (!deferredImages.isEmpty()) {
+            QString deferredScript = InitramfsBuilder::deferredBuildScriptPath();
+            chrootCommands << QString("mkdir -p \"$(dirname %1)\"").arg(deferredScript);
+            chrootCommands << QString("cat > %1 <<'ARCH7Z_EOF'\n%2ARCH7Z_EOF").arg(deferredScript).arg(InitramfsBuilder::deferredBuildScript(deferredImages));
+            chrootCommands << QString("chmod 755 %1").arg(deferredScript);
+            chrootCommands << QString("cat > /etc/systemd/system/%1 <<'ARCH7Z_EOF'\n%2ARCH7Z_EOF").arg(InitramfsBuilder::deferredBuildUnitName()).arg(InitramfsBuilder::deferredBuildUnit());
+        }
+        if (vmTuning) {
+            chrootCommands << "sed -i 's/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet\"/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet elevator=noop\"/' /etc/default/grub";
+        }
+    }
     
     // Generate machine ID
-    configCommands << "arch-chroot /mnt systemd-machine-id-setup";
+    chrootCommands << "systemd-machine-id-setup";
     
-    // Sync pacman databases if internet available
-    configCommands << "if ping -c 1 8.8.8.8 >/dev/null 2>&1; then arch-chroot /mnt pacman -Sy || true; else echo 'No internet - skipping repo sync'; fi";
-    
-    qDebug() << "[DEBUG] === BEFORE FINAL SETTINGS FROM CONFIG FILE ===";
+    // Basic mkinitcpio cleanup
+    chrootCommands << "rm -f /etc/mkinitcpio.conf.d/archiso.conf";
     
-    // Create user
-    configCommands << QString("arch-chroot /mnt useradd -m -G wheel,audio,video,optical,storage -s /bin/%1 %2")
-                      .arg(config.shell).arg(config.username);
+    // The busybox initramfs needs the resume hook to wake from the swap partition
+    if (config.hibernation && config.swapMode == SwapMode::Partition) {
+        chrootCommands << "if ! grep -qE '^HOOKS=.*[( ](systemd|resume)[ )]' /etc/mkinitcpio.conf; then "
+                          "sed -i '/^HOOKS=/ s/ filesystems/ filesystems resume/' /etc/mkinitcpio.conf; fi";
+    }
     
-    // Set passwords
-    configCommands << QString("arch-chroot /mnt bash -c \"echo '%1:%2' | chpasswd\"")
-                      .arg(config.username).arg(config.password);
+    if (!deferredImages.isEmpty()) {
+        chrootCommands << QString("systemctl enable %1").arg(InitramfsBuilder::deferredBuildUnitName());
+    }
     
-    QString rootPass = config.samePassword ? config.password : config.rootPassword;
-    configCommands << QString("arch-chroot /mnt bash -c \"echo 'root:%1' | chpasswd\"")
-                      .arg(rootPass);
+    qDebug() << "[DEBUG] Total basic commands to execute:" << hostCommands.size() + chrootCommands.size() - 1;
     
-    // Enable sudo for wheel group
-    configCommands << "arch-chroot /mnt sed -i 's/^# %wheel ALL=(ALL:ALL) ALL/%wheel ALL=(ALL:ALL) ALL/' /etc/sudoers";
+    // The two halves touch different files and run side by side
+    if (!hostCommands.isEmpty()) {
+        executeCommand("bash", QStringList() << "-c" << hostCommands.join(" && "));
+    }
+    executeInChroot(chrootCommands.join("\n"));
+}
+
+void Installer::generateInitramfs() {
+    QFile deferred("/mnt" + InitramfsBuilder::deferredLog());
+    if (deferred.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QStringList requests = QString::fromUtf8(deferred.readAll()).split('\n', Qt::SkipEmptyParts);
+        qDebug() << "[INITRAMFS]" << requests.size() << "mkinitcpio runs from the final settings folded into this build:" << requests;
+        deferred.close();
+        deferred.remove();
+    }
     
-    // Basic mkinitcpio cleanup and preset configuration
-    configCommands << "arch-chroot /mnt rm -f /etc/mkinitcpio.conf.d/archiso.conf";
+    // UKIs embed the kernel command line mkinitcpio reads from /etc/kernel/cmdline
+    QString script;
+    if (bootBackend() != BootBackend::Kind::Grub) {
+        FstabEntry rootEntry = rootMountEntry();
+        QString subvolume = rootEntry.type == "btrfs" ? "@" : QString();
+        if (geteuid() == 0) {
+            TargetConfigWriter writer("/mnt");
+            QStringList arguments;
+            for (const char *key : {"GRUB_CMDLINE_LINUX", "GRUB_CMDLINE_LINUX_DEFAULT"}) {
+                QString value = writer.assignment("/etc/default/grub", key);
+                if (value.size() >= 2 && (value.startsWith('"') || value.startsWith('\''))) {
+                    value = value.mid(1, value.size() - 2);
+                }
+                arguments << value;
+            }
+            QString uuid;
+            QString error;
+            if (!FstabGenerator::readUuid(rootEntry.device, rootEntry.type, &uuid, &error)) {
+                failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+                return;
+            }
+            QString cmdline = BootBackend::kernelCmdline(uuid, subvolume, arguments);
+            writer.writeFile("/etc/kernel/cmdline", cmdline + "\n");
+            if (!writer.commit(&error)) {
+                failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+                return;
+            }
+            qDebug() << "[INITRAMFS] Kernel command line:" << cmdline;
+        } else {
+            // Unquoted expansions drop the empty arguments
+            script += QString("mkdir -p /etc/kernel && ( . /etc/default/grub; echo root=UUID=$(blkid -s UUID -o value %1) rw%2 $GRUB_CMDLINE_LINUX $GRUB_CMDLINE_LINUX_DEFAULT ) > /etc/kernel/cmdline || exit 1\n")
+                      .arg(rootEntry.device).arg(subvolume.isEmpty() ? QString() : " rootflags=subvol=" + subvolume);
+        }
+    }
     
-    // Ensure linux.preset exists and is properly configured (overwrite to fix archiso references)
-    configCommands << "arch-chroot /mnt bash -c 'cat > /etc/mkinitcpio.d/linux.preset << EOF\nALL_config=\"/etc/mkinitcpio.conf\"\nALL_kver=\"/boot/vmlinuz-linux\"\n\nPRESETS=(\"default\" \"fallback\")\n\ndefault_image=\"/boot/initramfs-linux.img\"\nfallback_image=\"/boot/initramfs-linux-fallback.img\"\nfallback_options=\"-S autodetect\"\nEOF'";
+    // Every preset image at once, each by its own mkinitcpio
+    qDebug() << "[INITRAMFS] Building all preset images concurrently" << (InitramfsBuilder::hostOnlyEnabled() ? "(host-only)" : "");
+    QStringList deferredImages = deferredInitramfsImages();
+    if (bootBackend() != BootBackend::Kind::Uki) {
+        script += InitramfsBuilder::buildScript(deferredImages);
+        executeInChroot(script);
+        return;
+    }
     
-    // Generate initial initramfs (REQUIRED before arch7z-system-final)
-    configCommands << "echo '[DEBUG] Generating initial initramfs...' && arch-chroot /mnt mkinitcpio -P";
+    // One boot entry per image, the default one last so it ends up first in BootOrder
+    SettingsParser::loadSettings();
+    QString bootloaderId = SettingsParser::getBootloaderId();
+    QList<PendingBootEntry> entries;
+    for (const char *entry : {"fallback", "default"}) {
+        entries << PendingBootEntry{BootBackend::ukiLoader(entry), QString(entry) == "default" ? bootloaderId : bootloaderId + " (" + entry + ")"};
+    }
+    script += "(\n" + InitramfsBuilder::buildScript(deferredImages) + "\n) || exit 1\n";
+    if (geteuid() == 0) {
+        pendingBootEntries[startingTask] = entries;
+    } else {
+        QString espPartition = targetPartition("efi");
+        for (const PendingBootEntry &entry : entries) {
+            script += QString("efibootmgr --create --disk /dev/$(lsblk -no pkname %1) --part $(cat /sys/class/block/$(basename %1)/partition) --label '%2' --loader '%3'\n")
+                      .arg(espPartition).arg(entry.label).arg(QString(entry.loader).replace('/', '\\'));
+        }
+    }
+    executeInChroot(script);
+}
+
+QStringList Installer::deferredInitramfsImages() const {
+    // Each UKI needs its own boot entry, which only the installer creates
+    if (bootBackend() == BootBackend::Kind::Uki) {
+        return QStringList();
+    }
+    return InitramfsBuilder::deferredEntries();
+}
+
+void Installer::syncPackageDatabases() {
+    // Sync pacman databases if internet available
+    executeInChroot("if ping -c 1 8.8.8.8 >/dev/null 2>&1; then pacman -Sy || true; else echo 'No internet - skipping repo sync'; fi");
+}
+
+void Installer::createUsers() {
+    qDebug() << "[DEBUG] createUsers() - Applying user configuration";
     
-    // VM-specific optimizations (kernel parameters only - no package installation)
-    if (VMDetection::isVirtualMachine()) {
-        QString vmType = VMDetection::getVirtualizationType();
-        qDebug() << "[DEBUG] Detected virtual machine:" << vmType << "- applying kernel optimizations only";
+    QString rootPass = config.samePassword ? config.password : config.rootPassword;
+    QString hosts = QString("127.0.0.1\tlocalhost\n::1\t\tlocalhost\n127.0.1.1\t%1\n").arg(config.hostname);
+    QStringList userGroups = {"wheel", "audio", "video", "optical", "storage"};
+    
+    if (geteuid() == 0) {
+        // Accounts and files are written directly, no useradd/chpasswd round-trips
+        TargetConfigWriter writer("/mnt");
+        writer.writeFile("/etc/hostname", config.hostname + "\n");
+        writer.writeFile("/etc/hosts", hosts);
         
-        // VM-optimized kernel parameters only
-        configCommands << "arch-chroot /mnt sed -i 's/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet\"/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet elevator=noop\"/' /etc/default/grub";
+        QString error;
+        if (!writer.addUser(config.username, config.password, config.shell, userGroups, &error) ||
+            !writer.setPassword("root", rootPass, &error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+            return;
+        }
+        
+        // Enable sudo for wheel group
+        writer.replaceLine("/etc/sudoers", "# %wheel ALL=(ALL:ALL) ALL", "%wheel ALL=(ALL:ALL) ALL");
+        
+        if (!writer.commit(&error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+        }
+        return;
     }
     
-    qDebug() << "[DEBUG] === EXECUTING BASIC CONFIGURATION ===";
-    qDebug() << "[DEBUG] Total basic commands to execute:" << configCommands.size();
+    QStringList userCommands;
+    userCommands << "set -e";
+    userCommands << QString("echo '%1' > /etc/hostname").arg(config.hostname);
+    userCommands << QString("printf '%s' '%1' > /etc/hosts").arg(hosts);
     
-    // Execute all basic configuration in one script
-    QString configScript = configCommands.join(" && ");
-    executeCommand("bash", QStringList() << "-c" << configScript);
+    // Create user
+    userCommands << QString("useradd -m -G %1 -s /bin/%2 %3")
+                    .arg(userGroups.join(',')).arg(config.shell).arg(config.username);
+    
+    // Set passwords
+    userCommands << QString("echo '%1:%2' | chpasswd")
+                    .arg(config.username).arg(config.password);
     
-    // Final settings will be executed after bootloader installation
+    userCommands << QString("echo 'root:%1' | chpasswd")
+                    .arg(rootPass);
     
-    qDebug() << "[DEBUG] === AFTER FINAL SETTINGS FROM CONFIG FILE ===";
+    // Enable sudo for wheel group
+    userCommands << "sed -i 's/^# %wheel ALL=(ALL:ALL) ALL/%wheel ALL=(ALL:ALL) ALL/' /etc/sudoers";
+    
+    executeInChroot(userCommands.join("\n"));
+}
+
+bool Installer::applyGrubDefaults(QStringList *chrootCommands) {
+    // Hibernation resumes from the swap partition
+    QString swapPartition = targetPartition("swap");
+    bool resume = config.hibernation && config.swapMode == SwapMode::Partition && !swapPartition.isEmpty();
+    
+    if (geteuid() != 0) {
+        if (resume) {
+            chrootCommands->append(QString("sed -i \"s/GRUB_CMDLINE_LINUX_DEFAULT=.*/GRUB_CMDLINE_LINUX_DEFAULT=\\\"quiet resume=UUID=$(blkid -s UUID -o value %1)\\\"/\" /etc/default/grub").arg(swapPartition));
+        } else {
+            chrootCommands->append("sed -i 's/GRUB_CMDLINE_LINUX_DEFAULT=.*/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet\"/' /etc/default/grub");
+        }
+        chrootCommands->append("sed -i 's/#GRUB_DISABLE_OS_PROBER=false/GRUB_DISABLE_OS_PROBER=false/' /etc/default/grub");
+        chrootCommands->append("sed -i 's/GRUB_TIMEOUT=.*/GRUB_TIMEOUT=5/' /etc/default/grub");
+        return true;
+    }
+    
+    QString cmdline = "quiet";
+    if (resume) {
+        QString uuid;
+        QString error;
+        if (!FstabGenerator::readUuid(swapPartition, "swap", &uuid, &error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+            return false;
+        }
+        cmdline += " resume=UUID=" + uuid;
+    }
+    
+    TargetConfigWriter writer("/mnt");
+    writer.setAssignment("/etc/default/grub", "GRUB_CMDLINE_LINUX_DEFAULT", "\"" + cmdline + "\"");
+    // Enable os-prober for dual boot detection
+    writer.setAssignment("/etc/default/grub", "GRUB_DISABLE_OS_PROBER", "false");
+    writer.setAssignment("/etc/default/grub", "GRUB_TIMEOUT", "5");
+    
+    QString error;
+    if (!writer.commit(&error)) {
+        failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+        return false;
+    }
+    return true;
 }
 
 void Installer::installBootloader() {
@@ -476,31 +1383,98 @@ void Installer::installBootloader() {
     
     // Build complete bootloader installation script
     QStringList bootloaderCommands;
+    bootloaderCommands << "set -e";
     
     // Validate system is properly configured
-    bootloaderCommands << "test -f /mnt/etc/fstab || (echo 'System not properly installed - /mnt/etc/fstab missing' && exit 1)";
-    
-    // Configure GRUB
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/GRUB_CMDLINE_LINUX_DEFAULT=.*/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet\"/' /etc/default/grub";
+    bootloaderCommands << "test -f /etc/fstab || (echo 'System not properly installed - /etc/fstab missing' && exit 1)";
     
-    // Enable os-prober for dual boot detection
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/#GRUB_DISABLE_OS_PROBER=false/GRUB_DISABLE_OS_PROBER=false/' /etc/default/grub";
+    // Configure GRUB: quiet boot, os-prober for dual boot detection, 5 s timeout
+    if (!applyGrubDefaults(&bootloaderCommands)) {
+        return;
+    }
     
-    // Set proper timeout
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/GRUB_TIMEOUT=.*/GRUB_TIMEOUT=5/' /etc/default/grub";
+    // Kernel arguments come from /etc/default/grub with every backend
+    BootBackend::Kind backend = bootBackend();
+    if (backend != BootBackend::Kind::Grub) {
+        qDebug() << "[DEBUG] === BOOTLOADER INSTALLATION (" << BootBackend::name(backend) << ") ===";
+        if (installUkiBoot(backend, bootloaderId, &bootloaderCommands)) {
+            executeInChroot(bootloaderCommands.join("\n"));
+        }
+        return;
+    }
     
     qDebug() << "[DEBUG] === BOOTLOADER INSTALLATION ===";
-    // Install GRUB to EFI using bootloader ID from config
-    bootloaderCommands << QString("echo '[DEBUG] Installing GRUB (removable)...' && arch-chroot /mnt grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=%1 --removable").arg(bootloaderId);
-    bootloaderCommands << QString("echo '[DEBUG] Installing GRUB (standard)...' && arch-chroot /mnt grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=%1").arg(bootloaderId);
-    
+    // Install GRUB to EFI using bootloader ID from config. The core image is
+    // built once and copied to the removable fallback path; as root the NVRAM
+    // entry is written through efivarfs instead of by grub-install
+    QString loader = QString("/EFI/%1/grubx64.efi").arg(bootloaderId);
+    bool nvramInProcess = geteuid() == 0;
+    if (nvramInProcess) {
+        if (EfiBootEntry::available()) {
+            // Written once grub-install and the copy below succeeded
+            pendingBootEntries[startingTask] << PendingBootEntry{loader, bootloaderId};
+        } else {
+            qDebug() << "[WARNING] No efivarfs (not booted in UEFI mode) - relying on the removable path";
+        }
+    }
+    bootloaderCommands << QString("echo '[DEBUG] Installing GRUB...' && grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=%1%2")
+                          .arg(bootloaderId).arg(nvramInProcess ? " --no-nvram" : "");
+    bootloaderCommands << "mkdir -p /boot/efi/EFI/BOOT";
+    bootloaderCommands << QString("cp /boot/efi%1 /boot/efi/EFI/BOOT/BOOTX64.EFI").arg(loader);
     
-    // Generate GRUB configuration (after GRUB is installed and initramfs exists)
-    bootloaderCommands << "echo '[DEBUG] Generating GRUB config...' && arch-chroot /mnt grub-mkconfig -o /boot/grub/grub.cfg";
+    // grub.cfg is generated by the grub-config task once the final settings ran
     
     // Execute all bootloader commands in one script
-    QString bootloaderScript = bootloaderCommands.join(" && ");
-    executeCommand("bash", QStringList() << "-c" << bootloaderScript);
+    executeInChroot(bootloaderCommands.join("\n"));
+}
+
+bool Installer::installUkiBoot(BootBackend::Kind backend, const QString &bootloaderId, QStringList *chrootCommands) {
+    // mkinitcpio writes the images here once the final settings ran
+    chrootCommands->append(QString("mkdir -p %1/EFI/Linux").arg(BootBackend::espMountPoint()));
+    
+    bool asRoot = geteuid() == 0;
+    TargetConfigWriter writer("/mnt");
+    if (backend == BootBackend::Kind::Uki) {
+        // Without a boot manager nothing else finds the images; their entries
+        // are written by the initramfs task once the images exist
+        if (asRoot && !EfiBootEntry::available()) {
+            failInstallation(QString("FAILED: %1\n\nbootloader=uki needs the live system booted in UEFI mode").arg(taskLabel(startingTask)));
+            return false;
+        }
+        if (asRoot) {
+            writer.writeFile(BootBackend::removableHookPath(), BootBackend::removableHook(), 0755);
+        } else {
+            chrootCommands->append(QString("mkdir -p $(dirname %1) && cat > %1 <<'HOOK'\n%2HOOK\nchmod 755 %1")
+                                   .arg(BootBackend::removableHookPath()).arg(BootBackend::removableHook()));
+        }
+    } else {
+        // Show the menu only when there is something else to pick
+        int timeout = ForeignOsProber::results(overwrittenDevices()).isEmpty() ? 0 : 5;
+        QString loaderConf = BootBackend::espMountPoint() + "/loader/loader.conf";
+        bool nvramInProcess = asRoot && EfiBootEntry::available();
+        if (asRoot) {
+            // bootctl keeps an existing loader.conf
+            writer.writeFile(loaderConf, BootBackend::loaderConfig(timeout));
+        }
+        chrootCommands->append(QString("echo '[DEBUG] Installing systemd-boot...' && bootctl install --esp-path=%1%2")
+                               .arg(BootBackend::espMountPoint()).arg(nvramInProcess ? " --no-variables" : ""));
+        if (!asRoot) {
+            chrootCommands->append(QString("cat > %1 <<'LOADER'\n%2LOADER").arg(loaderConf).arg(BootBackend::loaderConfig(timeout)));
+        }
+        // Copies a newer systemd-boot to the ESP after systemd updates
+        chrootCommands->append("systemctl enable systemd-boot-update.service");
+        if (nvramInProcess) {
+            // Written once bootctl put the loader on the ESP
+            pendingBootEntries[startingTask] << PendingBootEntry{"/EFI/systemd/systemd-bootx64.efi", bootloaderId};
+        }
+    }
+    
+    QString error;
+    if (asRoot && !writer.commit(&error)) {
+        failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+        return false;
+    }
+    return true;
 }
 
 void Installer::runCustomScripts() {
@@ -539,9 +1513,9 @@ void Installer::runCustomScripts() {
     qDebug() << "[DEBUG] SettingsParser::loadSettings() returned:" << settingsLoaded;
     
     if (settingsLoaded) {
-        qDebug() << "[DEBUG] Calling SettingsParser::getExecutionCommands()...";
-        QStringList finalCommands = SettingsParser::getExecutionCommands();
-        qDebug() << QString("[DEBUG] SettingsParser::getExecutionCommands() returned %1 commands").arg(finalCommands.size());
+        qDebug() << "[DEBUG] Calling SettingsParser::getChrootCommands()...";
+        QStringList finalCommands = SettingsParser::getChrootCommands();
+        qDebug() << QString("[DEBUG] SettingsParser::getChrootCommands() returned %1 commands").arg(finalCommands.size());
         
         if (!finalCommands.isEmpty()) {
             qDebug() << "[DEBUG] Final commands to execute:";
@@ -559,6 +1533,10 @@ FAILED_COMMANDS=0
 TOTAL_COMMANDS=0
 
 )";
+            // mkinitcpio preset runs are recorded and done once by the initramfs task,
+            // grub.cfg is written once by the grub-config task
+            finalScript += InitramfsBuilder::deferScript();
+            finalScript += GrubConfigGenerator::deferScript();
             
             for (const QString &cmd : finalCommands) {
                 finalScript += QString("echo 'Executing: %1'\n").arg(cmd);
@@ -570,6 +1548,8 @@ TOTAL_COMMANDS=0
                 finalScript += "TOTAL_COMMANDS=$((TOTAL_COMMANDS + 1))\n\n";
             }
             
+            finalScript += InitramfsBuilder::restoreScript();
+            finalScript += GrubConfigGenerator::restoreScript();
             finalScript += R"(
 echo "Final settings completed: $((TOTAL_COMMANDS - FAILED_COMMANDS))/$TOTAL_COMMANDS commands successful"
 if [ $FAILED_COMMANDS -gt 0 ]; then
@@ -582,7 +1562,7 @@ exit 0
             
             qDebug() << "[DEBUG] Final script length:" << finalScript.length();
             qDebug() << "[DEBUG] Executing final settings script...";
-            executeCommand("bash", QStringList() << "-c" << finalScript);
+            executeInChroot(finalScript);
             qDebug() << "[DEBUG] Final settings script execution completed";
             
             // Verify critical final settings were applied
@@ -654,12 +1634,104 @@ exit 0
     }
 }
 
+BootBackend::Kind Installer::bootBackend() const {
+    return BootBackend::fromSettings();
+}
+
+FstabEntry Installer::rootMountEntry() const {
+    for (const FstabEntry &entry : mountTable) {
+        if (entry.mountPoint == "/") {
+            return entry;
+        }
+    }
+    return FstabEntry();
+}
+
+QStringList Installer::overwrittenDevices() const {
+    QStringList overwritten;
+    for (const char *role : {"efi", "root", "swap"}) {
+        if (!targetPartition(role).isEmpty()) {
+            overwritten << targetPartition(role);
+        }
+    }
+    if (config.partitioningMode == PartitioningMode::Automatic) {
+        overwritten << config.selectedDisk;
+    }
+    return overwritten;
+}
+
+void Installer::generateGrubConfig() {
+    if (bootBackend() != BootBackend::Kind::Grub) {
+        qDebug() << "[GRUB] Booting through" << BootBackend::name(bootBackend()) << "- no grub.cfg";
+        return;
+    }
+    
+    // Other systems on the disks and partitions the installation overwrote are gone
+    QList<ForeignOs> foreign = ForeignOsProber::results(overwrittenDevices());
+    FstabEntry rootEntry = rootMountEntry();
+
+    if (geteuid() == 0 && ForeignOsProber::available() && !rootEntry.device.isEmpty()) {
+        QElapsedTimer timer;
+        timer.start();
+
+        GrubTarget target;
+        target.rootFsType = rootEntry.type;
+        target.rootSubvolume = rootEntry.type == "btrfs" ? "@" : QString();
+        target.partitionMap = GrubConfigGenerator::partitionMap(rootEntry.device);
+        QString error;
+        if (!FstabGenerator::readUuid(rootEntry.device, rootEntry.type, &target.rootUuid, &error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+            return;
+        }
+
+        QString grubConfig = GrubConfigGenerator::generate("/mnt", target, foreign, &error);
+        if (!grubConfig.isEmpty()) {
+            TargetConfigWriter writer("/mnt");
+            writer.writeFile(GrubConfigGenerator::configPath(), grubConfig, 0444);
+            if (!writer.commit(&error)) {
+                failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(startingTask)).arg(error));
+                return;
+            }
+            qDebug() << QString("[GRUB] grub.cfg generated in %1 ms with %2 other systems").arg(timer.elapsed()).arg(foreign.size());
+            return;
+        }
+        qDebug() << "[GRUB] Falling back to grub-mkconfig:" << error;
+    }
+
+    // The real grub-mkconfig, still without probing the disks again when the cache is usable
+    QString script = "set +e\n";
+    if (ForeignOsProber::available()) {
+        script += GrubConfigGenerator::cachedProberScript(foreign);
+    }
+    script += QString("grub-mkconfig -o %1\nstatus=$?\n").arg(GrubConfigGenerator::configPath());
+    script += GrubConfigGenerator::cachedProberRestoreScript();
+    script += "exit $status\n";
+    executeInChroot(script);
+}
+
 
 
 void Installer::cleanup() {
     qDebug() << "[DEBUG] === FINAL CLEANUP ===";
     qDebug() << "[DEBUG] cleanup() - Starting cleanup";
     
+    // Tear the chroot API mounts down before unmounting the target
+    if (chrootSession && chrootSession->isRunning()) {
+        QString task = startingTask;
+        taskWorkers.insert(chrootSession, task);
+        connect(chrootSession, &ChrootSession::closed, this, [this, task]() {
+            if (!taskWorkers.remove(chrootSession) || failed) {
+                return;
+            }
+            unmountTarget(task);
+        });
+        chrootSession->close();
+        return;
+    }
+    unmountTarget(startingTask);
+}
+
+void Installer::unmountTarget(const QString &taskId) {
     // Emergency memory cleanup FIRST
     QProcess::execute("bash", QStringList() << "-c" << "echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true");
     QProcess::execute("sync");
@@ -671,15 +1743,11 @@ void Installer::cleanup() {
     cleanupCommands << "killall -9 rsync cp unsquashfs 2>/dev/null || true";
     
     // Wait for processes to terminate
-    cleanupCommands << "sleep 3";
+    cleanupCommands << DeviceReadiness::waitUntilUnused("/mnt", "/mnt");
     
-    // Force unmount everything
-    cleanupCommands << "umount -f /mnt/boot/efi 2>/dev/null || true";
-    cleanupCommands << "umount -f /mnt/boot 2>/dev/null || true";
-    cleanupCommands << "umount -f /mnt/proc 2>/dev/null || true";
-    cleanupCommands << "umount -f /mnt/sys 2>/dev/null || true";
-    cleanupCommands << "umount -f /mnt/dev 2>/dev/null || true";
-    cleanupCommands << "umount -f /mnt 2>/dev/null || true";
+    // Unmount everything below /mnt, deepest first: the ESP and every btrfs
+    // subvolume mount (@home, @log, ...) before the root itself
+    cleanupCommands << "(umount -R /mnt || { echo 'Target still busy, detaching it lazily' >&2; umount -R -l /mnt; })";
     
     // Clean up loop devices and temp files
     cleanupCommands << "losetup -D 2>/dev/null || true";
@@ -687,12 +1755,7 @@ void Installer::cleanup() {
     
     // Disable swap
     if (config.enableSwap) {
-        QString swapPartition;
-        if (config.partitioningMode == PartitioningMode::Manual) {
-            swapPartition = config.swapPartition;
-        } else {
-            swapPartition = getPartitionName(config.selectedDisk, 2);
-        }
+        QString swapPartition = targetPartition("swap");
         if (!swapPartition.isEmpty()) {
             cleanupCommands << QString("swapoff %1 2>/dev/null || true").arg(swapPartition);
         }
@@ -703,55 +1766,123 @@ void Installer::cleanup() {
     cleanupCommands << "echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true";
     
     QString cleanupScript = cleanupCommands.join(" && ");
-    executeCommand("bash", QStringList() << "-c" << cleanupScript);
+    executeTaskCommand(taskId, "bash", QStringList() << "-c" << cleanupScript);
 }
 
 void Installer::executeCommand(const QString &command, const QStringList &args) {
-    if (currentProcess) {
-        currentProcess->deleteLater();
-    }
-    
-    currentProcess = new QProcess(this);
-    connect(currentProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &Installer::onProcessFinished);
-    connect(currentProcess, &QProcess::errorOccurred, [this](QProcess::ProcessError error) {
-        QString errorMsg = QString("Process error: %1").arg(currentProcess->errorString());
+    executeTaskCommand(startingTask, command, args);
+}
+
+void Installer::executeTaskCommand(const QString &taskId, const QString &command, const QStringList &args) {
+    QProcess *process = new QProcess(this);
+    taskProcesses.insert(process, taskId);
+    connect(process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, &Installer::onProcessFinished);
+    connect(process, &QProcess::errorOccurred, this, [this, process](QProcess::ProcessError error) {
+        // Crashes also emit finished(); only a failed start needs handling here
+        if (error != QProcess::FailedToStart) {
+            return;
+        }
+        QString errorMsg = QString("Process error: %1").arg(process->errorString());
         qDebug() << "[ERROR]" << errorMsg;
-        emit installationFinished(false, errorMsg);
+        taskProcesses.remove(process);
+        process->deleteLater();
+        failInstallation(errorMsg);
     });
     
     QString fullCommand = command + " " + args.join(" ");
-    qDebug() << "[EXEC] Starting:" << fullCommand;
+    qDebug() << "[EXEC] Starting for task" << taskId << ":" << fullCommand;
     
     // Use pkexec for privileged operations
     if (command == "bash" && !args.isEmpty() && args.first() == "-c") {
         // Check if pkexec is available, fallback to sudo if needed
         if (QProcess::execute("which", QStringList() << "pkexec") == 0) {
-            currentProcess->start("pkexec", QStringList() << command << args);
+            process->start("pkexec", QStringList() << command << args);
         } else if (QProcess::execute("which", QStringList() << "sudo") == 0) {
-            currentProcess->start("sudo", QStringList() << command << args);
+            process->start("sudo", QStringList() << command << args);
         } else {
-            currentProcess->start(command, args);
+            process->start(command, args);
         }
     } else {
-        currentProcess->start(command, args);
+        process->start(command, args);
     }
     
     qDebug() << "[DEBUG] Command started, waiting for completion...";
 }
 
+void Installer::executeInChroot(const QString &script) {
+    if (!chrootSession) {
+        chrootSession = new ChrootSession("/mnt", this);
+        connect(chrootSession, &ChrootSession::commandFinished, this, &Installer::onChrootCommandFinished);
+        chrootSession->start();
+    }
+    taskChrootCommands.insert(chrootSession->run(script), startingTask);
+}
+
+void Installer::onChrootCommandFinished(int id, int exitStatus, const QString &output) {
+    if (!taskChrootCommands.contains(id)) {
+        return;
+    }
+    QString task = taskChrootCommands.take(id);
+    
+    qDebug() << QString("[RESULT] Task: %1 - chroot command %2, exit code %3").arg(task).arg(id).arg(exitStatus);
+    if (!output.isEmpty()) {
+        qDebug() << "[STDOUT]" << output.left(500) + (output.length() > 500 ? "..." : "");
+    }
+    
+    if (failed) {
+        return;
+    }
+    if (exitStatus != 0) {
+        failInstallation(QString("FAILED: %1\n\nCommand inside /mnt exited with code %2\n\nOutput:\n%3")
+                         .arg(taskLabel(task)).arg(exitStatus).arg(output.isEmpty() ? "(none)" : output));
+        return;
+    }
+    
+    if (!taskHasWork(task) && createPendingBootEntries(task)) {
+        completeTask(task);
+    }
+}
+
+bool Installer::createPendingBootEntries(const QString &taskId) {
+    // Never point the firmware at a loader that is not on the ESP
+    for (const PendingBootEntry &entry : pendingBootEntries.take(taskId)) {
+        QString error;
+        if (!QFileInfo::exists("/mnt" + BootBackend::espMountPoint() + entry.loader)) {
+            error = QString("%1 is missing on the EFI partition").arg(entry.loader);
+        }
+        if (!error.isEmpty() || !EfiBootEntry::create(targetPartition("efi"), entry.loader, entry.label, &error)) {
+            failInstallation(QString("FAILED: %1\n\n%2").arg(taskLabel(taskId)).arg(error));
+            return false;
+        }
+    }
+    return true;
+}
+
 void Installer::onProcessFinished(int exitCode, QProcess::ExitStatus exitStatus) {
-    QString stdOut = currentProcess->readAllStandardOutput();
-    QString stdErr = currentProcess->readAllStandardError();
-    QString program = currentProcess->program();
-    QStringList arguments = currentProcess->arguments();
+    QProcess *process = qobject_cast<QProcess *>(sender());
+    if (!process || !taskProcesses.contains(process)) {
+        return;
+    }
+    QString task = taskProcesses.take(process);
+    process->deleteLater();
+    
+    QString stdOut = process->readAllStandardOutput();
+    QString stdErr = process->readAllStandardError();
+    QString program = process->program();
+    QStringList arguments = process->arguments();
     
-    qDebug() << QString("[RESULT] Step: %1/%2 - %3")
-                .arg(currentStep+1).arg(totalSteps).arg(installSteps[currentStep]);
+    qDebug() << QString("[RESULT] Task: %1 - %2").arg(task).arg(taskLabel(task));
     qDebug() << QString("[RESULT] Command: %1 %2").arg(program).arg(arguments.join(" "));
     qDebug() << QString("[RESULT] Exit code: %1, Status: %2")
                 .arg(exitCode)
                 .arg(exitStatus == QProcess::NormalExit ? "Normal" : "Crashed");
     
+    // Readiness waits report how long they actually took
+    for (const QString &line : stdOut.split('\n')) {
+        if (line.startsWith("[DEVICE]")) {
+            qDebug() << line;
+        }
+    }
     if (!stdOut.isEmpty()) {
         qDebug() << "[STDOUT]" << stdOut.left(500) + (stdOut.length() > 500 ? "..." : "");
     }
@@ -759,89 +1890,90 @@ void Installer::onProcessFinished(int exitCode, QProcess::ExitStatus exitStatus)
         qDebug() << "[STDERR]" << stdErr.left(500) + (stdErr.length() > 500 ? "..." : "");
     }
     
-    if (exitCode != 0) {
+    if (failed) {
+        return;
+    }
+    if (exitCode != 0 || exitStatus != QProcess::NormalExit) {
         QString errorMsg = QString("FAILED: %1\n\nCommand: %2 %3\nExit Code: %4\n\nError Output:\n%5\n\nStandard Output:\n%6")
-                          .arg(installSteps[currentStep])
+                          .arg(taskLabel(task))
                           .arg(program)
                           .arg(arguments.join(" "))
                           .arg(exitCode)
                           .arg(stdErr.isEmpty() ? "(none)" : stdErr)
                           .arg(stdOut.isEmpty() ? "(none)" : stdOut);
-        qDebug() << "[FATAL]" << errorMsg;
-        
-        terminateInstallation();
-        emit installationFinished(false, errorMsg);
+        failInstallation(errorMsg);
         return;
     }
     
-    qDebug() << QString("[SUCCESS] Step %1 completed").arg(installSteps[currentStep]);
-    
-    // Proactive memory cleanup after each step
-    if (currentStep == 3) { // After base system installation
-        qDebug() << "[DEBUG] Performing memory cleanup after base system installation";
-        QProcess::execute("sync");
-        QProcess::execute("bash", QStringList() << "-c" << "echo 1 > /proc/sys/vm/drop_caches 2>/dev/null || true");
-    }
-    
-    // Check memory status
-    QProcess memCheck;
-    memCheck.start("bash", QStringList() << "-c" << "awk '/MemAvailable/ {print $2}' /proc/meminfo");
-    memCheck.waitForFinished(2000);
-    QString memAvailable = memCheck.readAllStandardOutput().trimmed();
-    qDebug() << "[MEMORY] Available:" << memAvailable << "KB";
-    
-    // Emergency cleanup if memory is low
-    if (!memAvailable.isEmpty() && memAvailable.toInt() < 512000) {
-        qDebug() << "[WARNING] Low memory detected, forcing cleanup";
-        QProcess::execute("bash", QStringList() << "-c" << "echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true");
+    if (!taskHasWork(task)) {
+        completeTask(task);
     }
-    
-    currentStep++;
-    
-    if (currentStep >= totalSteps) {
-        qDebug() << "[DEBUG] Installation completed successfully!";
-        emit installationFinished(true, "Installation completed successfully!");
+}
+
+void Installer::failInstallation(const QString &errorMsg) {
+    if (failed) {
         return;
     }
-    
-    progressTimer->start(500);
+    failed = true;
+    qDebug() << "[FATAL]" << errorMsg;
+    terminateInstallation();
+    emit installationFinished(false, errorMsg);
 }
 
 void Installer::updateProgress(int percentage, const QString &message) {
     emit progressChanged(percentage, message);
 }
 
-void Installer::writeFile(const QString &path, const QString &content) {
-    QFile file(path);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream stream(&file);
-        stream << content;
-        file.close();
-    }
-}
-
-void Installer::appendFile(const QString &path, const QString &content) {
-    QFile file(path);
-    if (file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
-        QTextStream stream(&file);
-        stream << content;
-        file.close();
-    }
+void Installer::updateStepProgress(const QString &taskId, qint64 done, qint64 total, const QString &detail) {
+    // Spread long-running work over one task's share of the progress bar
+    int stepStart = completedPercentage();
+    int stepSpan = tasks.isEmpty() ? 0 : 100 / tasks.size();
+    int percentage = stepStart + (total > 0 ? static_cast<int>(done * stepSpan / total) : 0);
+    updateProgress(percentage, QString("%1: %2").arg(taskLabel(taskId)).arg(detail));
 }
 
 void Installer::terminateInstallation() {
     qDebug() << "[DEBUG] terminateInstallation() - Cleaning up failed installation";
     
-    // Stop the progress timer
-    if (progressTimer && progressTimer->isActive()) {
-        progressTimer->stop();
+    // No further tasks may start
+    failed = true;
+    
+    // Kill any running processes
+    for (QProcess *process : taskProcesses.keys()) {
+        if (process->state() != QProcess::NotRunning) {
+            qDebug() << "[DEBUG] Terminating running process:" << process->program();
+            process->kill();
+            process->waitForFinished(5000);
+        }
     }
     
-    // Kill any running process
-    if (currentProcess && currentProcess->state() != QProcess::NotRunning) {
-        qDebug() << "[DEBUG] Terminating running process:" << currentProcess->program();
-        currentProcess->kill();
-        currentProcess->waitForFinished(5000);
+    // Stop an in-process extraction before its target goes away
+    if (extractor) {
+        qDebug() << "[DEBUG] Cancelling in-process extraction";
+        extractor->cancel();
+        extractor->wait();
+    }
+    if (deployer) {
+        qDebug() << "[DEBUG] Cancelling block image deployment";
+        deployer->cancel();
+        deployer->wait();
+    }
+    if (discarder) {
+        // A discard already submitted to the device cannot be interrupted
+        qDebug() << "[DEBUG] Waiting for the disk discard to finish";
+        discarder->wait();
+    }
+    if (copier) {
+        qDebug() << "[DEBUG] Cancelling image copy";
+        copier->cancel();
+        copier->wait();
+    }
+    if (!copyMountPoint.isEmpty()) {
+        QProcess::execute("umount", QStringList() << copyMountPoint);
+    }
+    if (chrootSession) {
+        qDebug() << "[DEBUG] Killing chroot session";
+        chrootSession->terminate();
     }
     
     // Emergency cleanup - try to unmount anything that might be mounted
@@ -850,8 +1982,8 @@ void Installer::terminateInstallation() {
     cleanup.waitForFinished(10000);
     
     // Disable swap if it was enabled
-    if (config.enableSwap) {
-        QString swapPartition = getPartitionName(config.selectedDisk, 2);
+    if (config.enableSwap && !targetPartition("swap").isEmpty()) {
+        QString swapPartition = targetPartition("swap");
         QProcess swapOff;
         swapOff.start("swapoff", QStringList() << swapPartition);
         swapOff.waitForFinished(5000);
@@ -1,9 +1,39 @@
 #pragma once
 #include <QObject>
 #include <QProcess>
+#include <QMap>
+#include <QSet>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <functional>
 #include "installconfig.h"
 #include "settingsparser.h"
+#include "fstabgenerator.h"
+#include "bootbackend.h"
+
+class SquashfsExtractor;
+class BlockImageDeployer;
+class TreeCopier;
+class ChrootSession;
+class DeviceDiscarder;
+struct InstallImage;
+
+// One unit of installation work. It starts once every fact in `inputs` is
+// known (e.g. "root-mounted") and makes its `outputs` known when it ends.
+// Tasks whose inputs are satisfied run concurrently.
+struct InstallTask {
+    QString id;
+    QString label;
+    QStringList inputs;
+    QStringList outputs;
+    std::function<void()> run;
+};
+
+// A UEFI boot entry for a loader path on the ESP (e.g. /EFI/arch7z/grubx64.efi)
+struct PendingBootEntry {
+    QString loader;
+    QString label;
+};
 
 class Installer : public QObject {
     Q_OBJECT
@@ -11,43 +41,132 @@ class Installer : public QObject {
 public:
     explicit Installer(const InstallConfig &config, QObject *parent = nullptr);
     void startInstallation();
+    // Early start: disk work runs ahead, tasks that need the user settings
+    // ("user-config") wait until releaseBarrier() supplies them
+    void holdBeforeConfiguration();
+    void releaseBarrier(const InstallConfig &userConfig);
+    void cancelInstallation();
 
 signals:
     void progressChanged(int percentage, const QString &message);
     void installationFinished(bool success, const QString &message);
 
 private slots:
-    void executeNextStep();
+    void scheduleTasks();
     void onProcessFinished(int exitCode, QProcess::ExitStatus exitStatus = QProcess::NormalExit);
+    void onExtractionProgress(qint64 bytesDone, qint64 bytesTotal, quint32 inodesDone, quint32 inodesTotal);
+    void onExtractionFinished(bool success, const QString &message);
+    void onDeployProgress(qint64 bytesDone, qint64 bytesTotal);
+    void onDeployFinished(bool success, const QString &message);
+    void onDiscardFinished(bool success, const QString &message);
+    void onCopyProgress(qint64 bytesDone, quint64 filesDone, double bytesPerSecond, double filesPerSecond);
+    void onCopyFinished(bool success, const QString &message);
+    void onChrootCommandFinished(int id, int exitStatus, const QString &output);
 
 protected:
-    virtual void partitionDisk();
-    virtual void formatPartitions();
-    virtual void mountPartitions();
-    virtual void installBaseSystem();
-    virtual void configureSystem();
-    virtual void installBootloader();
-    virtual void runCustomScripts();
+    // The work of an installation; VMInstaller describes its own graph
+    virtual QList<InstallTask> buildTaskGraph();
+    // Tasks that run once the base system is on the target, shared by both graphs
+    QList<InstallTask> configurationTasks(const QStringList &bootloaderInputs);
 
-    virtual void cleanup();
+    void partitionDisk();
+    void formatEfiPartition();
+    void formatSwapPartition();
+    void formatRootPartition();
+    void setupSwap();
+    void mountPartitions();
+    void installBaseSystem();
+    void configureSystem();
+    void generateInitramfs();
+    void syncPackageDatabases();
+    void createUsers();
+    virtual void installBootloader();
+    void runCustomScripts();
+    void generateGrubConfig();
+    void cleanup();
+    // The part of cleanup that runs once the chroot session is gone
+    void unmountTarget(const QString &taskId);
 
 private:
     
     void updateProgress(int percentage, const QString &message);
-    void writeFile(const QString &path, const QString &content);
-    void appendFile(const QString &path, const QString &content);
-    QString getPartitionName(const QString &disk, int partitionNumber);
+    void updateStepProgress(const QString &taskId, qint64 done, qint64 total, const QString &detail);
+    int completedPercentage() const;
+    QString taskLabel(const QString &taskId) const;
+    void setTaskLabel(const QString &taskId, const QString &label);
+    void completeTask(const QString &taskId);
+    bool taskHasWork(const QString &taskId) const;
+    QString getPartitionName(const QString &disk, int partitionNumber) const;
+    // The configured swap size, or the policy's for this machine
+    qint64 swapSizeMiB() const;
     void terminateInstallation();
+    static QString postExtractionScript();
+    static QString erofsCopyScript(const QString &imagePath);
+    QStringList deployedRootCommands(const QString &rootPartition) const;
+    QString selectBtrfsStream();
+    // The mount table entry for /
+    FstabEntry rootMountEntry() const;
+    // Partitions and disks whose previous contents the installation replaced
+    QStringList overwrittenDevices() const;
+    // Installs systemd-boot or the UKI boot entries; false once the installation failed
+    bool installUkiBoot(BootBackend::Kind backend, const QString &bootloaderId, QStringList *chrootCommands);
+    // Preset entries whose images are built on first boot instead of now
+    QStringList deferredInitramfsImages() const;
+    // Writes the NVRAM entries queued for a task once its chroot work succeeded;
+    // false once the installation failed
+    bool createPendingBootEntries(const QString &taskId);
     
 protected:
     InstallConfig config;
+    QString receivedStream;
+    // What the mount and format tasks set up on the target, for /etc/fstab
+    QList<FstabEntry> mountTable;
+    // Nodes of the partitions the in-process writer created ("efi", "swap", "root")
+    QMap<QString, QString> createdPartitions;
+    // Set once the whole target disk was discarded, so mkfs can skip its own pass
+    bool diskDiscarded;
+    // The partition that plays role on the target, in every partitioning mode
+    QString targetPartition(const QString &role) const;
+    // Discards the selected disk on a worker when it is flash that supports it,
+    // then runs next as part of the current task
+    void discardThen(const std::function<void()> &next);
+    QStringList rootSubvolumeCommands();
+    // Mounts the image read-only, copies it to /mnt in-process (needs root), then runs postScript
+    void startTreeCopy(const InstallImage &image, const QStringList &excludes, const QString &postScript);
+    // Runs a command as part of the task that is currently being started
     void executeCommand(const QString &command, const QStringList &args = QStringList());
+    void executeTaskCommand(const QString &taskId, const QString &command, const QStringList &args);
+    // Runs a script inside /mnt through the shared chroot session
+    void executeInChroot(const QString &script);
+    void failInstallation(const QString &errorMsg);
+    // Edits /etc/default/grub in-process when running as root, otherwise adds sed commands
+    bool applyGrubDefaults(QStringList *chrootCommands);
+    // bootloader= from final-settings.conf; VMs always use BIOS GRUB
+    virtual BootBackend::Kind bootBackend() const;
     
 private:
-    QProcess *currentProcess;
-    QTimer *progressTimer;
+    SquashfsExtractor *extractor;
+    BlockImageDeployer *deployer;
+    DeviceDiscarder *discarder;
+    std::function<void()> afterDiscard;
+    TreeCopier *copier;
+    ChrootSession *chrootSession;
+    QString copyMountPoint;
+    QString afterCopyScript;
+    QString deployedImage;
+    QString postDeployScript;
     
-    int currentStep;
-    int totalSteps;
-    QStringList installSteps;
-};
\ No newline at end of file
+    QList<InstallTask> tasks;
+    QSet<QString> knownFacts;
+    QSet<QString> startedTasks;
+    QSet<QString> finishedTasks;
+    QMap<QString, QElapsedTimer> taskTimers;
+    QMap<QProcess *, QString> taskProcesses;
+    QMap<QObject *, QString> taskWorkers;
+    QMap<int, QString> taskChrootCommands;
+    // Boot entries per task, created only after the task installed their loaders
+    QMap<QString, QList<PendingBootEntry>> pendingBootEntries;
+    QString startingTask;
+    bool holdAtBarrier;
+    bool failed;
+};
@@ -1,6 +1,7 @@
 #include "installprogress.h"
 #include "vminstaller.h"
 #include "vmdetection.h"
+#include "earlystart.h"
 #include <QApplication>
 #include <QHBoxLayout>
 #include <QMessageBox>
@@ -10,6 +11,22 @@ InstallProgressWindow::InstallProgressWindow(const InstallConfig &config, QWidge
     : QMainWindow(parent), config(config) {
     setupUI();
     
+    // Pick up disk work that already started while the wizard was open
+    EarlyStartStatus earlyStatus;
+    installer = EarlyStart::takeInstaller(this, config, &earlyStatus);
+    if (installer) {
+        connect(installer, &Installer::progressChanged, this, &InstallProgressWindow::onProgressChanged);
+        connect(installer, &Installer::installationFinished, this, &InstallProgressWindow::onInstallationFinished);
+        
+        onProgressChanged(earlyStatus.percentage, earlyStatus.message);
+        if (earlyStatus.finished) {
+            onInstallationFinished(earlyStatus.success, earlyStatus.result);
+        } else {
+            installer->releaseBarrier(config);
+        }
+        return;
+    }
+    
     // Use VM installer if virtual machine is detected
     if (VMDetection::isVirtualMachine()) {
         installer = new VMInstaller(config, this);
@@ -0,0 +1,84 @@
+#include "installsource.h"
+#include <QDebug>
+#include <QDirIterator>
+#include <QFileInfo>
+
+QString InstallImage::mountType() const {
+    switch (format) {
+        case Format::Squashfs: return "squashfs";
+        case Format::Erofs:    return "erofs";
+        case Format::None:     break;
+    }
+    return QString();
+}
+
+InstallImage InstallSource::locate() {
+    InstallImage image;
+
+    image.path = find(InstallImage::Format::Erofs);
+    if (!image.path.isEmpty()) {
+        image.format = InstallImage::Format::Erofs;
+    } else {
+        image.path = find(InstallImage::Format::Squashfs);
+        if (!image.path.isEmpty()) {
+            image.format = InstallImage::Format::Squashfs;
+        }
+    }
+
+    if (image.isValid()) {
+        qDebug() << "[DEBUG] Install image:" << image.path << "(" << image.mountType() << ")";
+    } else {
+        qDebug() << "[ERROR] No install image (airootfs.erofs or airootfs.sfs) found";
+    }
+    return image;
+}
+
+QString InstallSource::find(InstallImage::Format format) {
+    QString fileName;
+    switch (format) {
+        case InstallImage::Format::Squashfs: fileName = "airootfs.sfs"; break;
+        case InstallImage::Format::Erofs:    fileName = "airootfs.erofs"; break;
+        case InstallImage::Format::None:     return QString();
+    }
+
+    for (const QString &candidate : candidates(fileName)) {
+        if (QFileInfo(candidate).isFile()) {
+            return candidate;
+        }
+    }
+
+    // Custom archiso layouts: search the whole runtime tree
+    QDirIterator it("/run", QStringList() << fileName, QDir::Files, QDirIterator::Subdirectories);
+    return it.hasNext() ? it.next() : QString();
+}
+
+QString InstallSource::findBlockImage(const QString &filesystem, QString *bmapPath) {
+    QString fileName = QString("rootfs-%1.img").arg(filesystem);
+    for (const QString &candidate : candidates(fileName)) {
+        if (QFileInfo(candidate).isFile() && QFileInfo(candidate + ".bmap").isFile()) {
+            *bmapPath = candidate + ".bmap";
+            return candidate;
+        }
+    }
+    return QString();
+}
+
+QString InstallSource::findBtrfsStream() {
+    const QStringList fileNames = {"rootfs.btrfs.zst", "rootfs.btrfs.xz", "rootfs.btrfs.gz", "rootfs.btrfs"};
+    for (const QString &fileName : fileNames) {
+        for (const QString &candidate : candidates(fileName)) {
+            if (QFileInfo(candidate).isFile()) {
+                return candidate;
+            }
+        }
+    }
+    return QString();
+}
+
+QStringList InstallSource::candidates(const QString &fileName) {
+    // copytoram first: reading from RAM beats the boot medium
+    return QStringList()
+        << "/run/archiso/copytoram/" + fileName
+        << "/run/archiso/bootmnt/arch/x86_64/" + fileName
+        << "/run/archiso/sfs/airootfs/" + fileName;
+}
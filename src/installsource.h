@@ -0,0 +1,35 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+
+// Root filesystem image shipped on the live medium
+struct InstallImage {
+    enum class Format {
+        None,
+        Squashfs,
+        Erofs
+    };
+
+    Format format = Format::None;
+    QString path;
+
+    bool isValid() const { return format != Format::None; }
+    // Filesystem type as understood by mount -t
+    QString mountType() const;
+};
+
+class InstallSource {
+public:
+    // Preferred image for this boot. EROFS wins when both formats are present:
+    // it decompresses faster and is read straight through the page cache.
+    static InstallImage locate();
+    static QString find(InstallImage::Format format);
+    // Prebuilt rootfs-<filesystem>.img with its .bmap sidecar, for block-level deploys.
+    // Returns an empty path when either file is missing.
+    static QString findBlockImage(const QString &filesystem, QString *bmapPath);
+    // Prebuilt btrfs send stream (rootfs.btrfs, optionally .zst/.xz/.gz compressed)
+    static QString findBtrfsStream();
+
+private:
+    static QStringList candidates(const QString &fileName);
+};
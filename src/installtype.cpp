@@ -4,6 +4,7 @@
 #include "vmpartitionlayout.h"
 #include "installconfig.h"
 #include "vmdetection.h"
+#include "earlystart.h"
 #include <QApplication>
 #include <QGridLayout>
 #include <QMessageBox>
@@ -157,6 +158,8 @@ void InstallTypeWindow::onContinue() {
     } else {
         g_installConfig.installationSource = InstallationSource::CustomPartitioning;
         g_installConfig.partitioningMode = PartitioningMode::Manual;
+        // Disk work started for an automatic layout no longer applies
+        EarlyStart::abandon();
         
         AdvancedPartitionWindow *advancedWindow = new AdvancedPartitionWindow(this);
         advancedWindow->setWindowTitle("Arch7z Installer");
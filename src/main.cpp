@@ -2,6 +2,9 @@
 #include <QPalette>
 #include <QIcon>
 #include "mainwindow.h"
+#include "imageprefetcher.h"
+#include "foreignosprober.h"
+#include "earlystart.h"
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
@@ -23,6 +26,16 @@ int main(int argc, char *argv[]) {
     darkPalette.setColor(QPalette::HighlightedText, Qt::black);
     app.setPalette(darkPalette);
     
+    // Warm the install image while the user works through the wizard
+    ImagePrefetcher::start();
+    // Look for other operating systems now instead of in grub-mkconfig
+    ForeignOsProber::start();
+    QObject::connect(&app, &QCoreApplication::aboutToQuit, []() {
+        EarlyStart::abandon();
+        ImagePrefetcher::shutdown();
+        ForeignOsProber::shutdown();
+    });
+    
     MainWindow window;
     window.setWindowTitle("Arch7z Installer");
     window.resize(1024, 800);
@@ -1,15 +1,19 @@
 #include "partitionlayout.h"
 #include "userconfig.h"
 #include "installconfig.h"
+#include "earlystart.h"
+#include "storageprofile.h"
+#include "swappolicy.h"
 #include <QApplication>
 #include <QHBoxLayout>
 #include <QMessageBox>
 #include <QHeaderView>
+#include <QStandardItemModel>
 
 extern InstallConfig g_installConfig;
 
 PartitionLayoutWindow::PartitionLayoutWindow(const QString &selectedDisk, const QString &diskSize, QWidget *parent) 
-    : QMainWindow(parent), selectedDisk(selectedDisk), diskSize(diskSize) {
+    : QMainWindow(parent), selectedDisk(selectedDisk), diskSize(diskSize), ramMiB(SwapPolicy::installedRamMiB()) {
     setupUI();
     updatePartitionTable();
 }
@@ -41,12 +45,18 @@ void PartitionLayoutWindow::setupUI() {
     
     QLabel *diskInfo = new QLabel(QString("Selected Disk: %1 (%2)").arg(selectedDisk).arg(diskSize), this);
     diskInfo->setAlignment(Qt::AlignCenter);
-    diskInfo->setStyleSheet("font-size: 14px; color: #18e8ec; margin-bottom: 30px;");
+    diskInfo->setStyleSheet("font-size: 14px; color: #18e8ec; margin-bottom: 5px;");
+    
+    // Filesystems are created and mounted with options for this kind of storage
+    QLabel *storageInfo = new QLabel(QString("Storage profile: %1").arg(StorageProfile::detect(selectedDisk).summary()), this);
+    storageInfo->setAlignment(Qt::AlignCenter);
+    storageInfo->setStyleSheet("font-size: 12px; color: #888; margin-bottom: 30px;");
     
     mainLayout->addWidget(title);
     mainLayout->addWidget(logo);
     mainLayout->addWidget(subtitle);
     mainLayout->addWidget(diskInfo);
+    mainLayout->addWidget(storageInfo);
     
     // Filesystem selection
     QLabel *fsLabel = new QLabel("Root Filesystem:", this);
@@ -73,20 +83,34 @@ void PartitionLayoutWindow::setupUI() {
     
     connect(btrfsRadio, &QRadioButton::toggled, this, &PartitionLayoutWindow::onFilesystemChanged);
     
-    // Swap option (hidden for VMs)
-    swapCheckBox = new QCheckBox("Enable Swap Partition (9 GB)", this);
-    swapCheckBox->setChecked(true);
-    swapCheckBox->setStyleSheet("font-size: 16px; color: white; margin: 20px 0; padding: 8px;");
-    connect(swapCheckBox, &QCheckBox::toggled, this, &PartitionLayoutWindow::onSwapToggled);
+    // Swap options, sized from installed RAM (hidden for VMs)
+    QLabel *swapLabel = new QLabel(QString("Swap (%1 GB RAM installed):").arg(ramMiB / 1024), this);
+    swapLabel->setStyleSheet("font-size: 16px; color: white; margin-top: 20px;");
+    mainLayout->addWidget(swapLabel);
     
-    // Swap option
-    swapCheckBox = new QCheckBox("Enable Swap Partition (9 GB)", this);
-    swapCheckBox->setChecked(true);
-    swapCheckBox->setStyleSheet("font-size: 16px; color: white; margin: 20px 0; padding: 8px;");
-    connect(swapCheckBox, &QCheckBox::toggled, this, &PartitionLayoutWindow::onSwapToggled);
-    mainLayout->addWidget(swapCheckBox);
+    QHBoxLayout *swapLayout = new QHBoxLayout();
+    swapCombo = new QComboBox(this);
+    swapCombo->setStyleSheet("QComboBox { background-color: #444; color: white; padding: 5px; font-size: 14px; }");
+    hibernationCheckBox = new QCheckBox("Allow hibernation", this);
+    hibernationCheckBox->setStyleSheet("font-size: 14px; color: white; padding: 8px;");
+    swapLayout->addWidget(swapCombo);
+    swapLayout->addWidget(hibernationCheckBox);
+    swapLayout->addStretch();
+    mainLayout->addLayout(swapLayout);
     
-    mainLayout->addWidget(swapCheckBox);
+    const SwapMode modes[] = {SwapMode::Partition, SwapMode::Swapfile, SwapMode::Zram, SwapMode::None};
+    for (SwapMode mode : modes) {
+        swapCombo->addItem(QString(), static_cast<int>(mode));
+    }
+    if (!SwapPolicy::zramAvailable()) {
+        // Without zram-generator the target would boot with no swap at all
+        int zramIndex = swapCombo->findData(static_cast<int>(SwapMode::Zram));
+        qobject_cast<QStandardItemModel *>(swapCombo->model())->item(zramIndex)->setEnabled(false);
+        swapCombo->setItemData(zramIndex, "zram-generator is not installed in this image", Qt::ToolTipRole);
+    }
+    swapCombo->setCurrentIndex(swapCombo->findData(static_cast<int>(SwapPolicy::defaultMode(ramMiB))));
+    connect(swapCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &PartitionLayoutWindow::onSwapToggled);
+    connect(hibernationCheckBox, &QCheckBox::toggled, this, &PartitionLayoutWindow::onSwapToggled);
     
     // Partition table
     partitionTable = new QTableWidget(this);
@@ -173,8 +197,27 @@ void PartitionLayoutWindow::setupUI() {
     );
 }
 
+SwapMode PartitionLayoutWindow::selectedSwapMode() const {
+    return static_cast<SwapMode>(swapCombo->currentData().toInt());
+}
+
+qint64 PartitionLayoutWindow::selectedSwapSizeMiB() const {
+    return SwapPolicy::recommendedSizeMiB(ramMiB, hibernationCheckBox->isChecked());
+}
+
 void PartitionLayoutWindow::updatePartitionTable() {
-    int rowCount = swapCheckBox->isChecked() ? 3 : 2;
+    // Only a swap partition can be resumed from
+    hibernationCheckBox->setEnabled(selectedSwapMode() == SwapMode::Partition);
+    if (!hibernationCheckBox->isEnabled()) {
+        hibernationCheckBox->setChecked(false);
+    }
+    for (int i = 0; i < swapCombo->count(); ++i) {
+        SwapMode mode = static_cast<SwapMode>(swapCombo->itemData(i).toInt());
+        swapCombo->setItemText(i, SwapPolicy::describe(mode, selectedSwapSizeMiB()));
+    }
+    
+    bool swapPartition = selectedSwapMode() == SwapMode::Partition;
+    int rowCount = swapPartition ? 3 : 2;
     partitionTable->setRowCount(rowCount);
     
     // EFI/Boot partition
@@ -186,9 +229,9 @@ void PartitionLayoutWindow::updatePartitionTable() {
     int currentRow = 1;
     
     // Swap partition (if enabled)
-    if (swapCheckBox->isChecked()) {
+    if (swapPartition) {
         partitionTable->setItem(currentRow, 0, new QTableWidgetItem(selectedDisk + "2"));
-        partitionTable->setItem(currentRow, 1, new QTableWidgetItem("9 GB"));
+        partitionTable->setItem(currentRow, 1, new QTableWidgetItem(QString("%1 GB").arg(selectedSwapSizeMiB() / 1024.0, 0, 'f', 1)));
         partitionTable->setItem(currentRow, 2, new QTableWidgetItem("Linux Swap"));
         partitionTable->setItem(currentRow, 3, new QTableWidgetItem("swap"));
         currentRow++;
@@ -206,8 +249,8 @@ void PartitionLayoutWindow::updatePartitionTable() {
 QString PartitionLayoutWindow::calculateRemainingSpace() {
     // Simple calculation - in real implementation you'd parse the actual disk size
     QString remaining = "Remaining space";
-    if (swapCheckBox->isChecked()) {
-        remaining += " (Total - 11 GB)";
+    if (selectedSwapMode() == SwapMode::Partition) {
+        remaining += QString(" (Total - %1 GB)").arg(2 + selectedSwapSizeMiB() / 1024.0, 0, 'f', 1);
     } else {
         remaining += " (Total - 2 GB)";
     }
@@ -220,9 +263,14 @@ void PartitionLayoutWindow::onSwapToggled() {
 
 void PartitionLayoutWindow::onContinue() {
     // Save settings to global config
-    g_installConfig.enableSwap = swapCheckBox->isChecked();
+    g_installConfig.swapMode = selectedSwapMode();
+    g_installConfig.swapSizeMiB = selectedSwapSizeMiB();
+    g_installConfig.hibernation = hibernationCheckBox->isChecked();
+    g_installConfig.enableSwap = g_installConfig.swapMode == SwapMode::Partition;
     g_installConfig.filesystem = btrfsRadio->isChecked() ? "btrfs" : "ext4";
     
+    EarlyStart::offer(this, g_installConfig);
+    
     UserConfigWindow *userConfigWindow = new UserConfigWindow();
     userConfigWindow->setPreviousWindow(this);
     userConfigWindow->setWindowTitle("Arch7z Installer");
@@ -4,9 +4,11 @@
 #include <QLabel>
 #include <QPushButton>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QTableWidget>
 #include <QRadioButton>
 #include <QButtonGroup>
+#include "installconfig.h"
 
 class PartitionLayoutWindow : public QMainWindow {
     Q_OBJECT
@@ -24,11 +26,14 @@ private:
     void setupUI();
     void updatePartitionTable();
     QString calculateRemainingSpace();
+    SwapMode selectedSwapMode() const;
+    qint64 selectedSwapSizeMiB() const;
     
     QWidget *centralWidget;
     QVBoxLayout *mainLayout;
     QTableWidget *partitionTable;
-    QCheckBox *swapCheckBox;
+    QComboBox *swapCombo;
+    QCheckBox *hibernationCheckBox;
     QRadioButton *btrfsRadio;
     QRadioButton *ext4Radio;
     QButtonGroup *filesystemGroup;
@@ -37,4 +42,5 @@ private:
     
     QString selectedDisk;
     QString diskSize;
+    qint64 ramMiB;
 };
\ No newline at end of file
@@ -0,0 +1,392 @@
+#include "partitiontablewriter.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <linux/blkpg.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/swap.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+constexpr qint64 MIB = 1024 * 1024;
+constexpr quint32 GPT_ENTRIES = 128;
+constexpr quint32 GPT_ENTRY_SIZE = 128;
+
+// Sector range of one partition, last sector included
+struct Extent {
+    qint64 first;
+    qint64 last;
+};
+
+const char *gptType(PartitionSpec::Type type) {
+    switch (type) {
+    case PartitionSpec::Type::EfiSystem: return "C12A7328-F81F-11D2-BA4B-00A0C93EC93B";
+    case PartitionSpec::Type::LinuxSwap: return "0657FD6D-A4AB-43C4-84E5-0933C84B4F4F";
+    case PartitionSpec::Type::LinuxFilesystem: break;
+    }
+    return "0FC63DAF-8483-4772-8E79-3D69D8477DE4";
+}
+
+unsigned char mbrType(PartitionSpec::Type type) {
+    switch (type) {
+    case PartitionSpec::Type::EfiSystem: return 0xEF;
+    case PartitionSpec::Type::LinuxSwap: return 0x82;
+    case PartitionSpec::Type::LinuxFilesystem: break;
+    }
+    return 0x83;
+}
+
+void putLe(unsigned char *p, quint64 value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        p[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+// GUIDs are stored with their first three fields little-endian
+void putGuid(unsigned char *p, const char *text) {
+    unsigned char raw[16] = {};
+    int digits = 0;
+    for (const char *c = text; *c && digits < 32; ++c) {
+        if (*c == '-') continue;
+        int value = (*c >= '0' && *c <= '9') ? *c - '0' : ((*c | 0x20) - 'a' + 10);
+        raw[digits / 2] |= static_cast<unsigned char>(digits % 2 == 0 ? value << 4 : value);
+        ++digits;
+    }
+    static const int order[16] = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+    for (int i = 0; i < 16; ++i) {
+        p[i] = raw[order[i]];
+    }
+}
+
+void putRandomGuid(unsigned char *p) {
+    quint32 words[4];
+    QRandomGenerator::system()->fillRange(words, 4);
+    memcpy(p, words, 16);
+    p[7] = static_cast<unsigned char>((p[7] & 0x0F) | 0x40);   // version 4
+    p[8] = static_cast<unsigned char>((p[8] & 0x3F) | 0x80);   // RFC 4122 variant
+}
+
+bool pwriteAll(int fd, const void *buffer, size_t length, qint64 offset) {
+    const char *data = static_cast<const char *>(buffer);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, data + done, length - done, offset + static_cast<qint64>(done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool layout(const QList<PartitionSpec> &partitions, qint64 sectorSize, qint64 firstUsable, qint64 lastUsable,
+            std::vector<Extent> *extents, QString *error) {
+    qint64 align = std::max<qint64>(1, MIB / sectorSize);
+    qint64 start = std::max(align, (firstUsable + align - 1) / align * align);
+
+    for (int i = 0; i < partitions.size(); ++i) {
+        qint64 last;
+        if (partitions[i].sizeMiB > 0) {
+            last = start + partitions[i].sizeMiB * MIB / sectorSize - 1;
+        } else if (i == partitions.size() - 1) {
+            last = (lastUsable + 1) / align * align - 1;
+        } else {
+            *error = "Only the last partition can take the rest of the disk";
+            return false;
+        }
+        if (last > lastUsable || last < start) {
+            *error = QString("Disk is too small for partition %1 (%2)").arg(i + 1).arg(partitions[i].name);
+            return false;
+        }
+        extents->push_back({start, last});
+        start = last + 1;
+    }
+    return true;
+}
+
+// Partition number (as the kernel counts them) -> sysfs entry name
+QMap<int, QString> kernelPartitions(const QString &diskName) {
+    QMap<int, QString> result;
+    QString sysDir = "/sys/class/block/" + diskName;
+    for (const QString &entry : QDir(sysDir).entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        QFile partition(sysDir + "/" + entry + "/partition");
+        if (partition.open(QIODevice::ReadOnly)) {
+            result.insert(partition.readAll().trimmed().toInt(), entry);
+        }
+    }
+    return result;
+}
+
+bool blkpg(int fd, int op, int pno, qint64 start, qint64 length) {
+    struct blkpg_partition partition;
+    memset(&partition, 0, sizeof(partition));
+    partition.pno = pno;
+    partition.start = start;
+    partition.length = length;
+
+    struct blkpg_ioctl_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.op = op;
+    arg.datalen = sizeof(partition);
+    arg.data = &partition;
+    return ioctl(fd, BLKPG, &arg) == 0;
+}
+
+} // namespace
+
+bool PartitionTableWriter::write(const QString &device, Scheme scheme, const QList<PartitionSpec> &partitions,
+                                 QStringList *devicePaths, QString *error) {
+    QElapsedTimer timer;
+    timer.start();
+    devicePaths->clear();
+
+    if (partitions.isEmpty() || (scheme == Scheme::Mbr && partitions.size() > 4)) {
+        *error = QString("Unsupported number of partitions: %1").arg(partitions.size());
+        return false;
+    }
+
+    struct stat info;
+    if (stat(device.toLocal8Bit().constData(), &info) != 0) {
+        *error = QString("Cannot access %1: %2").arg(device).arg(strerror(errno));
+        return false;
+    }
+    bool blockDevice = S_ISBLK(info.st_mode);
+    if (blockDevice && !releaseDevice(device, error)) {
+        return false;
+    }
+
+    // O_EXCL on a block device fails while any of its partitions is still in use
+    int fd = open(device.toLocal8Bit().constData(), O_RDWR | O_CLOEXEC | (blockDevice ? O_EXCL : 0));
+    if (fd < 0) {
+        *error = QString("Cannot open %1 for writing: %2").arg(device).arg(strerror(errno));
+        return false;
+    }
+
+    qint64 sectorSize = 512;
+    qint64 deviceSize = info.st_size;
+    if (blockDevice) {
+        int logicalSector = 0;
+        quint64 bytes = 0;
+        if (ioctl(fd, BLKSSZGET, &logicalSector) != 0 || ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
+            *error = QString("Cannot query the size of %1: %2").arg(device).arg(strerror(errno));
+            close(fd);
+            return false;
+        }
+        sectorSize = logicalSector;
+        deviceSize = static_cast<qint64>(bytes);
+    }
+    qint64 sectors = deviceSize / sectorSize;
+    qint64 entrySectors = (GPT_ENTRIES * GPT_ENTRY_SIZE + sectorSize - 1) / sectorSize;
+
+    std::vector<Extent> extents;
+    bool ok = (scheme == Scheme::Gpt)
+              ? layout(partitions, sectorSize, 2 + entrySectors, sectors - 2 - entrySectors, &extents, error)
+              : layout(partitions, sectorSize, 1, sectors - 1, &extents, error);
+    if (ok && scheme == Scheme::Mbr && sectors > 0xFFFFFFFFLL) {
+        *error = QString("%1 is too large for an MBR partition table").arg(device);
+        ok = false;
+    }
+    if (!ok) {
+        close(fd);
+        return false;
+    }
+
+    // Clear the old tables at both ends of the disk and stale signatures at
+    // the start of every new partition
+    std::vector<char> zeros(MIB, 0);
+    ok = pwriteAll(fd, zeros.data(), static_cast<size_t>(std::min(MIB, deviceSize)), 0) &&
+         pwriteAll(fd, zeros.data(), static_cast<size_t>(std::min(MIB, deviceSize)), std::max<qint64>(0, deviceSize - MIB));
+    for (const Extent &extent : extents) {
+        qint64 length = std::min(MIB, (extent.last - extent.first + 1) * sectorSize);
+        ok = ok && pwriteAll(fd, zeros.data(), static_cast<size_t>(length), extent.first * sectorSize);
+    }
+
+    std::vector<unsigned char> mbr(sectorSize, 0);
+    mbr[510] = 0x55;
+    mbr[511] = 0xAA;
+
+    if (scheme == Scheme::Gpt) {
+        std::vector<unsigned char> entries(GPT_ENTRIES * GPT_ENTRY_SIZE, 0);
+        for (size_t i = 0; i < extents.size(); ++i) {
+            unsigned char *entry = &entries[i * GPT_ENTRY_SIZE];
+            putGuid(entry, gptType(partitions[static_cast<int>(i)].type));
+            putRandomGuid(entry + 16);
+            putLe(entry + 32, static_cast<quint64>(extents[i].first), 8);
+            putLe(entry + 40, static_cast<quint64>(extents[i].last), 8);
+            // Name: up to 36 UTF-16LE code units
+            QString name = partitions[static_cast<int>(i)].name.left(36);
+            for (int c = 0; c < name.size(); ++c) {
+                putLe(entry + 56 + 2 * c, name.at(c).unicode(), 2);
+            }
+        }
+        quint32 entriesCrc = crc32(0, entries.data(), static_cast<uInt>(entries.size()));
+
+        unsigned char diskGuid[16];
+        putRandomGuid(diskGuid);
+        qint64 lastLba = sectors - 1;
+        qint64 backupEntries = lastLba - entrySectors;
+
+        auto header = [&](qint64 myLba, qint64 alternateLba, qint64 entriesLba) {
+            std::vector<unsigned char> sector(sectorSize, 0);
+            memcpy(sector.data(), "EFI PART", 8);
+            putLe(&sector[8], 0x00010000, 4);
+            putLe(&sector[12], 92, 4);
+            putLe(&sector[24], static_cast<quint64>(myLba), 8);
+            putLe(&sector[32], static_cast<quint64>(alternateLba), 8);
+            putLe(&sector[40], static_cast<quint64>(2 + entrySectors), 8);
+            putLe(&sector[48], static_cast<quint64>(backupEntries - 1), 8);
+            memcpy(&sector[56], diskGuid, 16);
+            putLe(&sector[72], static_cast<quint64>(entriesLba), 8);
+            putLe(&sector[80], GPT_ENTRIES, 4);
+            putLe(&sector[84], GPT_ENTRY_SIZE, 4);
+            putLe(&sector[88], entriesCrc, 4);
+            putLe(&sector[16], crc32(0, sector.data(), 92), 4);
+            return sector;
+        };
+
+        // Protective MBR: one 0xEE partition covering the disk
+        unsigned char *protective = &mbr[446];
+        protective[2] = 0x02;
+        protective[4] = 0xEE;
+        protective[5] = protective[6] = protective[7] = 0xFF;
+        putLe(protective + 8, 1, 4);
+        putLe(protective + 12, static_cast<quint64>(std::min<qint64>(sectors - 1, 0xFFFFFFFFLL)), 4);
+
+        std::vector<unsigned char> primary = header(1, lastLba, 2);
+        std::vector<unsigned char> backup = header(lastLba, 1, backupEntries);
+        ok = ok && pwriteAll(fd, entries.data(), entries.size(), 2 * sectorSize) &&
+             pwriteAll(fd, entries.data(), entries.size(), backupEntries * sectorSize) &&
+             pwriteAll(fd, backup.data(), backup.size(), lastLba * sectorSize) &&
+             pwriteAll(fd, primary.data(), primary.size(), sectorSize);
+    } else {
+        quint32 signature = QRandomGenerator::system()->generate();
+        putLe(&mbr[440], signature, 4);
+        for (size_t i = 0; i < extents.size(); ++i) {
+            unsigned char *entry = &mbr[446 + 16 * i];
+            entry[0] = partitions[static_cast<int>(i)].bootable ? 0x80 : 0x00;
+            // CHS fields are unused, mark them as beyond 1024 cylinders
+            entry[1] = entry[5] = 0xFE;
+            entry[2] = entry[3] = entry[6] = entry[7] = 0xFF;
+            entry[4] = mbrType(partitions[static_cast<int>(i)].type);
+            putLe(entry + 8, static_cast<quint64>(extents[i].first), 4);
+            putLe(entry + 12, static_cast<quint64>(extents[i].last - extents[i].first + 1), 4);
+        }
+    }
+
+    ok = ok && pwriteAll(fd, mbr.data(), mbr.size(), 0);
+    if (!ok || fsync(fd) != 0) {
+        *error = QString("Cannot write the partition table to %1: %2").arg(device).arg(strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    if (!blockDevice) {
+        close(fd);
+        qDebug() << "[DEBUG] Wrote" << (scheme == Scheme::Gpt ? "GPT" : "MBR") << "to image" << device
+                 << "in" << timer.elapsed() << "ms";
+        return true;
+    }
+
+    // Swap the kernel's view partition by partition; fall back to a full
+    // re-read only where the driver refuses BLKPG
+    QString diskName = QFileInfo(QFileInfo(device).canonicalFilePath()).fileName();
+    QMap<int, QString> existing = kernelPartitions(diskName);
+    for (auto it = existing.constBegin(); it != existing.constEnd(); ++it) {
+        if (!blkpg(fd, BLKPG_DEL_PARTITION, it.key(), 0, 0) && errno != ENXIO) {
+            *error = QString("Cannot remove /dev/%1 from the kernel: %2").arg(it.value()).arg(strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    bool added = true;
+    for (size_t i = 0; i < extents.size() && added; ++i) {
+        added = blkpg(fd, BLKPG_ADD_PARTITION, static_cast<int>(i) + 1, extents[i].first * sectorSize,
+                      (extents[i].last - extents[i].first + 1) * sectorSize);
+    }
+    if (!added) {
+        int addError = errno;
+        qDebug() << "[WARNING] BLKPG failed on" << device << "(" << strerror(addError) << "), re-reading the partition table";
+        if (ioctl(fd, BLKRRPART) != 0) {
+            *error = QString("The kernel cannot create partitions on %1: %2 (loop devices need partition scanning, losetup -P)")
+                     .arg(device).arg(strerror(errno));
+            close(fd);
+            return false;
+        }
+    }
+    close(fd);
+
+    QMap<int, QString> created = kernelPartitions(diskName);
+    for (int pno = 1; pno <= partitions.size(); ++pno) {
+        QString path = "/dev/" + created.value(pno);
+        if (!created.contains(pno) || !QFileInfo(path).exists()) {
+            *error = QString("Partition %1 of %2 did not appear").arg(pno).arg(device);
+            return false;
+        }
+        devicePaths->append(path);
+    }
+
+    qDebug() << "[DEBUG] Wrote" << (scheme == Scheme::Gpt ? "GPT" : "MBR") << "to" << device
+             << "in" << timer.elapsed() << "ms, partitions:" << *devicePaths;
+    return true;
+}
+
+bool PartitionTableWriter::releaseDevice(const QString &device, QString *error) {
+    QString disk = QFileInfo(device).canonicalFilePath();
+    QString diskName = QFileInfo(disk).fileName();
+    auto onDisk = [&](const QString &source) {
+        QString real = QFileInfo(source).canonicalFilePath();
+        if (real.isEmpty()) {
+            return false;
+        }
+        return real == disk || QFile::exists("/sys/class/block/" + diskName + "/" + QFileInfo(real).fileName());
+    };
+
+    QFile swaps("/proc/swaps");
+    if (swaps.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream stream(&swaps);
+        QString line = stream.readLine();   // header
+        while (stream.readLineInto(&line)) {
+            QString source = line.simplified().split(' ').value(0);
+            if (onDisk(source) && swapoff(source.toLocal8Bit().constData()) != 0) {
+                *error = QString("Cannot disable swap on %1: %2").arg(source).arg(strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    QStringList targets;
+    QFile mounts("/proc/self/mounts");
+    if (mounts.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream stream(&mounts);
+        QString line;
+        while (stream.readLineInto(&line)) {
+            QStringList fields = line.split(' ');
+            if (fields.size() >= 2 && onDisk(fields[0])) {
+                targets << fields[1].replace("\\040", " ");
+            }
+        }
+    }
+    // Nested mounts first
+    std::sort(targets.begin(), targets.end(), [](const QString &a, const QString &b) { return a.size() > b.size(); });
+    for (const QString &target : targets) {
+        qDebug() << "[DEBUG] Unmounting" << target << "before partitioning";
+        if (umount2(target.toLocal8Bit().constData(), 0) != 0 && errno != EINVAL) {
+            *error = QString("Cannot unmount %1: %2").arg(target).arg(strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
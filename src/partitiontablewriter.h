@@ -0,0 +1,32 @@
+#pragma once
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+struct PartitionSpec {
+    enum class Type { EfiSystem, LinuxSwap, LinuxFilesystem };
+
+    Type type;
+    QString name;            // GPT partition name
+    qint64 sizeMiB = 0;      // 0 takes the rest of the disk
+    bool bootable = false;   // MBR active flag
+};
+
+// Writes a fresh GPT or MBR partition table without parted or sfdisk.
+//
+// Partitions are laid out back to back from 1 MiB on 1 MiB boundaries. On a
+// block device (loop devices included) the partitions of the device are
+// unmounted first, the old partitions are removed from the kernel and the new
+// ones added one by one with BLKPG, so no full re-read of the table is needed.
+// Image files only get the table written.
+class PartitionTableWriter {
+public:
+    enum class Scheme { Gpt, Mbr };
+
+    // On success devicePaths holds the new partition nodes in spec order
+    // (empty for image files)
+    static bool write(const QString &device, Scheme scheme, const QList<PartitionSpec> &partitions,
+                      QStringList *devicePaths, QString *error);
+    // Disables swap on and unmounts every partition of device
+    static bool releaseDevice(const QString &device, QString *error);
+};
@@ -130,7 +130,7 @@ bool SettingsParser::loadSettings(const QString &configPath) {
     return true;
 }
 
-QStringList SettingsParser::getExecutionCommands() {
+QStringList SettingsParser::getChrootCommands() {
     qDebug() << "[SettingsParser] Getting execution commands...";
     QStringList commands;
     
@@ -162,9 +162,9 @@ QStringList SettingsParser::getExecutionCommands() {
             QString expandedCmd = expandVariables(cmd.trimmed());
             QString finalCmd;
             if (sectionName == "external_scripts") {
-                finalCmd = QString("arch-chroot /mnt /usr/local/bin/%1").arg(expandedCmd);
+                finalCmd = QString("/usr/local/bin/%1").arg(expandedCmd);
             } else {
-                finalCmd = QString("arch-chroot /mnt %1").arg(expandedCmd);
+                finalCmd = expandedCmd;
             }
             commands << finalCmd;
             qDebug() << "[SettingsParser] Added command:" << finalCmd;
@@ -192,4 +192,8 @@ QString SettingsParser::expandVariables(const QString &command) {
 
 QString SettingsParser::getBootloaderId() {
     return variables.value("bootloader_id", "Xray_OS");
+}
+
+QString SettingsParser::getVariable(const QString &name, const QString &defaultValue) {
+    return variables.value(name, defaultValue);
 }
\ No newline at end of file
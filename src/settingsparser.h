@@ -14,9 +14,11 @@ struct CommandSection {
 class SettingsParser {
 public:
     static bool loadSettings(const QString &configPath = "/usr/share/arch7z-installer/settings/final-settings.conf");
-    static QStringList getExecutionCommands();
+    // Final settings commands, to run inside the target
+    static QStringList getChrootCommands();
     static bool hasInternetRequiredCommands();
     static QString getBootloaderId();
+    static QString getVariable(const QString &name, const QString &defaultValue = QString());
     
 private:
     static QMap<QString, CommandSection> sections;
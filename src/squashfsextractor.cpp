@@ -0,0 +1,1278 @@
+#include "squashfsextractor.h"
+#include "blockdecompressor.h"
+#include "btrfsencodedwriter.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr quint32 SQUASHFS_MAGIC = 0x73717368;
+constexpr quint32 SUPERBLOCK_SIZE = 96;
+constexpr quint32 METADATA_SIZE = 8192;
+constexpr quint16 METADATA_UNCOMPRESSED = 0x8000;
+constexpr quint32 DATA_UNCOMPRESSED = 1u << 24;
+constexpr quint32 NO_FRAGMENT = 0xFFFFFFFF;
+constexpr quint32 NO_XATTR = 0xFFFFFFFF;
+constexpr quint64 INVALID_TABLE = 0xFFFFFFFFFFFFFFFFULL;
+constexpr quint16 XATTR_OUT_OF_LINE = 0x100;
+constexpr quint64 MAX_WRITE_RUN = 4 * 1024 * 1024;
+
+enum InodeType : quint16 {
+    BasicDir = 1, BasicFile, BasicSymlink, BasicBlockDev, BasicCharDev, BasicFifo, BasicSocket,
+    ExtDir, ExtFile, ExtSymlink, ExtBlockDev, ExtCharDev, ExtFifo, ExtSocket
+};
+
+quint16 le16(const char *p) { quint16 v; memcpy(&v, p, sizeof(v)); return le16toh(v); }
+quint32 le32(const char *p) { quint32 v; memcpy(&v, p, sizeof(v)); return le32toh(v); }
+quint64 le64(const char *p) { quint64 v; memcpy(&v, p, sizeof(v)); return le64toh(v); }
+
+bool preadExact(int fd, char *buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool pwriteAll(int fd, const char *buffer, size_t length, quint64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+QString systemError(const char *what, const std::string &path) {
+    return QString("%1 %2: %3").arg(what).arg(QString::fromStdString(path)).arg(strerror(errno));
+}
+
+BlockDecompressor::Codec codecForCompressor(quint16 id) {
+    switch (id) {
+        case 1: return BlockDecompressor::Codec::Zlib;
+        case 2: return BlockDecompressor::Codec::Lzma;
+        case 4: return BlockDecompressor::Codec::Xz;
+        case 5: return BlockDecompressor::Codec::Lz4;
+        case 6: return BlockDecompressor::Codec::Zstd;
+        default: return BlockDecompressor::Codec::Unsupported; // 3 = LZO
+    }
+}
+
+bool isDirectory(quint16 type) { return type == BasicDir || type == ExtDir; }
+
+struct Superblock {
+    quint32 inodeCount = 0;
+    quint32 blockSize = 0;
+    quint32 fragmentCount = 0;
+    quint16 compressor = 0;
+    quint16 blockLog = 0;
+    quint16 flags = 0;
+    quint16 idCount = 0;
+    quint16 versionMajor = 0;
+    quint16 versionMinor = 0;
+    quint64 rootInode = 0;
+    quint64 bytesUsed = 0;
+    quint64 idTable = 0;
+    quint64 xattrTable = 0;
+    quint64 inodeTable = 0;
+    quint64 directoryTable = 0;
+    quint64 fragmentTable = 0;
+    quint64 exportTable = 0;
+
+    bool parse(const char *p, QString *error) {
+        if (le32(p) != SQUASHFS_MAGIC) {
+            *error = "not a SquashFS image (bad magic)";
+            return false;
+        }
+        inodeCount = le32(p + 4);
+        blockSize = le32(p + 12);
+        fragmentCount = le32(p + 16);
+        compressor = le16(p + 20);
+        blockLog = le16(p + 22);
+        flags = le16(p + 24);
+        idCount = le16(p + 26);
+        versionMajor = le16(p + 28);
+        versionMinor = le16(p + 30);
+        rootInode = le64(p + 32);
+        bytesUsed = le64(p + 40);
+        idTable = le64(p + 48);
+        xattrTable = le64(p + 56);
+        inodeTable = le64(p + 64);
+        directoryTable = le64(p + 72);
+        fragmentTable = le64(p + 80);
+        exportTable = le64(p + 88);
+
+        if (versionMajor != 4 || versionMinor != 0) {
+            *error = QString("unsupported SquashFS version %1.%2").arg(versionMajor).arg(versionMinor);
+            return false;
+        }
+        if (blockSize < 4096 || blockSize > 1024 * 1024 || (1u << blockLog) != blockSize) {
+            *error = QString("invalid block size %1").arg(blockSize);
+            return false;
+        }
+        return true;
+    }
+};
+
+// Bounded view into a decompressed metadata table
+struct Cursor {
+    const char *pointer = nullptr;
+    size_t remaining = 0;
+
+    const char *take(size_t length) {
+        if (length > remaining) return nullptr;
+        const char *result = pointer;
+        pointer += length;
+        remaining -= length;
+        return result;
+    }
+};
+
+// Metadata blocks decompressed back to back; references are (block offset
+// relative to the table start, offset inside the decompressed block)
+struct MetadataTable {
+    std::vector<char> data;
+    std::unordered_map<quint64, size_t> blockPositions;
+
+    bool cursor(quint64 block, quint32 offset, Cursor *cursor) const {
+        auto it = blockPositions.find(block);
+        if (it == blockPositions.end()) return false;
+        size_t position = it->second + offset;
+        if (position > data.size()) return false;
+        cursor->pointer = data.data() + position;
+        cursor->remaining = data.size() - position;
+        return true;
+    }
+};
+
+struct Inode {
+    quint16 type = 0;
+    mode_t mode = 0;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    quint32 mtime = 0;
+    quint32 number = 0;
+    quint32 linkCount = 1;
+    quint32 xattrIndex = NO_XATTR;
+    quint32 dirBlock = 0;
+    quint32 dirOffset = 0;
+    quint32 dirSize = 0;
+    quint64 blocksStart = 0;
+    quint64 fileSize = 0;
+    quint32 fragmentIndex = NO_FRAGMENT;
+    quint32 fragmentOffset = 0;
+    std::vector<quint32> blockSizes;
+    std::string symlinkTarget;
+    dev_t device = 0;
+};
+
+struct DirEntry {
+    std::string name;
+    quint64 inodeRef = 0;
+};
+
+struct Xattr {
+    std::string name;
+    std::string value;
+};
+
+class SquashfsImage {
+public:
+    ~SquashfsImage() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(const QString &path, QString *error) {
+        fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            *error = systemError("Cannot open", path.toStdString());
+            return false;
+        }
+        char buffer[SUPERBLOCK_SIZE];
+        if (!preadExact(fd, buffer, sizeof(buffer), 0)) {
+            *error = "Cannot read SquashFS superblock";
+            return false;
+        }
+        if (!sb.parse(buffer, error)) {
+            return false;
+        }
+        codec = codecForCompressor(sb.compressor);
+        if (codec == BlockDecompressor::Codec::Unsupported) {
+            *error = QString("unsupported SquashFS compressor id %1").arg(sb.compressor);
+            return false;
+        }
+        // Data is read front to back, let the kernel read ahead aggressively
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        return true;
+    }
+
+    bool loadTables(QString *error) {
+        quint64 directoryEnd = sb.bytesUsed;
+        quint64 firstEntry = 0;
+
+        if (sb.fragmentCount > 0 && sb.fragmentTable != INVALID_TABLE && readU64(sb.fragmentTable, &firstEntry)) {
+            directoryEnd = std::min(directoryEnd, firstEntry);
+        }
+        if (sb.exportTable != INVALID_TABLE && readU64(sb.exportTable, &firstEntry)) {
+            directoryEnd = std::min(directoryEnd, firstEntry);
+        }
+        if (readU64(sb.idTable, &firstEntry)) {
+            directoryEnd = std::min(directoryEnd, firstEntry);
+        }
+
+        quint64 xattrValuesStart = INVALID_TABLE;
+        quint32 xattrIdCount = 0;
+        if (sb.xattrTable != INVALID_TABLE) {
+            char header[16];
+            if (!preadExact(fd, header, sizeof(header), sb.xattrTable)) {
+                *error = "Cannot read xattr table header";
+                return false;
+            }
+            xattrValuesStart = le64(header);
+            xattrIdCount = le32(header + 8);
+            directoryEnd = std::min(directoryEnd, xattrValuesStart);
+        }
+
+        if (!readMetadataRange(sb.inodeTable, sb.directoryTable, &inodes)) {
+            *error = "Cannot read inode table";
+            return false;
+        }
+        if (!readMetadataRange(sb.directoryTable, directoryEnd, &directories)) {
+            *error = "Cannot read directory table";
+            return false;
+        }
+        if (!readIndexedTable(sb.idTable, sb.idCount, 4, &ids)) {
+            *error = "Cannot read id table";
+            return false;
+        }
+        if (sb.fragmentCount > 0 && !readIndexedTable(sb.fragmentTable, sb.fragmentCount, 16, &fragments)) {
+            *error = "Cannot read fragment table";
+            return false;
+        }
+        if (xattrIdCount > 0) {
+            quint64 firstIdBlock = 0;
+            if (!readU64(sb.xattrTable + 16, &firstIdBlock) ||
+                !readMetadataRange(xattrValuesStart, firstIdBlock, &xattrValues) ||
+                !readIndexedTable(sb.xattrTable + 16, xattrIdCount, 16, &xattrIds)) {
+                *error = "Cannot read xattr tables";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool readInode(quint64 ref, Inode *inode) const {
+        Cursor c;
+        if (!inodes.cursor(ref >> 16, ref & 0xFFFF, &c)) return false;
+
+        const char *p = c.take(16);
+        if (!p) return false;
+        inode->type = le16(p);
+        quint16 permissions = le16(p + 2);
+        quint16 uidIndex = le16(p + 4);
+        quint16 gidIndex = le16(p + 6);
+        inode->mtime = le32(p + 8);
+        inode->number = le32(p + 12);
+        if (!lookupId(uidIndex, &inode->uid) || !lookupId(gidIndex, &inode->gid)) return false;
+
+        mode_t typeBits = 0;
+        switch (inode->type) {
+            case BasicDir:
+                if (!(p = c.take(16))) return false;
+                typeBits = S_IFDIR;
+                inode->dirBlock = le32(p);
+                inode->linkCount = le32(p + 4);
+                inode->dirSize = le16(p + 8);
+                inode->dirOffset = le16(p + 10);
+                break;
+            case ExtDir:
+                if (!(p = c.take(24))) return false;
+                typeBits = S_IFDIR;
+                inode->linkCount = le32(p);
+                inode->dirSize = le32(p + 4);
+                inode->dirBlock = le32(p + 8);
+                inode->dirOffset = le16(p + 18);
+                inode->xattrIndex = le32(p + 20);
+                break;
+            case BasicFile:
+                if (!(p = c.take(16))) return false;
+                typeBits = S_IFREG;
+                inode->blocksStart = le32(p);
+                inode->fragmentIndex = le32(p + 4);
+                inode->fragmentOffset = le32(p + 8);
+                inode->fileSize = le32(p + 12);
+                if (!readBlockList(&c, inode)) return false;
+                break;
+            case ExtFile:
+                if (!(p = c.take(40))) return false;
+                typeBits = S_IFREG;
+                inode->blocksStart = le64(p);
+                inode->fileSize = le64(p + 8);
+                inode->linkCount = le32(p + 24);
+                inode->fragmentIndex = le32(p + 28);
+                inode->fragmentOffset = le32(p + 32);
+                inode->xattrIndex = le32(p + 36);
+                if (!readBlockList(&c, inode)) return false;
+                break;
+            case BasicSymlink:
+            case ExtSymlink: {
+                if (!(p = c.take(8))) return false;
+                typeBits = S_IFLNK;
+                inode->linkCount = le32(p);
+                quint32 targetSize = le32(p + 4);
+                const char *target = c.take(targetSize);
+                if (!target) return false;
+                inode->symlinkTarget.assign(target, targetSize);
+                if (inode->type == ExtSymlink) {
+                    if (!(p = c.take(4))) return false;
+                    inode->xattrIndex = le32(p);
+                }
+                break;
+            }
+            case BasicBlockDev:
+            case BasicCharDev:
+            case ExtBlockDev:
+            case ExtCharDev: {
+                bool extended = inode->type >= ExtDir;
+                if (!(p = c.take(extended ? 12 : 8))) return false;
+                typeBits = (inode->type == BasicBlockDev || inode->type == ExtBlockDev) ? S_IFBLK : S_IFCHR;
+                inode->linkCount = le32(p);
+                quint32 encoded = le32(p + 4);
+                // Same encoding as the kernel's new_decode_dev()
+                unsigned int major = (encoded & 0xfff00) >> 8;
+                unsigned int minor = (encoded & 0xff) | ((encoded >> 12) & 0xfff00);
+                inode->device = makedev(major, minor);
+                if (extended) inode->xattrIndex = le32(p + 8);
+                break;
+            }
+            case BasicFifo:
+            case BasicSocket:
+            case ExtFifo:
+            case ExtSocket: {
+                bool extended = inode->type >= ExtDir;
+                if (!(p = c.take(extended ? 8 : 4))) return false;
+                typeBits = (inode->type == BasicFifo || inode->type == ExtFifo) ? S_IFIFO : S_IFSOCK;
+                inode->linkCount = le32(p);
+                if (extended) inode->xattrIndex = le32(p + 4);
+                break;
+            }
+            default:
+                return false;
+        }
+        inode->mode = typeBits | (permissions & 07777);
+        return true;
+    }
+
+    bool readDirectory(const Inode &dir, std::vector<DirEntry> *entries) const {
+        entries->clear();
+        if (dir.dirSize <= 3) return true; // empty directory
+
+        Cursor c;
+        if (!directories.cursor(dir.dirBlock, dir.dirOffset, &c)) return false;
+        size_t remaining = dir.dirSize - 3;
+        if (remaining > c.remaining) return false;
+        c.remaining = remaining;
+
+        while (c.remaining > 0) {
+            const char *header = c.take(12);
+            if (!header) return false;
+            quint32 count = le32(header) + 1;
+            quint32 start = le32(header + 4);
+            if (count > 256) return false;
+
+            for (quint32 i = 0; i < count; ++i) {
+                const char *entry = c.take(8);
+                if (!entry) return false;
+                quint16 offset = le16(entry);
+                quint16 nameSize = le16(entry + 6) + 1;
+                const char *name = c.take(nameSize);
+                if (!name) return false;
+
+                DirEntry dirEntry;
+                dirEntry.name.assign(name, nameSize);
+                dirEntry.inodeRef = (static_cast<quint64>(start) << 16) | offset;
+                entries->push_back(std::move(dirEntry));
+            }
+        }
+        return true;
+    }
+
+    bool readXattrs(quint32 index, std::vector<Xattr> *xattrs) const {
+        xattrs->clear();
+        if (static_cast<size_t>(index) * 16 + 16 > xattrIds.size()) return false;
+        const char *id = xattrIds.data() + static_cast<size_t>(index) * 16;
+        quint64 ref = le64(id);
+        quint32 count = le32(id + 8);
+
+        Cursor c;
+        if (!xattrValues.cursor(ref >> 16, ref & 0xFFFF, &c)) return false;
+
+        static const char *prefixes[] = {"user.", "trusted.", "security."};
+        for (quint32 i = 0; i < count; ++i) {
+            const char *key = c.take(4);
+            if (!key) return false;
+            quint16 type = le16(key);
+            quint16 nameSize = le16(key + 2);
+            const char *name = c.take(nameSize);
+            const char *sizeField = c.take(4);
+            if (!name || !sizeField || (type & 0xFF) > 2) return false;
+
+            Xattr xattr;
+            xattr.name = std::string(prefixes[type & 0xFF]) + std::string(name, nameSize);
+
+            quint32 valueSize = le32(sizeField);
+            const char *value = c.take(valueSize);
+            if (!value) return false;
+
+            if (type & XATTR_OUT_OF_LINE) {
+                // The inline value is a reference to a shared value elsewhere in the table
+                if (valueSize != 8) return false;
+                quint64 valueRef = le64(value);
+                Cursor shared;
+                if (!xattrValues.cursor(valueRef >> 16, valueRef & 0xFFFF, &shared)) return false;
+                const char *sharedSize = shared.take(4);
+                if (!sharedSize) return false;
+                quint32 length = le32(sharedSize);
+                const char *sharedValue = shared.take(length);
+                if (!sharedValue) return false;
+                xattr.value.assign(sharedValue, length);
+            } else {
+                xattr.value.assign(value, valueSize);
+            }
+            xattrs->push_back(std::move(xattr));
+        }
+        return true;
+    }
+
+    bool fragmentLocation(quint32 index, quint64 *start, quint32 *sizeField) const {
+        if (static_cast<size_t>(index) * 16 + 16 > fragments.size()) return false;
+        const char *entry = fragments.data() + static_cast<size_t>(index) * 16;
+        *start = le64(entry);
+        *sizeField = le32(entry + 8);
+        return true;
+    }
+
+    bool decompressData(const char *raw, quint32 sizeField, char *dst, size_t capacity, size_t *outSize) const {
+        size_t onDisk = sizeField & ~DATA_UNCOMPRESSED;
+        BlockDecompressor::Codec blockCodec = (sizeField & DATA_UNCOMPRESSED) ? BlockDecompressor::Codec::None : codec;
+        return BlockDecompressor::decompress(blockCodec, raw, onDisk, dst, capacity, outSize);
+    }
+
+    Superblock sb;
+    BlockDecompressor::Codec codec = BlockDecompressor::Codec::Unsupported;
+    int fd = -1;
+
+private:
+    bool readU64(quint64 position, quint64 *value) const {
+        char buffer[8];
+        if (!preadExact(fd, buffer, sizeof(buffer), position)) return false;
+        *value = le64(buffer);
+        return true;
+    }
+
+    bool lookupId(quint16 index, quint32 *id) const {
+        if (static_cast<size_t>(index) * 4 + 4 > ids.size()) return false;
+        *id = le32(ids.data() + static_cast<size_t>(index) * 4);
+        return true;
+    }
+
+    bool readBlockList(Cursor *c, Inode *inode) const {
+        quint64 blockSize = sb.blockSize;
+        quint64 count = inode->fragmentIndex == NO_FRAGMENT
+                        ? (inode->fileSize + blockSize - 1) / blockSize
+                        : inode->fileSize / blockSize;
+        const char *list = c->take(count * 4);
+        if (!list) return false;
+        inode->blockSizes.resize(count);
+        for (quint64 i = 0; i < count; ++i) {
+            inode->blockSizes[i] = le32(list + i * 4);
+        }
+        return true;
+    }
+
+    bool readMetadataBlock(quint64 position, std::vector<char> *out, quint64 *next) const {
+        char header[2];
+        if (!preadExact(fd, header, sizeof(header), position)) return false;
+        quint16 value = le16(header);
+        quint32 size = value & ~METADATA_UNCOMPRESSED;
+        if (size == 0 || size > METADATA_SIZE) return false;
+
+        std::vector<char> raw(size);
+        if (!preadExact(fd, raw.data(), size, position + 2)) return false;
+
+        out->resize(METADATA_SIZE);
+        size_t produced = 0;
+        BlockDecompressor::Codec blockCodec = (value & METADATA_UNCOMPRESSED) ? BlockDecompressor::Codec::None : codec;
+        if (!BlockDecompressor::decompress(blockCodec, raw.data(), size, out->data(), METADATA_SIZE, &produced)) {
+            return false;
+        }
+        out->resize(produced);
+        *next = position + 2 + size;
+        return true;
+    }
+
+    bool readMetadataRange(quint64 start, quint64 end, MetadataTable *table) const {
+        std::vector<char> block;
+        quint64 position = start;
+        while (position < end) {
+            quint64 next = 0;
+            if (!readMetadataBlock(position, &block, &next)) return false;
+            table->blockPositions[position - start] = table->data.size();
+            table->data.insert(table->data.end(), block.begin(), block.end());
+            position = next;
+        }
+        return true;
+    }
+
+    bool readIndexedTable(quint64 indexStart, size_t count, size_t entrySize, std::vector<char> *out) const {
+        size_t totalBytes = count * entrySize;
+        size_t blocks = (totalBytes + METADATA_SIZE - 1) / METADATA_SIZE;
+        std::vector<char> index(blocks * 8);
+        if (!preadExact(fd, index.data(), index.size(), indexStart)) return false;
+
+        std::vector<char> block;
+        for (size_t i = 0; i < blocks; ++i) {
+            quint64 next = 0;
+            if (!readMetadataBlock(le64(index.data() + i * 8), &block, &next)) return false;
+            out->insert(out->end(), block.begin(), block.end());
+        }
+        return out->size() >= totalBytes;
+    }
+
+    MetadataTable inodes;
+    MetadataTable directories;
+    MetadataTable xattrValues;
+    std::vector<char> ids;
+    std::vector<char> fragments;
+    std::vector<char> xattrIds;
+};
+
+struct FileJob {
+    std::string path;
+    Inode inode;
+    std::vector<Xattr> xattrs;
+    bool hasTail = false;
+    std::atomic<quint32> remainingParts{0};
+    std::once_flag openOnce;
+    int fd = -1;
+};
+
+// One sequential read from the image: either a run of data blocks of a single
+// file or a whole fragment block shared by the tails of several files
+struct ReadOp {
+    quint64 diskOffset = 0;
+    quint64 length = 0;
+    FileJob *job = nullptr;
+    quint32 firstBlock = 0;
+    quint32 blockCount = 0;
+    quint32 fragment = NO_FRAGMENT;
+    quint32 fragmentSizeField = 0;
+};
+
+struct DataTask {
+    ReadOp op;
+    std::vector<char> raw;
+};
+
+class TaskQueue {
+public:
+    explicit TaskQueue(size_t capacityBytes) : capacity(capacityBytes) {}
+
+    bool push(DataTask &&task, const std::atomic<bool> &stop) {
+        QMutexLocker locker(&mutex);
+        size_t size = task.raw.size();
+        while (!tasks.empty() && queuedBytes + size > capacity) {
+            if (stop) return false;
+            notFull.wait(&mutex, 100);
+        }
+        queuedBytes += size;
+        tasks.push_back(std::move(task));
+        notEmpty.wakeOne();
+        return true;
+    }
+
+    bool pop(DataTask *task) {
+        QMutexLocker locker(&mutex);
+        while (tasks.empty()) {
+            if (closed) return false;
+            notEmpty.wait(&mutex);
+        }
+        *task = std::move(tasks.front());
+        tasks.pop_front();
+        queuedBytes -= task->raw.size();
+        notFull.wakeAll();
+        return true;
+    }
+
+    void close() {
+        QMutexLocker locker(&mutex);
+        closed = true;
+        notEmpty.wakeAll();
+    }
+
+private:
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    std::deque<DataTask> tasks;
+    size_t queuedBytes = 0;
+    size_t capacity;
+    bool closed = false;
+};
+
+class ExtractionRun {
+public:
+    ExtractionRun(const SquashfsImage &image, const std::string &root, std::atomic<bool> &cancelled,
+                  int workers, size_t queueBytes, bool encodedWrites)
+        : image(image), root(root), cancelled(cancelled), workerCount(std::max(1, workers)),
+          encodedWrites(encodedWrites),
+          queue(std::max<size_t>(queueBytes, static_cast<size_t>(workerCount) * 2 * MAX_WRITE_RUN)) {}
+
+    bool scan(QString *error) {
+        Inode rootInode;
+        if (!image.readInode(image.sb.rootInode, &rootInode) || !isDirectory(rootInode.type)) {
+            *error = "Corrupt SquashFS image: cannot read root directory";
+            return false;
+        }
+
+        std::vector<Xattr> rootXattrs;
+        if (rootInode.xattrIndex != NO_XATTR && !image.readXattrs(rootInode.xattrIndex, &rootXattrs)) {
+            *error = "Corrupt SquashFS image: bad xattrs on root directory";
+            return false;
+        }
+
+        struct PendingDir {
+            std::string path;
+            Inode inode;
+            int depth;
+        };
+        std::vector<PendingDir> stack;
+        stack.push_back({root, rootInode, 0});
+        directories.push_back({root, rootInode, rootXattrs, 0});
+        inodesDone++;
+
+        std::vector<DirEntry> entries;
+        while (!stack.empty()) {
+            if (cancelled) {
+                *error = "Extraction cancelled";
+                return false;
+            }
+            PendingDir current = std::move(stack.back());
+            stack.pop_back();
+
+            if (!image.readDirectory(current.inode, &entries)) {
+                *error = QString("Corrupt SquashFS image: cannot read directory %1").arg(QString::fromStdString(current.path));
+                return false;
+            }
+
+            for (const DirEntry &entry : entries) {
+                if (entry.name.empty() || entry.name == "." || entry.name == ".." ||
+                    entry.name.find('/') != std::string::npos) {
+                    *error = QString("Corrupt SquashFS image: invalid name in %1").arg(QString::fromStdString(current.path));
+                    return false;
+                }
+
+                Inode inode;
+                if (!image.readInode(entry.inodeRef, &inode)) {
+                    *error = QString("Corrupt SquashFS image: bad inode for %1/%2")
+                             .arg(QString::fromStdString(current.path)).arg(QString::fromStdString(entry.name));
+                    return false;
+                }
+
+                std::string path = current.path + "/" + entry.name;
+                if (!createEntry(path, inode, current.depth + 1, error)) {
+                    return false;
+                }
+                if (isDirectory(inode.type)) {
+                    stack.push_back({path, inode, current.depth + 1});
+                }
+            }
+        }
+        return true;
+    }
+
+    bool extractData(const std::function<void()> &report, QString *error) {
+        std::vector<ReadOp> ops;
+        buildReadOps(&ops);
+        qDebug() << QString("[DEBUG] %1 files, %2 sequential reads, %3 workers")
+                    .arg(jobs.size()).arg(ops.size()).arg(workerCount);
+
+        std::vector<QThread *> workers;
+        for (int i = 0; i < workerCount; ++i) {
+            QThread *worker = QThread::create([this]() { workerLoop(); });
+            worker->start();
+            workers.push_back(worker);
+        }
+
+        QElapsedTimer sinceReport;
+        sinceReport.start();
+        for (const ReadOp &op : ops) {
+            if (stopping()) break;
+
+            DataTask task;
+            task.op = op;
+            task.raw.resize(op.length);
+            if (op.length > 0 && !preadExact(image.fd, task.raw.data(), op.length, op.diskOffset)) {
+                fail(QString("Read error in SquashFS image at offset %1").arg(op.diskOffset));
+                break;
+            }
+            if (!queue.push(std::move(task), failed)) break;
+
+            if (sinceReport.elapsed() >= 250) {
+                report();
+                sinceReport.restart();
+            }
+        }
+        queue.close();
+
+        for (QThread *worker : workers) {
+            while (!worker->wait(250)) {
+                report();
+            }
+            delete worker;
+        }
+
+        if (failed) {
+            QMutexLocker locker(&errorMutex);
+            *error = firstError;
+            return false;
+        }
+        if (cancelled) {
+            *error = "Extraction cancelled";
+            return false;
+        }
+        return true;
+    }
+
+    bool finalizeDirectories(QString *error) {
+        // Deepest first so parents keep their mtime after children are touched
+        std::stable_sort(directories.begin(), directories.end(),
+                         [](const DirRecord &a, const DirRecord &b) { return a.depth > b.depth; });
+        for (const DirRecord &dir : directories) {
+            if (cancelled) {
+                *error = "Extraction cancelled";
+                return false;
+            }
+            applyMetadata(-1, dir.path, dir.inode, dir.xattrs);
+        }
+        return true;
+    }
+
+    qint64 totalBytes() const { return bytesTotal; }
+    qint64 writtenBytes() const { return bytesDone; }
+    quint32 completedInodes() const { return inodesDone; }
+    int warnings() const { return metadataWarnings; }
+    quint64 passthroughBlocks() const { return encodedBlocks; }
+    quint64 decodedFallbacks() const { return encodedFallbacks; }
+
+private:
+    struct DirRecord {
+        std::string path;
+        Inode inode;
+        std::vector<Xattr> xattrs;
+        int depth;
+    };
+
+    bool stopping() const { return failed || cancelled; }
+
+    void fail(const QString &message) {
+        QMutexLocker locker(&errorMutex);
+        if (!failed) {
+            firstError = message;
+            failed = true;
+        }
+    }
+
+    void warn(const QString &message) {
+        int count = ++metadataWarnings;
+        if (count <= 10) {
+            qDebug() << "[WARNING]" << message;
+        }
+    }
+
+    bool removeExisting(const std::string &path, QString *error) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) return true;
+        if (S_ISDIR(st.st_mode)) {
+            *error = QString("Cannot replace directory %1 with a non-directory").arg(QString::fromStdString(path));
+            return false;
+        }
+        if (unlink(path.c_str()) != 0) {
+            *error = systemError("Cannot remove", path);
+            return false;
+        }
+        return true;
+    }
+
+    bool createEntry(const std::string &path, const Inode &inode, int depth, QString *error) {
+        std::vector<Xattr> xattrs;
+        if (inode.xattrIndex != NO_XATTR && !image.readXattrs(inode.xattrIndex, &xattrs)) {
+            *error = QString("Corrupt SquashFS image: bad xattrs for %1").arg(QString::fromStdString(path));
+            return false;
+        }
+
+        if (!isDirectory(inode.type) && inode.linkCount > 1) {
+            auto existing = linkTargets.find(inode.number);
+            if (existing != linkTargets.end()) {
+                if (!removeExisting(path, error)) return false;
+                if (link(existing->second.c_str(), path.c_str()) != 0) {
+                    *error = systemError("Cannot create hardlink", path);
+                    return false;
+                }
+                return true;
+            }
+            linkTargets.emplace(inode.number, path);
+        }
+
+        switch (inode.mode & S_IFMT) {
+            case S_IFDIR: {
+                if (mkdir(path.c_str(), 0700) != 0) {
+                    struct stat st;
+                    if (errno != EEXIST || lstat(path.c_str(), &st) != 0) {
+                        *error = systemError("Cannot create directory", path);
+                        return false;
+                    }
+                    if (!S_ISDIR(st.st_mode)) {
+                        if (unlink(path.c_str()) != 0 || mkdir(path.c_str(), 0700) != 0) {
+                            *error = systemError("Cannot create directory", path);
+                            return false;
+                        }
+                    }
+                }
+                directories.push_back({path, inode, xattrs, depth});
+                inodesDone++;
+                return true;
+            }
+            case S_IFREG: {
+                if (!removeExisting(path, error)) return false;
+                int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+                if (fd < 0) {
+                    *error = systemError("Cannot create", path);
+                    return false;
+                }
+                // Pre-size the file: unwritten (sparse) blocks stay holes
+                if (inode.fileSize > 0 && ftruncate(fd, static_cast<off_t>(inode.fileSize)) != 0) {
+                    *error = systemError("Cannot size", path);
+                    close(fd);
+                    return false;
+                }
+
+                bool hasTail = inode.fragmentIndex != NO_FRAGMENT &&
+                               inode.fileSize > static_cast<quint64>(inode.blockSizes.size()) * image.sb.blockSize;
+                if (inode.blockSizes.empty() && !hasTail) {
+                    applyMetadata(fd, path, inode, xattrs);
+                    close(fd);
+                    inodesDone++;
+                    return true;
+                }
+                close(fd);
+
+                auto job = std::make_unique<FileJob>();
+                job->path = path;
+                job->inode = inode;
+                job->xattrs = std::move(xattrs);
+                job->hasTail = hasTail;
+                bytesTotal += static_cast<qint64>(inode.fileSize);
+                jobs.push_back(std::move(job));
+                return true;
+            }
+            case S_IFLNK: {
+                if (!removeExisting(path, error)) return false;
+                if (symlink(inode.symlinkTarget.c_str(), path.c_str()) != 0) {
+                    *error = systemError("Cannot create symlink", path);
+                    return false;
+                }
+                applyMetadata(-1, path, inode, xattrs);
+                inodesDone++;
+                return true;
+            }
+            default: {
+                if (!removeExisting(path, error)) return false;
+                if (mknod(path.c_str(), (inode.mode & S_IFMT) | 0600, inode.device) != 0) {
+                    *error = systemError("Cannot create special file", path);
+                    return false;
+                }
+                applyMetadata(-1, path, inode, xattrs);
+                inodesDone++;
+                return true;
+            }
+        }
+    }
+
+    void applyMetadata(int fd, const std::string &path, const Inode &inode, const std::vector<Xattr> &xattrs) {
+        bool isLink = S_ISLNK(inode.mode);
+        struct timespec times[2];
+        times[0].tv_sec = inode.mtime;
+        times[0].tv_nsec = 0;
+        times[1] = times[0];
+
+        // chown first: it clears setuid/setgid bits that chmod then restores
+        if ((fd >= 0 ? fchown(fd, inode.uid, inode.gid) : lchown(path.c_str(), inode.uid, inode.gid)) != 0) {
+            warn(systemError("chown", path));
+        }
+        if (!isLink && (fd >= 0 ? fchmod(fd, inode.mode & 07777) : chmod(path.c_str(), inode.mode & 07777)) != 0) {
+            warn(systemError("chmod", path));
+        }
+        // After the data is written so security.capability is not stripped again
+        for (const Xattr &xattr : xattrs) {
+            int ret = fd >= 0
+                      ? fsetxattr(fd, xattr.name.c_str(), xattr.value.data(), xattr.value.size(), 0)
+                      : lsetxattr(path.c_str(), xattr.name.c_str(), xattr.value.data(), xattr.value.size(), 0);
+            if (ret != 0) {
+                warn(systemError(("setxattr " + xattr.name).c_str(), path));
+            }
+        }
+        if ((fd >= 0 ? futimens(fd, times) : utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW)) != 0) {
+            warn(systemError("utimes", path));
+        }
+    }
+
+    void buildReadOps(std::vector<ReadOp> *ops) {
+        const quint64 blockSize = image.sb.blockSize;
+        const quint32 blocksPerRun = static_cast<quint32>(std::max<quint64>(1, MAX_WRITE_RUN / blockSize));
+
+        for (const std::unique_ptr<FileJob> &job : jobs) {
+            quint32 parts = 0;
+            quint64 diskOffset = job->inode.blocksStart;
+            quint32 blockCount = static_cast<quint32>(job->inode.blockSizes.size());
+
+            for (quint32 index = 0; index < blockCount;) {
+                ReadOp op;
+                op.job = job.get();
+                op.firstBlock = index;
+                op.diskOffset = diskOffset;
+                while (index < blockCount && op.blockCount < blocksPerRun) {
+                    op.length += job->inode.blockSizes[index] & ~DATA_UNCOMPRESSED;
+                    op.blockCount++;
+                    index++;
+                }
+                diskOffset += op.length;
+                ops->push_back(op);
+                parts++;
+            }
+
+            if (job->hasTail) {
+                fragmentUsers[job->inode.fragmentIndex].push_back(job.get());
+                parts++;
+            }
+            job->remainingParts = parts;
+        }
+
+        for (const auto &users : fragmentUsers) {
+            ReadOp op;
+            op.fragment = users.first;
+            quint64 start = 0;
+            quint32 sizeField = 0;
+            if (!image.fragmentLocation(users.first, &start, &sizeField)) {
+                fail(QString("Corrupt SquashFS image: bad fragment %1").arg(users.first));
+                continue;
+            }
+            op.diskOffset = start;
+            op.length = sizeField & ~DATA_UNCOMPRESSED;
+            op.fragmentSizeField = sizeField;
+            ops->push_back(op);
+        }
+
+        // The whole point: one pass over the image in on-disk order
+        std::stable_sort(ops->begin(), ops->end(),
+                         [](const ReadOp &a, const ReadOp &b) { return a.diskOffset < b.diskOffset; });
+    }
+
+    int openJob(FileJob *job) {
+        std::call_once(job->openOnce, [this, job]() {
+            job->fd = open(job->path.c_str(), O_WRONLY | O_NOFOLLOW | O_CLOEXEC);
+            if (job->fd < 0) {
+                fail(systemError("Cannot open", job->path));
+            }
+        });
+        return job->fd;
+    }
+
+    void completePart(FileJob *job) {
+        if (job->remainingParts.fetch_sub(1) != 1) return;
+        if (job->fd >= 0) {
+            if (!stopping()) {
+                applyMetadata(job->fd, job->path, job->inode, job->xattrs);
+            }
+            close(job->fd);
+            job->fd = -1;
+        }
+        inodesDone++;
+    }
+
+    void workerLoop() {
+        std::vector<char> buffer;
+        DataTask task;
+        while (queue.pop(&task)) {
+            if (task.op.job) {
+                processData(task, buffer);
+            } else {
+                processFragment(task, buffer);
+            }
+        }
+    }
+
+    void processData(DataTask &task, std::vector<char> &buffer) {
+        FileJob *job = task.op.job;
+        const quint64 blockSize = image.sb.blockSize;
+        int fd = stopping() ? -1 : openJob(job);
+
+        if (fd >= 0) {
+            buffer.resize(static_cast<size_t>(task.op.blockCount) * blockSize);
+            size_t rawPosition = 0;
+            size_t runLength = 0;
+            quint64 runStart = static_cast<quint64>(task.op.firstBlock) * blockSize;
+
+            // Write out the decoded blocks collected so far and start a new run at nextStart
+            auto flushRun = [&](quint64 nextStart) {
+                if (runLength > 0 && !pwriteAll(fd, buffer.data(), runLength, runStart)) {
+                    fail(systemError("Write error on", job->path));
+                    return false;
+                }
+                bytesDone += static_cast<qint64>(runLength);
+                runStart = nextStart;
+                runLength = 0;
+                return true;
+            };
+
+            bool ok = true;
+            for (quint32 i = 0; i < task.op.blockCount && ok; ++i) {
+                quint32 index = task.op.firstBlock + i;
+                quint64 offset = static_cast<quint64>(index) * blockSize;
+                quint64 expected = std::min<quint64>(blockSize, job->inode.fileSize - offset);
+                quint32 sizeField = job->inode.blockSizes[index];
+                quint32 onDisk = sizeField & ~DATA_UNCOMPRESSED;
+                const char *raw = task.raw.data() + rawPosition;
+
+                if (onDisk == 0) {
+                    // Sparse block: flush what we have and leave a hole
+                    ok = flushRun(offset + expected);
+                    bytesDone += static_cast<qint64>(expected);
+                    continue;
+                }
+                rawPosition += onDisk;
+
+                if (encodedWrites && !(sizeField & DATA_UNCOMPRESSED)) {
+                    if (!(ok = flushRun(offset))) break;
+                    BtrfsEncodedWriter::Result result = BtrfsEncodedWriter::writeZstdFrame(fd, raw, onDisk, offset, expected);
+                    if (result == BtrfsEncodedWriter::Result::Written) {
+                        encodedBlocks++;
+                        bytesDone += static_cast<qint64>(expected);
+                        runStart = offset + expected;
+                        continue;
+                    }
+                    if (result == BtrfsEncodedWriter::Result::Unsupported && encodedWrites.exchange(false)) {
+                        qDebug() << "[WARNING] Btrfs encoded writes unsupported here, decompressing instead:" << strerror(errno);
+                    }
+                    encodedFallbacks++;
+                }
+
+                size_t produced = 0;
+                if (!image.decompressData(raw, sizeField, buffer.data() + runLength, blockSize, &produced) ||
+                    produced != expected) {
+                    fail(QString("Corrupt data block in %1").arg(QString::fromStdString(job->path)));
+                    ok = false;
+                    break;
+                }
+                runLength += produced;
+            }
+
+            if (ok) {
+                flushRun(runStart);
+            }
+        }
+        completePart(job);
+    }
+
+    void processFragment(DataTask &task, std::vector<char> &buffer) {
+        const std::vector<FileJob *> &users = fragmentUsers[task.op.fragment];
+        const quint64 blockSize = image.sb.blockSize;
+        size_t produced = 0;
+        bool ok = !stopping();
+
+        if (ok) {
+            buffer.resize(blockSize);
+            ok = image.decompressData(task.raw.data(), task.op.fragmentSizeField, buffer.data(), blockSize, &produced);
+            if (!ok) {
+                fail(QString("Corrupt fragment block %1").arg(task.op.fragment));
+            }
+        }
+
+        for (FileJob *job : users) {
+            if (ok && !stopping()) {
+                quint64 tailOffset = static_cast<quint64>(job->inode.blockSizes.size()) * blockSize;
+                quint64 tailSize = job->inode.fileSize - tailOffset;
+                int fd = openJob(job);
+                if (job->inode.fragmentOffset + tailSize > produced) {
+                    fail(QString("Corrupt fragment reference in %1").arg(QString::fromStdString(job->path)));
+                } else if (fd >= 0) {
+                    if (pwriteAll(fd, buffer.data() + job->inode.fragmentOffset, tailSize, tailOffset)) {
+                        bytesDone += static_cast<qint64>(tailSize);
+                    } else {
+                        fail(systemError("Write error on", job->path));
+                    }
+                }
+            }
+            completePart(job);
+        }
+    }
+
+    const SquashfsImage &image;
+    std::string root;
+    std::atomic<bool> &cancelled;
+    int workerCount;
+    std::atomic<bool> encodedWrites;
+    TaskQueue queue;
+
+    std::vector<std::unique_ptr<FileJob>> jobs;
+    std::vector<DirRecord> directories;
+    std::unordered_map<quint32, std::string> linkTargets;
+    std::unordered_map<quint32, std::vector<FileJob *>> fragmentUsers;
+
+    qint64 bytesTotal = 0;
+    std::atomic<qint64> bytesDone{0};
+    std::atomic<quint32> inodesDone{0};
+    std::atomic<int> metadataWarnings{0};
+    std::atomic<quint64> encodedBlocks{0};
+    std::atomic<quint64> encodedFallbacks{0};
+    std::atomic<bool> failed{false};
+    QMutex errorMutex;
+    QString firstError;
+};
+
+void raiseOpenFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+} // namespace
+
+SquashfsExtractor::SquashfsExtractor(const QString &imagePath, const QString &targetDir, QObject *parent)
+    : QObject(parent), imagePath(imagePath), targetDir(targetDir), workerCount(1), queueBudgetMb(256),
+      thread(nullptr), cancelled(false) {
+}
+
+SquashfsExtractor::~SquashfsExtractor() {
+    cancel();
+    wait();
+    delete thread;
+}
+
+bool SquashfsExtractor::canExtract(const QString &imagePath, QString *reason) {
+    SquashfsImage image;
+    return image.open(imagePath, reason);
+}
+
+void SquashfsExtractor::setWorkerCount(int workers) {
+    workerCount = std::max(1, workers);
+}
+
+void SquashfsExtractor::setQueueBudgetMb(int megabytes) {
+    queueBudgetMb = std::max(16, megabytes);
+}
+
+void SquashfsExtractor::start() {
+    if (thread) return;
+    thread = QThread::create([this]() {
+        QString message;
+        bool success = run(&message);
+        emit finished(success, message);
+    });
+    thread->start();
+}
+
+void SquashfsExtractor::cancel() {
+    cancelled = true;
+}
+
+void SquashfsExtractor::wait() {
+    if (thread) {
+        thread->wait();
+    }
+}
+
+bool SquashfsExtractor::run(QString *message) {
+    QElapsedTimer timer;
+    timer.start();
+
+    SquashfsImage image;
+    if (!image.open(imagePath, message) || !image.loadTables(message)) {
+        return false;
+    }
+    qDebug() << QString("[DEBUG] %1: %2 inodes, block size %3, %4 compression")
+                .arg(imagePath).arg(image.sb.inodeCount).arg(image.sb.blockSize)
+                .arg(BlockDecompressor::codecName(image.codec));
+
+    // On a btrfs target, zstd blocks can go to disk still compressed instead of
+    // being decoded here and recompressed by compress=zstd in the kernel
+    bool encodedWrites = false;
+    if (image.codec == BlockDecompressor::Codec::Zstd && BtrfsEncodedWriter::isBtrfs(targetDir)) {
+        encodedWrites = image.sb.blockSize <= BtrfsEncodedWriter::MaxExtentSize;
+        qDebug() << QString("[DEBUG] Btrfs zstd passthrough %1 (block size %2)")
+                    .arg(encodedWrites ? "enabled" : "disabled, btrfs extents are limited to 128K")
+                    .arg(image.sb.blockSize);
+    }
+
+    raiseOpenFileLimit();
+    ExtractionRun extraction(image, targetDir.toStdString(), cancelled, workerCount,
+                             static_cast<size_t>(queueBudgetMb) * 1024 * 1024, encodedWrites);
+    auto report = [this, &extraction, &image]() {
+        emit progressChanged(extraction.writtenBytes(), extraction.totalBytes(),
+                             extraction.completedInodes(), image.sb.inodeCount);
+    };
+
+    if (!extraction.scan(message)) {
+        return false;
+    }
+    qDebug() << QString("[DEBUG] Directory tree created in %1 ms (%2 inodes)")
+                .arg(timer.elapsed()).arg(extraction.completedInodes());
+    report();
+
+    if (!extraction.extractData(report, message) || !extraction.finalizeDirectories(message)) {
+        return false;
+    }
+    report();
+
+    double seconds = std::max<qint64>(1, timer.elapsed()) / 1000.0;
+    *message = QString("Extracted %1 MB and %2 inodes in %3 s (%4 MB/s, %5 metadata warnings)")
+               .arg(extraction.writtenBytes() / (1024 * 1024))
+               .arg(extraction.completedInodes())
+               .arg(seconds, 0, 'f', 1)
+               .arg(extraction.writtenBytes() / (1024.0 * 1024.0) / seconds, 0, 'f', 1)
+               .arg(extraction.warnings());
+    qDebug() << "[DEBUG]" << *message;
+    if (encodedWrites) {
+        qDebug() << QString("[DEBUG] Btrfs passthrough: %1 blocks written compressed, %2 decoded")
+                    .arg(extraction.passthroughBlocks()).arg(extraction.decodedFallbacks());
+    }
+    return true;
+}
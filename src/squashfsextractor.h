@@ -0,0 +1,44 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <atomic>
+
+class QThread;
+
+// In-process SquashFS 4.0 extractor.
+//
+// The directory tree is created first (directories, empty pre-sized files,
+// symlinks, device nodes and hardlinks). File data is then read from the image
+// strictly in on-disk order by a single reader, decompressed by a worker pool and
+// written back in coalesced runs. Ownership, modes, xattrs and timestamps are
+// applied once a file is complete; directories are finalized last, deepest first.
+class SquashfsExtractor : public QObject {
+    Q_OBJECT
+
+public:
+    SquashfsExtractor(const QString &imagePath, const QString &targetDir, QObject *parent = nullptr);
+    ~SquashfsExtractor();
+
+    static bool canExtract(const QString &imagePath, QString *reason);
+
+    void setWorkerCount(int workers);
+    void setQueueBudgetMb(int megabytes);
+
+    void start();
+    void cancel();
+    void wait();
+
+signals:
+    void progressChanged(qint64 bytesDone, qint64 bytesTotal, quint32 inodesDone, quint32 inodesTotal);
+    void finished(bool success, const QString &message);
+
+private:
+    bool run(QString *message);
+
+    QString imagePath;
+    QString targetDir;
+    int workerCount;
+    int queueBudgetMb;
+    QThread *thread;
+    std::atomic<bool> cancelled;
+};
@@ -0,0 +1,187 @@
+#include "storageprofile.h"
+#include "vmdetection.h"
+#include <QFile>
+#include <QFileInfo>
+
+namespace {
+
+qint64 readSysfsNumber(const QString &path, qint64 defaultValue) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return defaultValue;
+    }
+    bool ok = false;
+    qint64 value = file.readAll().trimmed().toLongLong(&ok);
+    return ok ? value : defaultValue;
+}
+
+} // namespace
+
+StorageProfile StorageProfile::detect(const QString &device) {
+    StorageProfile profile;
+
+    // Partitions have no queue/ of their own; it lives on the parent disk
+    QString name = QFileInfo(QFileInfo(device).canonicalFilePath()).fileName();
+    QString sysPath = QFileInfo("/sys/class/block/" + name).canonicalFilePath();
+    if (!sysPath.isEmpty() && !QFile::exists(sysPath + "/queue")) {
+        sysPath = QFileInfo(sysPath).path();
+    }
+    if (sysPath.isEmpty()) {
+        profile.disk = device;
+        profile.transport = "unknown";
+        return profile;
+    }
+    QString diskName = QFileInfo(sysPath).fileName();
+    profile.disk = "/dev/" + diskName;
+
+    QString queue = sysPath + "/queue/";
+    profile.rotational = readSysfsNumber(queue + "rotational", 1) != 0;
+    profile.discard = readSysfsNumber(queue + "discard_max_bytes", 0) > 0;
+    profile.physicalBlock = readSysfsNumber(queue + "physical_block_size", 512);
+    profile.minimumIo = readSysfsNumber(queue + "minimum_io_size", 0);
+    profile.optimalIo = readSysfsNumber(queue + "optimal_io_size", 0);
+
+    // The device path in sysfs names the bus the disk hangs off
+    if (diskName.startsWith("nvme") || sysPath.contains("/nvme")) {
+        profile.transport = "nvme";
+    } else if (diskName.startsWith("mmcblk")) {
+        profile.transport = "mmc";
+    } else if (diskName.startsWith("vd") || sysPath.contains("/virtio")) {
+        profile.transport = "virtio";
+    } else if (sysPath.contains("/usb")) {
+        profile.transport = "usb";
+    } else if (sysPath.contains("/ata")) {
+        profile.transport = "sata";
+    } else if (sysPath.contains("/host")) {
+        profile.transport = "scsi";
+    } else {
+        profile.transport = "unknown";
+    }
+
+    if (profile.transport == "virtio" || (profile.transport == "scsi" && VMDetection::isVirtualMachine())) {
+        profile.kind = Kind::VirtualDisk;
+    } else if (profile.transport == "nvme") {
+        profile.kind = Kind::NvmeSsd;
+    } else if (profile.transport == "mmc") {
+        profile.kind = Kind::Emmc;
+    } else if (profile.rotational) {
+        profile.kind = Kind::Hdd;
+    } else if (profile.transport == "usb") {
+        profile.kind = Kind::UsbFlash;
+    } else if (profile.transport == "sata") {
+        profile.kind = Kind::SataSsd;
+    } else {
+        profile.kind = Kind::Ssd;
+    }
+    return profile;
+}
+
+QString StorageProfile::name() const {
+    switch (kind) {
+    case Kind::NvmeSsd: return "NVMe SSD";
+    case Kind::SataSsd: return "SATA SSD";
+    case Kind::Hdd: return "HDD";
+    case Kind::Emmc: return "eMMC/SD";
+    case Kind::UsbFlash: return "USB flash";
+    case Kind::VirtualDisk: return "Virtual disk";
+    case Kind::Ssd: break;
+    }
+    return "SSD";
+}
+
+QString StorageProfile::summary() const {
+    QStringList traits;
+    traits << transport;
+    traits << (rotational ? "rotational" : "non-rotational");
+    if (discard) {
+        traits << "discard";
+    }
+    if (physicalBlock > 512) {
+        traits << QString("%1 B sectors").arg(physicalBlock);
+    }
+    if (optimalIo > 0) {
+        traits << QString("optimal I/O %1 KiB").arg(optimalIo / 1024);
+    }
+    return QString("%1 (%2)").arg(name()).arg(traits.join(", "));
+}
+
+bool StorageProfile::isFlash() const {
+    return !rotational && kind != Kind::VirtualDisk;
+}
+
+QStringList StorageProfile::mkfsOptions(const QString &fsType, bool alreadyDiscarded) const {
+    QStringList options;
+
+    if (fsType == "ext4") {
+        QStringList extended;
+        if (kind == Kind::Hdd || kind == Kind::Emmc || kind == Kind::UsbFlash) {
+            // Writing every inode table up front takes minutes on slow media;
+            // the kernel fills them in after the first mount instead
+            extended << "lazy_itable_init=1" << "lazy_journal_init=1";
+        } else if (kind == Kind::NvmeSsd || kind == Kind::SataSsd) {
+            // Fast flash initializes in seconds and is left idle after the install
+            extended << "lazy_itable_init=0" << "lazy_journal_init=0";
+        }
+
+        // RAID and SMR hints from the queue limits, in 4 KiB filesystem blocks
+        if (minimumIo > 4096 && minimumIo % 4096 == 0) {
+            extended << QString("stride=%1").arg(minimumIo / 4096);
+        }
+        if (optimalIo > 4096 && optimalIo % 4096 == 0) {
+            extended << QString("stripe_width=%1").arg(optimalIo / 4096);
+        }
+        if (alreadyDiscarded) {
+            extended << "nodiscard";
+        }
+        if (!extended.isEmpty()) {
+            options << "-E" << extended.join(",");
+        }
+    } else if (fsType == "btrfs") {
+        // Duplicate metadata protects HDDs against bad sectors; single metadata
+        // halves metadata writes on small flash
+        if (kind == Kind::Hdd) {
+            options << "-m" << "dup";
+        } else if (kind == Kind::Emmc || kind == Kind::UsbFlash) {
+            options << "-m" << "single";
+        }
+        if (!discard || alreadyDiscarded) {
+            options << "--nodiscard";
+        }
+    }
+    return options;
+}
+
+QString StorageProfile::mountOptions(const QString &fsType) const {
+    // Flash with few write cycles gets longer commit intervals
+    bool slowFlash = kind == Kind::Emmc || kind == Kind::UsbFlash;
+
+    if (fsType == "btrfs") {
+        // Spend CPU on compression where the disk is the bottleneck
+        QString options = kind == Kind::Hdd ? "rw,noatime,compress=zstd:3,space_cache=v2,autodefrag"
+                                            : "rw,noatime,compress=zstd:1,space_cache=v2";
+        if (isFlash()) {
+            options += ",ssd";
+        }
+        if (!rotational && discard) {
+            options += ",discard=async";
+        }
+        if (slowFlash) {
+            options += ",commit=60";
+        }
+        return options;
+    }
+    if (fsType == "ext4") {
+        // ext4 discard is synchronous; flash is trimmed by fstrim.timer instead
+        if (slowFlash) {
+            return "rw,noatime,commit=60";
+        }
+        return kind == Kind::Hdd ? "rw,relatime" : "rw,noatime";
+    }
+    if (fsType == "vfat") {
+        return "rw,noatime,fmask=0077,dmask=0077,shortname=mixed,utf8,errors=remount-ro";
+    }
+    if (fsType == "swap") {
+        return (!rotational && discard) ? "defaults,discard=once" : "defaults";
+    }
+    return "defaults";
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+
+// What kind of storage a target disk is, read from its sysfs queue
+// attributes, and the mkfs features and mount options that suit it.
+//
+// Partitions are resolved to the disk they live on, so detect() can be
+// called with either.
+struct StorageProfile {
+    enum class Kind { NvmeSsd, SataSsd, Hdd, Emmc, UsbFlash, VirtualDisk, Ssd };
+
+    Kind kind = Kind::Hdd;
+    QString disk;                // e.g. /dev/nvme0n1
+    QString transport;           // nvme, sata, mmc, usb, virtio, scsi or unknown
+    bool rotational = true;
+    bool discard = false;        // the device advertises discard/TRIM
+    qint64 physicalBlock = 512;
+    qint64 minimumIo = 0;
+    qint64 optimalIo = 0;
+
+    static StorageProfile detect(const QString &device);
+
+    QString name() const;
+    // One line for the layout windows and the install log
+    QString summary() const;
+    // Extra arguments for mkfs.<fsType>; alreadyDiscarded skips mkfs's own discard pass
+    QStringList mkfsOptions(const QString &fsType, bool alreadyDiscarded = false) const;
+    // Mount options for fsType on this storage (btrfs without subvol=)
+    QString mountOptions(const QString &fsType) const;
+
+private:
+    bool isFlash() const;
+};
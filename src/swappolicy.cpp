@@ -0,0 +1,94 @@
+#include "swappolicy.h"
+#include "systemresources.h"
+#include <QFile>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const qint64 GiB = 1024;
+
+} // namespace
+
+qint64 SwapPolicy::installedRamMiB() {
+    qint64 totalMiB = SystemResources::memTotalKb() / 1024;
+    // The kernel and firmware reserve part of the DIMMs
+    return (totalMiB + GiB - 1) / GiB * GiB;
+}
+
+qint64 SwapPolicy::recommendedSizeMiB(qint64 ramMiB, bool hibernation) {
+    if (ramMiB <= 0) {
+        // /proc/meminfo unreadable - the size the layout used to hardcode
+        return 8 * GiB;
+    }
+    qint64 ramGiB = std::max<qint64>(1, (ramMiB + GiB - 1) / GiB);
+    qint64 headroom = static_cast<qint64>(std::ceil(std::sqrt(static_cast<double>(ramGiB)))) * GiB;
+
+    if (hibernation) {
+        // The image is compressed, but a full memory dump must still fit
+        return ramMiB + headroom;
+    }
+    if (ramMiB <= 2 * GiB) {
+        return 2 * ramMiB;
+    }
+    if (ramMiB <= 8 * GiB) {
+        return ramMiB;
+    }
+    return std::clamp<qint64>(headroom, 4 * GiB, 8 * GiB);
+}
+
+SwapMode SwapPolicy::defaultMode(qint64 ramMiB) {
+    return ramMiB >= 16 * GiB && zramAvailable() ? SwapMode::Zram : SwapMode::Partition;
+}
+
+QString SwapPolicy::describe(SwapMode mode, qint64 sizeMiB) {
+    QString size = QString::number(sizeMiB / static_cast<double>(GiB), 'f', sizeMiB % GiB ? 1 : 0);
+    switch (mode) {
+    case SwapMode::Partition: return QString("Swap partition (%1 GB)").arg(size);
+    case SwapMode::Swapfile: return QString("Swap file (%1 GB)").arg(size);
+    case SwapMode::Zram: return "Compressed swap in RAM (zram)";
+    case SwapMode::None: break;
+    }
+    return "No swap";
+}
+
+QString SwapPolicy::swapfilePath(const QString &fsType) {
+    return fsType == "btrfs" ? "/swap/swapfile" : "/swapfile";
+}
+
+QStringList SwapPolicy::swapfileCommands(const QString &targetRoot, const QString &fsType, qint64 sizeMiB) {
+    QString path = targetRoot + swapfilePath(fsType);
+    QStringList commands;
+    if (fsType == "btrfs") {
+        // Swap files must not be copy-on-write or compressed: +C has to be set
+        // while the file is still empty
+        commands << QString("([ -d %1/swap ] || btrfs subvolume create %1/swap)").arg(targetRoot);
+        commands << QString("truncate -s 0 %1").arg(path);
+        commands << QString("chattr +C %1").arg(path);
+    }
+    // fallocate leaves no holes, which swapon refuses
+    commands << QString("fallocate -l %1M %2").arg(sizeMiB).arg(path);
+    commands << QString("chmod 600 %1").arg(path);
+    commands << QString("mkswap %1").arg(path);
+    return commands;
+}
+
+bool SwapPolicy::zramAvailable(const QString &root) {
+    return QFile::exists(root + "/usr/lib/systemd/system-generators/zram-generator");
+}
+
+QString SwapPolicy::zramGeneratorConfig() {
+    return "[zram0]\n"
+           "zram-size = min(ram / 2, 8192)\n"
+           "compression-algorithm = zstd\n"
+           "swap-priority = 100\n";
+}
+
+QString SwapPolicy::zramSysctlConfig() {
+    // Swapping to RAM is cheap: prefer it over dropping page cache, and read
+    // single pages since there is no seek to amortize
+    return "vm.swappiness = 180\n"
+           "vm.watermark_boost_factor = 0\n"
+           "vm.watermark_scale_factor = 125\n"
+           "vm.page-cluster = 0\n";
+}
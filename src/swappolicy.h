@@ -0,0 +1,34 @@
+#pragma once
+#include <QString>
+#include <QStringList>
+#include "installconfig.h"
+
+// How much swap a target gets and in what form.
+//
+// Sizes follow installed RAM: small machines get up to twice their memory,
+// large ones a few GiB to absorb spikes. Hibernation needs room for a full
+// memory image, so it sizes swap past RAM. Machines with plenty of memory
+// default to compressed swap in zram and keep the disk for data.
+class SwapPolicy {
+public:
+    // MemTotal rounded up to whole GiB, as the machine is sold
+    static qint64 installedRamMiB();
+    static qint64 recommendedSizeMiB(qint64 ramMiB, bool hibernation);
+    // zram on large machines, when the image ships zram-generator
+    static SwapMode defaultMode(qint64 ramMiB);
+    // "Swap partition (8 GB)" and the like, for the layout window
+    static QString describe(SwapMode mode, qint64 sizeMiB);
+
+    // Where the swap file lives on the target (btrfs keeps it in its own
+    // nested subvolume so snapshots of / do not include it)
+    static QString swapfilePath(const QString &fsType);
+    // Creates and formats the swap file under targetRoot
+    static QStringList swapfileCommands(const QString &targetRoot, const QString &fsType, qint64 sizeMiB);
+
+    // Whether zram-generator is installed under root; the live system runs
+    // the image the target gets, so "/" answers for the layout window
+    static bool zramAvailable(const QString &root = QString());
+    // /etc/systemd/zram-generator.conf and the matching VM tuning
+    static QString zramGeneratorConfig();
+    static QString zramSysctlConfig();
+};
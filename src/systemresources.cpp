@@ -0,0 +1,72 @@
+#include "systemresources.h"
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+
+int SystemResources::cpuCount() {
+    return std::max(1, QThread::idealThreadCount());
+}
+
+qint64 SystemResources::memAvailableKb() {
+    return readMeminfo("MemAvailable");
+}
+
+qint64 SystemResources::memTotalKb() {
+    return readMeminfo("MemTotal");
+}
+
+qint64 SystemResources::readMeminfo(const QString &key) {
+    QFile meminfo("/proc/meminfo");
+    if (!meminfo.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return 0;
+    }
+
+    QTextStream stream(&meminfo);
+    QString line;
+    while (stream.readLineInto(&line)) {
+        if (line.startsWith(key + ":")) {
+            // Format: "MemAvailable:   12345678 kB"
+            QStringList parts = line.simplified().split(' ');
+            if (parts.size() >= 2) {
+                return parts[1].toLongLong();
+            }
+        }
+    }
+    return 0;
+}
+
+ExtractionTuning SystemResources::extractionTuning() {
+    ExtractionTuning tuning;
+    int cores = cpuCount();
+    qint64 availableMb = memAvailableKb() / 1024;
+
+    if (availableMb <= 0) {
+        // /proc/meminfo unreadable - stay close to unsquashfs defaults
+        tuning.processors = std::min(cores, 4);
+        tuning.dataQueueMb = 128;
+        tuning.fragmentQueueMb = 64;
+    } else if (availableMb < 1024) {
+        // Low-RAM machines (often copytoram ISOs): keep the queues small so
+        // the extraction does not push the live system into OOM
+        tuning.processors = std::min(cores, 2);
+        tuning.dataQueueMb = 32;
+        tuning.fragmentQueueMb = 32;
+    } else {
+        // Every worker keeps a few blocks in flight, give each one ~256MB of headroom
+        // and spend at most a quarter of the available memory on the queues
+        int memoryBoundWorkers = static_cast<int>(std::max<qint64>(2, availableMb / 256));
+        tuning.processors = std::min(cores, memoryBoundWorkers);
+
+        qint64 queueBudgetMb = availableMb / 4;
+        tuning.dataQueueMb = static_cast<int>(std::clamp<qint64>(queueBudgetMb * 2 / 3, 64, 1024));
+        tuning.fragmentQueueMb = static_cast<int>(std::clamp<qint64>(queueBudgetMb / 3, 32, 512));
+    }
+
+    qDebug() << QString("[DEBUG] Extraction tuning: cores=%1 MemAvailable=%2MB -> processors=%3 data_queue=%4MB fragment_queue=%5MB")
+                .arg(cores).arg(availableMb).arg(tuning.processors)
+                .arg(tuning.dataQueueMb).arg(tuning.fragmentQueueMb);
+
+    return tuning;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <QString>
+
+struct ExtractionTuning {
+    int processors = 1;
+    int dataQueueMb = 256;
+    int fragmentQueueMb = 256;
+};
+
+class SystemResources {
+public:
+    static int cpuCount();
+    static qint64 memAvailableKb();
+    static qint64 memTotalKb();
+    static ExtractionTuning extractionTuning();
+
+private:
+    static qint64 readMeminfo(const QString &key);
+};
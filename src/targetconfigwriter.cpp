@@ -0,0 +1,331 @@
+#include "targetconfigwriter.h"
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <crypt.h>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TargetConfigWriter::TargetConfigWriter(const QString &root) : root(root) {
+}
+
+TargetConfigWriter::StagedFile &TargetConfigWriter::stage(const QString &path, mode_t defaultMode) {
+    auto it = staged.find(path);
+    if (it != staged.end()) {
+        return it.value();
+    }
+
+    StagedFile file;
+    file.mode = defaultMode;
+    QFile current(root + path);
+    if (current.open(QIODevice::ReadOnly)) {
+        file.content = current.readAll();
+        struct stat st;
+        if (stat((root + path).toLocal8Bit().constData(), &st) == 0) {
+            file.mode = st.st_mode & 07777;
+        }
+    }
+    staged.insert(path, file);
+    return staged[path];
+}
+
+void TargetConfigWriter::writeFile(const QString &path, const QString &content, mode_t mode) {
+    StagedFile &file = stage(path, mode);
+    file.content = content.toUtf8();
+    file.mode = mode;
+    file.changed = true;
+}
+
+QStringList TargetConfigWriter::lines(const QString &path) {
+    QString content = QString::fromUtf8(stage(path).content);
+    if (content.endsWith('\n')) {
+        content.chop(1);
+    }
+    return content.isEmpty() ? QStringList() : content.split('\n');
+}
+
+void TargetConfigWriter::setLines(const QString &path, const QStringList &newLines) {
+    StagedFile &file = stage(path);
+    file.content = (newLines.join('\n') + '\n').toUtf8();
+    file.changed = true;
+}
+
+QString TargetConfigWriter::assignment(const QString &path, const QString &key) {
+    for (const QString &line : lines(path)) {
+        if (line.startsWith(key + "=")) {
+            return line.mid(key.size() + 1);
+        }
+    }
+    return QString();
+}
+
+void TargetConfigWriter::setAssignment(const QString &path, const QString &key, const QString &value) {
+    QStringList content = lines(path);
+    QString newLine = key + "=" + value;
+
+    auto active = std::find_if(content.begin(), content.end(),
+                               [&key](const QString &line) { return line.startsWith(key + "="); });
+    if (active == content.end()) {
+        active = std::find_if(content.begin(), content.end(),
+                              [&key](const QString &line) { return line.startsWith("#" + key + "="); });
+    }
+    if (active != content.end()) {
+        *active = newLine;
+    } else {
+        content << newLine;
+    }
+    setLines(path, content);
+}
+
+bool TargetConfigWriter::replaceLine(const QString &path, const QString &line, const QString &replacement) {
+    QStringList content = lines(path);
+    int index = content.indexOf(line);
+    if (index < 0) {
+        return false;
+    }
+    content[index] = replacement;
+    setLines(path, content);
+    return true;
+}
+
+QString TargetConfigWriter::loginDefs(const QString &key, const QString &defaultValue) {
+    for (const QString &line : lines("/etc/login.defs")) {
+        QStringList fields = line.simplified().split(' ');
+        if (fields.size() >= 2 && fields[0] == key) {
+            return fields[1];
+        }
+    }
+    return defaultValue;
+}
+
+QString TargetConfigWriter::hashPassword(const QString &password) {
+    // Same method as ENCRYPT_METHOD YESCRYPT in Arch's login.defs; libxcrypt picks the salt
+    char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+    if (!crypt_gensalt_rn("$y$", 0, nullptr, 0, setting, sizeof(setting)) &&
+        !crypt_gensalt_rn("$6$", 0, nullptr, 0, setting, sizeof(setting))) {
+        return QString();
+    }
+
+    struct crypt_data data;
+    memset(&data, 0, sizeof(data));
+    const char *hash = crypt_rn(password.toUtf8().constData(), setting, &data, sizeof(data));
+    if (!hash || hash[0] == '*') {
+        return QString();
+    }
+    return QString::fromLatin1(hash);
+}
+
+bool TargetConfigWriter::addUser(const QString &name, const QString &password, const QString &shell,
+                                 const QStringList &groups, QString *error) {
+    QStringList passwd = lines("/etc/passwd");
+    QStringList group = lines("/etc/group");
+
+    uint uidMin = loginDefs("UID_MIN", "1000").toUInt();
+    uint uidMax = loginDefs("UID_MAX", "60000").toUInt();
+    uint gidMin = loginDefs("GID_MIN", "1000").toUInt();
+    uint gidMax = loginDefs("GID_MAX", "60000").toUInt();
+
+    // Next free ids above the highest regular user, like useradd
+    uint uid = uidMin;
+    QSet<uint> usedUids;
+    for (const QString &line : passwd) {
+        QStringList fields = line.split(':');
+        if (fields.size() < 3) continue;
+        if (fields[0] == name) {
+            *error = QString("useradd: user '%1' already exists").arg(name);
+            return false;
+        }
+        uint id = fields[2].toUInt();
+        usedUids.insert(id);
+        if (id >= uidMin && id < uidMax) {
+            uid = std::max(uid, id + 1);
+        }
+    }
+    QSet<uint> usedGids;
+    QSet<QString> existingGroups;
+    for (const QString &line : group) {
+        QStringList fields = line.split(':');
+        if (fields.size() < 3) continue;
+        if (fields[0] == name) {
+            *error = QString("useradd: group '%1' already exists").arg(name);
+            return false;
+        }
+        usedGids.insert(fields[2].toUInt());
+        existingGroups.insert(fields[0]);
+    }
+    for (const QString &supplementary : groups) {
+        if (!existingGroups.contains(supplementary)) {
+            *error = QString("useradd: group '%1' does not exist").arg(supplementary);
+            return false;
+        }
+    }
+    // The user private group shares the uid when that gid is free
+    uint gid = uid;
+    while (usedGids.contains(gid)) gid++;
+    if (uid > uidMax || gid > gidMax || gid < gidMin) {
+        *error = "useradd: no free user or group id";
+        return false;
+    }
+
+    QString hash = hashPassword(password);
+    if (hash.isEmpty()) {
+        *error = "Cannot hash the user password";
+        return false;
+    }
+    qint64 today = static_cast<qint64>(time(nullptr)) / 86400;
+    QString home = "/home/" + name;
+
+    passwd << QString("%1:x:%2:%3::%4:/bin/%5").arg(name).arg(uid).arg(gid).arg(home).arg(shell);
+    setLines("/etc/passwd", passwd);
+
+    QStringList shadow = lines("/etc/shadow");
+    shadow << QString("%1:%2:%3:0:99999:7:::").arg(name).arg(hash).arg(today);
+    setLines("/etc/shadow", shadow);
+
+    // Supplementary groups in group and gshadow, then the private group
+    QStringList gshadow = lines("/etc/gshadow");
+    auto addMember = [&name, &groups](QStringList &entries, int memberField) {
+        for (QString &line : entries) {
+            QStringList fields = line.split(':');
+            if (fields.size() <= memberField || !groups.contains(fields[0])) continue;
+            QStringList members = fields[memberField].split(',', Qt::SkipEmptyParts);
+            if (!members.contains(name)) members << name;
+            fields[memberField] = members.join(',');
+            line = fields.join(':');
+        }
+    };
+    addMember(group, 3);
+    addMember(gshadow, 3);
+    group << QString("%1:x:%2:").arg(name).arg(gid);
+    gshadow << QString("%1:!::").arg(name);
+    setLines("/etc/group", group);
+    setLines("/etc/gshadow", gshadow);
+
+    // Subordinate ids for rootless containers, as useradd does when the files exist
+    for (const QString &path : {QString("/etc/subuid"), QString("/etc/subgid")}) {
+        if (!QFileInfo::exists(root + path)) continue;
+        QStringList ranges = lines(path);
+        qint64 next = 100000;
+        for (const QString &line : ranges) {
+            QStringList fields = line.split(':');
+            if (fields.size() == 3) {
+                next = std::max(next, fields[1].toLongLong() + fields[2].toLongLong());
+            }
+        }
+        ranges << QString("%1:%2:65536").arg(name).arg(next);
+        setLines(path, ranges);
+    }
+
+    return createHome(home, uid, gid, error);
+}
+
+bool TargetConfigWriter::createHome(const QString &home, uid_t uid, gid_t gid, QString *error) {
+    QString target = root + home;
+    if (!QDir().mkpath(target) || chown(target.toLocal8Bit().constData(), uid, gid) != 0 ||
+        chmod(target.toLocal8Bit().constData(), 0700) != 0) {
+        *error = QString("Cannot create home directory %1: %2").arg(target).arg(strerror(errno));
+        return false;
+    }
+
+    // Populate it from /etc/skel, dotfiles included
+    QString skel = root + "/etc/skel";
+    QDirIterator it(skel, QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QString source = it.next();
+        QFileInfo info = it.fileInfo();
+        QString destination = target + source.mid(skel.size());
+        QByteArray destinationPath = destination.toLocal8Bit();
+
+        if (info.isSymLink()) {
+            QFile::link(info.symLinkTarget(), destination);
+        } else if (info.isDir()) {
+            QDir().mkpath(destination);
+        } else if (!QFile::copy(source, destination)) {
+            *error = QString("Cannot copy %1 to %2").arg(source).arg(destination);
+            return false;
+        }
+        struct stat st;
+        if (!info.isSymLink() && lstat(source.toLocal8Bit().constData(), &st) == 0) {
+            chmod(destinationPath.constData(), st.st_mode & 07777);
+        }
+        lchown(destinationPath.constData(), uid, gid);
+    }
+    return true;
+}
+
+bool TargetConfigWriter::setPassword(const QString &name, const QString &password, QString *error) {
+    QString hash = hashPassword(password);
+    if (hash.isEmpty()) {
+        *error = "Cannot hash the password";
+        return false;
+    }
+
+    QStringList shadow = lines("/etc/shadow");
+    for (QString &line : shadow) {
+        QStringList fields = line.split(':');
+        if (fields.size() >= 3 && fields[0] == name) {
+            fields[1] = hash;
+            fields[2] = QString::number(static_cast<qint64>(time(nullptr)) / 86400);
+            line = fields.join(':');
+            setLines("/etc/shadow", shadow);
+            return true;
+        }
+    }
+    *error = QString("chpasswd: user '%1' does not exist").arg(name);
+    return false;
+}
+
+bool TargetConfigWriter::commit(QString *error) {
+    int written = 0;
+    for (auto it = staged.begin(); it != staged.end(); ++it) {
+        if (!it.value().changed) continue;
+
+        QByteArray target = (root + it.key()).toLocal8Bit();
+        QByteArray temporary = target + ".arch7z-new";
+        QDir().mkpath(QFileInfo(root + it.key()).path());
+        int fd = open(temporary.constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, it.value().mode);
+        if (fd < 0) {
+            *error = QString("Cannot write %1: %2").arg(QString::fromLocal8Bit(temporary)).arg(strerror(errno));
+            return false;
+        }
+        const QByteArray &content = it.value().content;
+        qsizetype done = 0;
+        while (done < content.size()) {
+            ssize_t n = write(fd, content.constData() + done, static_cast<size_t>(content.size() - done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        // Mode is set explicitly: umask must not loosen or tighten shadow or sudoers
+        bool ok = done == content.size() && fchmod(fd, it.value().mode) == 0;
+        close(fd);
+        if (!ok || rename(temporary.constData(), target.constData()) != 0) {
+            *error = QString("Cannot replace %1: %2").arg(root + it.key()).arg(strerror(errno));
+            unlink(temporary.constData());
+            return false;
+        }
+        it.value().changed = false;
+        written++;
+    }
+
+    // One flush for everything instead of an fsync per file
+    int rootFd = open(root.toLocal8Bit().constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd < 0 || syncfs(rootFd) != 0) {
+        *error = QString("Cannot sync the configuration files to %1: %2").arg(root).arg(strerror(errno));
+        if (rootFd >= 0) close(rootFd);
+        return false;
+    }
+    close(rootFd);
+    qDebug() << "[DEBUG] Wrote" << written << "configuration files to" << root;
+    return true;
+}
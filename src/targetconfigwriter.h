@@ -0,0 +1,47 @@
+#pragma once
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <sys/types.h>
+
+// Edits configuration files of the installed system in-process.
+//
+// Changes are staged in memory and read back by later edits. commit() writes
+// every staged file next to its target, renames it into place and syncs the
+// target filesystem once. User accounts go straight into passwd, shadow,
+// group and gshadow with yescrypt (or SHA-512) password hashes.
+class TargetConfigWriter {
+public:
+    explicit TargetConfigWriter(const QString &root);
+
+    void writeFile(const QString &path, const QString &content, mode_t mode = 0644);
+    // KEY=value lines as in /etc/default/grub; a commented "#KEY=" line is
+    // replaced in place, a missing key is appended
+    QString assignment(const QString &path, const QString &key);
+    void setAssignment(const QString &path, const QString &key, const QString &value);
+    // Replaces a whole line; returns false if it is not there
+    bool replaceLine(const QString &path, const QString &line, const QString &replacement);
+
+    bool addUser(const QString &name, const QString &password, const QString &shell,
+                 const QStringList &groups, QString *error);
+    bool setPassword(const QString &name, const QString &password, QString *error);
+
+    bool commit(QString *error);
+
+private:
+    struct StagedFile {
+        QByteArray content;
+        mode_t mode = 0644;
+        bool changed = false;
+    };
+
+    StagedFile &stage(const QString &path, mode_t defaultMode = 0644);
+    QStringList lines(const QString &path);
+    void setLines(const QString &path, const QStringList &lines);
+    QString loginDefs(const QString &key, const QString &defaultValue);
+    bool createHome(const QString &home, uid_t uid, gid_t gid, QString *error);
+    static QString hashPassword(const QString &password);
+
+    QString root;
+    QMap<QString, StagedFile> staged;
+};
@@ -0,0 +1,505 @@
+#include "treecopier.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t COPY_BUFFER = 1024 * 1024;
+
+QString systemError(const char *what, const std::string &path) {
+    return QString("%1 %2: %3").arg(what).arg(QString::fromStdString(path)).arg(strerror(errno));
+}
+
+class CopyRun {
+public:
+    CopyRun(const std::string &source, const std::string &target, const QStringList &patterns,
+            std::atomic<bool> &cancelled)
+        : source(source), target(target), cancelled(cancelled) {
+        for (const QString &pattern : patterns) {
+            std::string value = pattern.toStdString();
+            while (!value.empty() && value.front() == '/') value.erase(0, 1);
+            if (value.size() > 2 && value.compare(value.size() - 2, 2, "/*") == 0) {
+                contentsExcluded.insert(value.substr(0, value.size() - 2));
+            } else if (!value.empty()) {
+                entriesExcluded.insert(value);
+            }
+        }
+    }
+
+    bool copy(int workerCount, const std::function<void()> &report, QString *error) {
+        struct stat st;
+        if (lstat(source.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            *error = systemError("Cannot read source directory", source);
+            return false;
+        }
+        if (mkdir(target.c_str(), 0700) != 0 && errno != EEXIST) {
+            *error = systemError("Cannot create", target);
+            return false;
+        }
+        {
+            QMutexLocker locker(&mutex);
+            directories.push_back({"", st, 0});
+            queue.push_back({"", 0});
+            pendingDirectories = 1;
+        }
+
+        std::vector<QThread *> workers;
+        for (int i = 0; i < std::max(1, workerCount); ++i) {
+            QThread *worker = QThread::create([this]() { workerLoop(); });
+            worker->start();
+            workers.push_back(worker);
+        }
+        for (QThread *worker : workers) {
+            while (!worker->wait(250)) {
+                report();
+            }
+            delete worker;
+        }
+
+        if (!failed && !cancelled) {
+            linkHardlinks();
+        }
+        if (!failed && !cancelled) {
+            finalizeDirectories();
+        }
+
+        if (failed) {
+            QMutexLocker locker(&mutex);
+            *error = firstError;
+            return false;
+        }
+        if (cancelled) {
+            *error = "Copy cancelled";
+            return false;
+        }
+        return true;
+    }
+
+    qint64 copiedBytes() const { return bytesDone; }
+    quint64 copiedFiles() const { return filesDone; }
+    int warnings() const { return metadataWarnings; }
+
+private:
+    struct PendingDir {
+        std::string relative;
+        int depth;
+    };
+
+    struct DirRecord {
+        std::string relative;
+        struct stat st;
+        int depth;
+    };
+
+    bool stopping() const { return failed || cancelled; }
+
+    void fail(const QString &message) {
+        QMutexLocker locker(&mutex);
+        if (!failed) {
+            firstError = message;
+            failed = true;
+        }
+        available.wakeAll();
+    }
+
+    void warn(const QString &message) {
+        if (++metadataWarnings <= 10) {
+            qDebug() << "[WARNING]" << message;
+        }
+    }
+
+    bool excluded(const std::string &parent, const std::string &relative) const {
+        return entriesExcluded.count(relative) || contentsExcluded.count(parent);
+    }
+
+    void workerLoop() {
+        std::vector<char> buffer(COPY_BUFFER);
+        while (true) {
+            PendingDir dir;
+            {
+                QMutexLocker locker(&mutex);
+                while (queue.empty() && pendingDirectories > 0 && !stopping()) {
+                    available.wait(&mutex);
+                }
+                if (queue.empty() || stopping()) {
+                    available.wakeAll();
+                    return;
+                }
+                dir = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            copyDirectory(dir, buffer);
+
+            QMutexLocker locker(&mutex);
+            if (--pendingDirectories == 0) {
+                available.wakeAll();
+            }
+        }
+    }
+
+    void copyDirectory(const PendingDir &dir, std::vector<char> &buffer) {
+        std::string sourcePath = source + "/" + dir.relative;
+        DIR *handle = opendir(sourcePath.c_str());
+        if (!handle) {
+            fail(systemError("Cannot open directory", sourcePath));
+            return;
+        }
+
+        std::vector<PendingDir> subdirectories;
+        while (struct dirent *entry = readdir(handle)) {
+            if (stopping()) break;
+            std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+
+            std::string relative = dir.relative.empty() ? name : dir.relative + "/" + name;
+            if (excluded(dir.relative, relative)) continue;
+
+            std::string from = source + "/" + relative;
+            std::string to = target + "/" + relative;
+            struct stat st;
+            if (lstat(from.c_str(), &st) != 0) {
+                fail(systemError("Cannot stat", from));
+                break;
+            }
+
+            if (S_ISDIR(st.st_mode)) {
+                if (mkdir(to.c_str(), 0700) != 0 && errno != EEXIST) {
+                    fail(systemError("Cannot create directory", to));
+                    break;
+                }
+                subdirectories.push_back({relative, dir.depth + 1});
+                QMutexLocker locker(&mutex);
+                directories.push_back({relative, st, dir.depth + 1});
+                continue;
+            }
+
+            if (st.st_nlink > 1) {
+                // Later names of an inode become hardlinks once every worker is done
+                QMutexLocker locker(&mutex);
+                auto inserted = firstLinks.emplace(std::make_pair(st.st_dev, st.st_ino), to);
+                if (!inserted.second) {
+                    pendingLinks.emplace_back(inserted.first->second, to);
+                    continue;
+                }
+            }
+
+            if (!copyEntry(from, to, st, buffer)) break;
+            filesDone++;
+        }
+        closedir(handle);
+
+        if (!subdirectories.empty()) {
+            QMutexLocker locker(&mutex);
+            for (PendingDir &subdirectory : subdirectories) {
+                queue.push_back(std::move(subdirectory));
+                pendingDirectories++;
+            }
+            available.wakeAll();
+        }
+    }
+
+    bool copyEntry(const std::string &from, const std::string &to, const struct stat &st, std::vector<char> &buffer) {
+        // Same semantics as the extractor: replace whatever non-directory is in the way
+        struct stat existing;
+        if (lstat(to.c_str(), &existing) == 0 && !S_ISDIR(existing.st_mode)) {
+            unlink(to.c_str());
+        }
+
+        if (S_ISREG(st.st_mode)) {
+            return copyFile(from, to, st, buffer);
+        }
+        if (S_ISLNK(st.st_mode)) {
+            std::string linkTarget(static_cast<size_t>(st.st_size) + 1, '\0');
+            ssize_t length = readlink(from.c_str(), &linkTarget[0], linkTarget.size());
+            if (length < 0) {
+                fail(systemError("Cannot read symlink", from));
+                return false;
+            }
+            linkTarget.resize(static_cast<size_t>(length));
+            if (symlink(linkTarget.c_str(), to.c_str()) != 0) {
+                fail(systemError("Cannot create symlink", to));
+                return false;
+            }
+        } else if (mknod(to.c_str(), (st.st_mode & S_IFMT) | 0600, st.st_rdev) != 0) {
+            fail(systemError("Cannot create special file", to));
+            return false;
+        }
+        applyMetadata(-1, from, to, st);
+        return true;
+    }
+
+    bool copyFile(const std::string &from, const std::string &to, const struct stat &st, std::vector<char> &buffer) {
+        int in = open(from.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (in < 0) {
+            fail(systemError("Cannot open", from));
+            return false;
+        }
+        int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (out < 0) {
+            fail(systemError("Cannot create", to));
+            close(in);
+            return false;
+        }
+
+        bool ok = true;
+        if (st.st_size > 0) {
+            if (reflinks && ioctl(out, FICLONE, in) == 0) {
+                bytesDone += st.st_size;
+            } else {
+                // Cross-filesystem copies (image -> target) always end up here
+                reflinks = false;
+                ok = copyData(in, out, st.st_size, buffer);
+                if (!ok) {
+                    fail(systemError("Copy error on", to));
+                } else if (ftruncate(out, st.st_size) != 0) {
+                    // Sets the size when the file ends in a hole
+                    fail(systemError("Cannot size", to));
+                    ok = false;
+                }
+            }
+        }
+
+        if (ok) {
+            applyMetadata(out, from, to, st);
+        }
+        close(out);
+        close(in);
+        return ok;
+    }
+
+    bool copyData(int in, int out, off_t size, std::vector<char> &buffer) {
+        off_t offset = 0;
+        while (offset < size) {
+            if (stopping()) return true;
+
+            // Walk the data segments so holes in the source stay holes
+            off_t dataStart = lseek(in, offset, SEEK_DATA);
+            if (dataStart < 0) {
+                if (errno == ENXIO) return true; // only a hole left
+                dataStart = offset;
+            }
+            off_t dataEnd = lseek(in, dataStart, SEEK_HOLE);
+            if (dataEnd < 0 || dataEnd > size) {
+                dataEnd = size;
+            }
+
+            off_t position = dataStart;
+            while (position < dataEnd) {
+                size_t chunk = static_cast<size_t>(std::min<off_t>(dataEnd - position, 64 * 1024 * 1024));
+                ssize_t copied = -1;
+                if (copyFileRange) {
+                    loff_t inOffset = position;
+                    loff_t outOffset = position;
+                    copied = copy_file_range(in, &inOffset, out, &outOffset, chunk, 0);
+                    if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+                        copyFileRange = false;
+                    } else if (copied < 0 && errno != EINTR) {
+                        return false;
+                    }
+                }
+                if (!copyFileRange) {
+                    copied = pread(in, buffer.data(), std::min(chunk, buffer.size()), position);
+                    if (copied < 0 && errno == EINTR) continue;
+                    if (copied < 0) return false;
+                    ssize_t written = 0;
+                    while (written < copied) {
+                        ssize_t n = pwrite(out, buffer.data() + written, static_cast<size_t>(copied - written), position + written);
+                        if (n < 0 && errno == EINTR) continue;
+                        if (n <= 0) return false;
+                        written += n;
+                    }
+                }
+                if (copied == 0) break; // source shrank underneath us
+                if (copied > 0) {
+                    position += copied;
+                    bytesDone += copied;
+                }
+            }
+            offset = dataEnd;
+        }
+        return true;
+    }
+
+    void applyMetadata(int fd, const std::string &from, const std::string &to, const struct stat &st) {
+        bool isLink = S_ISLNK(st.st_mode);
+
+        // chown first: it clears setuid/setgid bits that chmod then restores
+        if ((fd >= 0 ? fchown(fd, st.st_uid, st.st_gid) : lchown(to.c_str(), st.st_uid, st.st_gid)) != 0) {
+            warn(systemError("chown", to));
+        }
+        if (!isLink && (fd >= 0 ? fchmod(fd, st.st_mode & 07777) : chmod(to.c_str(), st.st_mode & 07777)) != 0) {
+            warn(systemError("chmod", to));
+        }
+        copyXattrs(fd, from, to);
+
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if ((fd >= 0 ? futimens(fd, times) : utimensat(AT_FDCWD, to.c_str(), times, AT_SYMLINK_NOFOLLOW)) != 0) {
+            warn(systemError("utimes", to));
+        }
+    }
+
+    void copyXattrs(int fd, const std::string &from, const std::string &to) {
+        ssize_t listSize = llistxattr(from.c_str(), nullptr, 0);
+        if (listSize <= 0) return;
+
+        std::vector<char> names(static_cast<size_t>(listSize));
+        listSize = llistxattr(from.c_str(), names.data(), names.size());
+        if (listSize <= 0) return;
+
+        std::vector<char> value;
+        for (ssize_t i = 0; i < listSize; i += static_cast<ssize_t>(strlen(names.data() + i)) + 1) {
+            const char *name = names.data() + i;
+            ssize_t valueSize = lgetxattr(from.c_str(), name, nullptr, 0);
+            if (valueSize < 0) continue;
+            value.resize(static_cast<size_t>(valueSize));
+            valueSize = lgetxattr(from.c_str(), name, value.data(), value.size());
+            if (valueSize < 0) continue;
+
+            // system.posix_acl_* carry the ACLs; security.capability goes on after the data
+            int ret = fd >= 0 ? fsetxattr(fd, name, value.data(), static_cast<size_t>(valueSize), 0)
+                              : lsetxattr(to.c_str(), name, value.data(), static_cast<size_t>(valueSize), 0);
+            if (ret != 0) {
+                warn(systemError((std::string("setxattr ") + name).c_str(), to));
+            }
+        }
+    }
+
+    void linkHardlinks() {
+        for (const auto &link : pendingLinks) {
+            struct stat existing;
+            if (lstat(link.second.c_str(), &existing) == 0 && !S_ISDIR(existing.st_mode)) {
+                unlink(link.second.c_str());
+            }
+            if (::link(link.first.c_str(), link.second.c_str()) != 0) {
+                fail(systemError("Cannot create hardlink", link.second));
+                return;
+            }
+            filesDone++;
+        }
+    }
+
+    void finalizeDirectories() {
+        // Deepest first so parents keep their mtime after children are touched
+        std::stable_sort(directories.begin(), directories.end(),
+                         [](const DirRecord &a, const DirRecord &b) { return a.depth > b.depth; });
+        for (const DirRecord &dir : directories) {
+            std::string from = dir.relative.empty() ? source : source + "/" + dir.relative;
+            std::string to = dir.relative.empty() ? target : target + "/" + dir.relative;
+            applyMetadata(-1, from, to, dir.st);
+        }
+    }
+
+    std::string source;
+    std::string target;
+    std::set<std::string> entriesExcluded;
+    std::set<std::string> contentsExcluded;
+    std::atomic<bool> &cancelled;
+
+    QMutex mutex;
+    QWaitCondition available;
+    std::deque<PendingDir> queue;
+    int pendingDirectories = 0;
+    std::vector<DirRecord> directories;
+    std::map<std::pair<dev_t, ino_t>, std::string> firstLinks;
+    std::vector<std::pair<std::string, std::string>> pendingLinks;
+    QString firstError;
+
+    std::atomic<bool> failed{false};
+    std::atomic<bool> reflinks{true};
+    std::atomic<bool> copyFileRange{true};
+    std::atomic<qint64> bytesDone{0};
+    std::atomic<quint64> filesDone{0};
+    std::atomic<int> metadataWarnings{0};
+};
+
+} // namespace
+
+TreeCopier::TreeCopier(const QString &sourceDir, const QString &targetDir, QObject *parent)
+    : QObject(parent), sourceDir(sourceDir), targetDir(targetDir), workerCount(1), thread(nullptr), cancelled(false) {
+}
+
+TreeCopier::~TreeCopier() {
+    cancel();
+    wait();
+    delete thread;
+}
+
+void TreeCopier::setWorkerCount(int workers) {
+    workerCount = std::max(1, workers);
+}
+
+void TreeCopier::setExcludes(const QStringList &patterns) {
+    excludes = patterns;
+}
+
+void TreeCopier::start() {
+    if (thread) return;
+    thread = QThread::create([this]() {
+        QString message;
+        bool success = run(&message);
+        emit finished(success, message);
+    });
+    thread->start();
+}
+
+void TreeCopier::cancel() {
+    cancelled = true;
+}
+
+void TreeCopier::wait() {
+    if (thread) {
+        thread->wait();
+    }
+}
+
+bool TreeCopier::run(QString *message) {
+    QElapsedTimer timer;
+    timer.start();
+
+    CopyRun copy(sourceDir.toStdString(), targetDir.toStdString(), excludes, cancelled);
+    auto report = [this, &copy, &timer]() {
+        double seconds = std::max<qint64>(1, timer.elapsed()) / 1000.0;
+        emit progressChanged(copy.copiedBytes(), copy.copiedFiles(),
+                             copy.copiedBytes() / seconds, copy.copiedFiles() / seconds);
+    };
+
+    qDebug() << QString("[DEBUG] Copying %1 -> %2 with %3 workers").arg(sourceDir).arg(targetDir).arg(workerCount);
+    if (!copy.copy(workerCount, report, message)) {
+        return false;
+    }
+    report();
+
+    double seconds = std::max<qint64>(1, timer.elapsed()) / 1000.0;
+    *message = QString("Copied %1 MB and %2 files in %3 s (%4 MB/s, %5 files/s, %6 metadata warnings)")
+               .arg(copy.copiedBytes() / (1024 * 1024))
+               .arg(copy.copiedFiles())
+               .arg(seconds, 0, 'f', 1)
+               .arg(copy.copiedBytes() / (1024.0 * 1024.0) / seconds, 0, 'f', 1)
+               .arg(copy.copiedFiles() / seconds, 0, 'f', 0)
+               .arg(copy.warnings());
+    qDebug() << "[DEBUG]" << *message;
+    return true;
+}
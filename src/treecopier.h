@@ -0,0 +1,45 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+
+class QThread;
+
+// Parallel copy of a mounted directory tree.
+//
+// Directories are handed out to a pool of workers as they are discovered.
+// File data moves with reflinks or copy_file_range when the kernel allows it
+// and with read/write otherwise; holes are kept. Ownership, modes, timestamps
+// and all xattrs (so POSIX ACLs and file capabilities too) are preserved, and
+// hardlinked inodes are linked again on the target once the copy is done.
+class TreeCopier : public QObject {
+    Q_OBJECT
+
+public:
+    TreeCopier(const QString &sourceDir, const QString &targetDir, QObject *parent = nullptr);
+    ~TreeCopier();
+
+    void setWorkerCount(int workers);
+    // rsync-style excludes relative to the source root: "lost+found" skips
+    // the entry itself, "dev/*" keeps the directory but not its contents
+    void setExcludes(const QStringList &patterns);
+
+    void start();
+    void cancel();
+    void wait();
+
+signals:
+    void progressChanged(qint64 bytesDone, quint64 filesDone, double bytesPerSecond, double filesPerSecond);
+    void finished(bool success, const QString &message);
+
+private:
+    bool run(QString *message);
+
+    QString sourceDir;
+    QString targetDir;
+    QStringList excludes;
+    int workerCount;
+    QThread *thread;
+    std::atomic<bool> cancelled;
+};
@@ -1,10 +1,37 @@
 #include "vminstaller.h"
+#include "installsource.h"
+#include "imageprefetcher.h"
+#include "devicereadiness.h"
+#include "partitiontablewriter.h"
+#include "storageprofile.h"
+#include "btrfslayout.h"
 #include <QDebug>
+#include <unistd.h>
 
 VMInstaller::VMInstaller(const InstallConfig &config, QObject *parent)
     : Installer(config, parent) {
 }
 
+QList<InstallTask> VMInstaller::buildTaskGraph() {
+    QList<InstallTask> graph;
+    graph << InstallTask{"partition", "Partitioning disk", {"foreign-os"}, {"partitions"},
+                         [this]() { partitionDisk(); }};
+    graph << InstallTask{"format", "Formatting partitions", {"partitions"}, {"root-formatted"},
+                         [this]() { formatPartitions(); }};
+    graph << InstallTask{"mount", "Mounting partitions", {"root-formatted"}, {"root-mounted"},
+                         [this]() { mountPartitions(); }};
+    graph << InstallTask{"base-system", "Installing base system", {"root-mounted"}, {"base-system"},
+                         [this]() { installBaseSystem(); }};
+    // The BIOS GRUB settings edit /etc/default/grub after the VM kernel parameters
+    graph << configurationTasks({"target-config"});
+    return graph;
+}
+
+BootBackend::Kind VMInstaller::bootBackend() const {
+    // systemd-boot and UKIs need UEFI; the VM layout boots through BIOS GRUB
+    return BootBackend::Kind::Grub;
+}
+
 void VMInstaller::partitionDisk() {
     qDebug() << "[DEBUG] VM partitionDisk() - Using MBR partitioning";
     
@@ -19,7 +46,24 @@ void VMInstaller::partitionDisk() {
     qDebug() << "[DEBUG] VM automatic partitioning - MBR + single root partition";
     
     if (config.selectedDisk.isEmpty()) {
-        emit installationFinished(false, "VM partitioning requires a disk to be selected");
+        failInstallation("VM partitioning requires a disk to be selected");
+        return;
+    }
+    
+    if (geteuid() == 0) {
+        // Thin-provisioned images shrink on the host when the guest sees discard
+        discardThen([this]() {
+            QList<PartitionSpec> layout;
+            layout << PartitionSpec{PartitionSpec::Type::LinuxFilesystem, "Linux root", 0, true};
+            
+            QStringList devices;
+            QString error;
+            if (!PartitionTableWriter::write(config.selectedDisk, PartitionTableWriter::Scheme::Mbr, layout, &devices, &error)) {
+                failInstallation(QString("VM partitioning failed:\n%1").arg(error));
+                return;
+            }
+            createdPartitions.insert("root", devices.first());
+        });
         return;
     }
     
@@ -35,22 +79,15 @@ umount %1* 2>/dev/null || true
 
 # Wipe existing partition table
 dd if=/dev/zero of=%1 bs=1M count=1 2>/dev/null || true
-sync
-sleep 1
 
 # Create MBR partition table with single bootable Linux partition
 echo ',,L,*' | sfdisk %1
-sync
-sleep 2
 
 # Force kernel to re-read partition table
 partprobe %1
-sync
-sleep 3
 
 # Wait for udev to create device nodes
-udevadm settle
-sleep 2
+%3
 
 # Validate partition was created
 ROOT_PART="%2"
@@ -62,7 +99,8 @@ echo "Final VM partition layout:"
 lsblk %1
 )")
     .arg(config.selectedDisk)
-    .arg(getRootPartition());
+    .arg(getRootPartition())
+    .arg(DeviceReadiness::waitForDevices(QStringList() << getRootPartition(), "VM root partition"));
     
     executeCommand("bash", QStringList() << "-c" << partitionScript);
 }
@@ -78,15 +116,14 @@ void VMInstaller::formatPartitions() {
     }
     
     QStringList formatCommands;
-    formatCommands << "sleep 2";
+    formatCommands << DeviceReadiness::waitForDevices(QStringList() << rootPartition, "VM root partition");
     formatCommands << QString("test -b %1 || (echo 'Root partition not found: %1' && exit 1)").arg(rootPartition);
     
     // Format single root partition
-    if (config.filesystem == "btrfs") {
-        formatCommands << QString("mkfs.btrfs -f %1").arg(rootPartition);
-    } else {
-        formatCommands << QString("mkfs.ext4 -F %1").arg(rootPartition);
-    }
+    StorageProfile profile = StorageProfile::detect(rootPartition);
+    qDebug() << "[STORAGE]" << profile.disk << "profile:" << profile.summary();
+    QString mkfs = (config.filesystem == "btrfs") ? "mkfs.btrfs -f" : "mkfs.ext4 -F";
+    formatCommands << (QStringList() << mkfs << profile.mkfsOptions(config.filesystem == "btrfs" ? "btrfs" : "ext4", diskDiscarded) << rootPartition).join(" ");
     
     QString formatScript = formatCommands.join(" && ");
     executeCommand("bash", QStringList() << "-c" << formatScript);
@@ -108,16 +145,16 @@ void VMInstaller::mountPartitions() {
     
     if (config.filesystem == "btrfs") {
         // Btrfs with subvolumes
+        BtrfsLayout layout = BtrfsLayout::fromSettings();
         mountCommands << QString("mount %1 /mnt").arg(rootPartition);
-        mountCommands << "btrfs subvolume create /mnt/@";
-        mountCommands << "btrfs subvolume create /mnt/@home";
+        mountCommands << rootSubvolumeCommands();
+        mountCommands << layout.createCommands("/mnt");
         mountCommands << "umount /mnt";
-        mountCommands << QString("mount -o subvol=@,compress=zstd %1 /mnt").arg(rootPartition);
-        mountCommands << "mkdir -p /mnt/home";
-        mountCommands << QString("mount -o subvol=@home,compress=zstd %1 /mnt/home").arg(rootPartition);
+        mountCommands << layout.mountCommands(rootPartition, "/mnt", &mountTable);
     } else {
         // Ext4 simple mount
-        mountCommands << QString("mount %1 /mnt").arg(rootPartition);
+        mountTable << FstabEntry{rootPartition, "/", "ext4", FstabGenerator::mountOptions("ext4", rootPartition)};
+        mountCommands << QString("mount -o %1 %2 /mnt").arg(mountTable.last().options).arg(rootPartition);
         mountCommands << "mkdir -p /mnt/home";
     }
     
@@ -137,23 +174,44 @@ void VMInstaller::installBootloader() {
     qDebug() << "[DEBUG] VM installBootloader() - BIOS/Legacy GRUB configuration";
     
     QStringList bootloaderCommands;
-    bootloaderCommands << "test -f /mnt/etc/fstab || (echo 'System not properly installed' && exit 1)";
+    bootloaderCommands << "set -e";
+    bootloaderCommands << "test -f /etc/fstab || (echo 'System not properly installed' && exit 1)";
     
     // Configure GRUB for BIOS boot
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/GRUB_CMDLINE_LINUX_DEFAULT=.*/GRUB_CMDLINE_LINUX_DEFAULT=\"quiet\"/' /etc/default/grub";
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/#GRUB_DISABLE_OS_PROBER=false/GRUB_DISABLE_OS_PROBER=false/' /etc/default/grub";
-    bootloaderCommands << "arch-chroot /mnt sed -i 's/GRUB_TIMEOUT=.*/GRUB_TIMEOUT=5/' /etc/default/grub";
+    if (!applyGrubDefaults(&bootloaderCommands)) {
+        return;
+    }
     
-    // Note: GRUB installation and config generation moved to final-settings.conf
+    // Note: GRUB installation moved to final-settings.conf; grub.cfg comes from the grub-config task
     
-    QString bootloaderScript = bootloaderCommands.join(" && ");
-    executeCommand("bash", QStringList() << "-c" << bootloaderScript);
+    executeInChroot(bootloaderCommands.join("\n"));
 }
 
 void VMInstaller::installBaseSystem() {
     qDebug() << "[DEBUG] VM installBaseSystem() - Starting base system installation";
     
-    QString installScript = R"(
+    if (!receivedStream.isEmpty()) {
+        qDebug() << "[DEBUG] VM root subvolume received from" << receivedStream << "- skipping image copy";
+        executeCommand("bash", QStringList() << "-c" << "set -e\n" + postCopyScript());
+        return;
+    }
+    
+    InstallImage image = InstallSource::locate();
+    if (!image.isValid()) {
+        QString errorMsg = "No install image found (airootfs.erofs or airootfs.sfs)";
+        failInstallation(errorMsg);
+        return;
+    }
+    image.path = ImagePrefetcher::claim(image.path);
+    
+    if (geteuid() == 0) {
+        // Same exclusions as the rsync fallback below
+        QStringList excludes = {"dev/*", "proc/*", "sys/*", "tmp/*", "run/*", "mnt/*", "media/*", "lost+found"};
+        startTreeCopy(image, excludes, postCopyScript());
+        return;
+    }
+    
+    QString installScript = QString(R"(
 #!/bin/bash
 set -e
 
@@ -161,25 +219,26 @@ set -e
 test -d /mnt || (echo '/mnt directory does not exist' && exit 1)
 mountpoint -q /mnt || (echo '/mnt is not mounted' && exit 1)
 
-# Try copytoram first, then bootmnt as fallback
-if [ -f /run/archiso/copytoram/airootfs.sfs ]; then
-    SQUASHFS_PATH='/run/archiso/copytoram/airootfs.sfs'
-    echo 'VM: Using copytoram SquashFS'
-elif [ -f /run/archiso/bootmnt/arch/x86_64/airootfs.sfs ]; then
-    SQUASHFS_PATH='/run/archiso/bootmnt/arch/x86_64/airootfs.sfs'
-    echo 'VM: Using bootmnt SquashFS'
-else
-    echo 'ERROR: No SquashFS found'
-    exit 1
-fi
+IMAGE_PATH='%1'
+IMAGE_TYPE='%2'
+echo "VM: Using $IMAGE_TYPE image: $IMAGE_PATH"
 
-# Install system from SquashFS
-echo "Found SquashFS at: $SQUASHFS_PATH"
-mkdir -p /tmp/squashfs-root
-mount -t squashfs -o loop "$SQUASHFS_PATH" /tmp/squashfs-root
-rsync -aHAXS --numeric-ids --exclude=/dev/* --exclude=/proc/* --exclude=/sys/* --exclude=/tmp/* --exclude=/run/* --exclude=/mnt/* --exclude=/media/* --exclude=/lost+found /tmp/squashfs-root/ /mnt/
+# Install system from the live image
+mkdir -p /tmp/image-root
+mount -t "$IMAGE_TYPE" -o loop,ro "$IMAGE_PATH" /tmp/image-root
+rsync -aHAXS --numeric-ids --exclude=/dev/* --exclude=/proc/* --exclude=/sys/* --exclude=/tmp/* --exclude=/run/* --exclude=/mnt/* --exclude=/media/* --exclude=/lost+found /tmp/image-root/ /mnt/
 
-# Copy kernel - prioritize SquashFS source over live environment
+# Cleanup
+umount /tmp/image-root
+rmdir /tmp/image-root
+)").arg(image.path).arg(image.mountType()) + postCopyScript();
+    
+    executeCommand("bash", QStringList() << "-c" << installScript);
+}
+
+QString VMInstaller::postCopyScript() {
+    return R"(
+# Copy kernel - prioritize the installed tree over live environment
 mkdir -p /mnt/boot
 if [ -f /mnt/usr/lib/modules/$(uname -r)/vmlinuz ]; then
     cp /mnt/usr/lib/modules/$(uname -r)/vmlinuz /mnt/boot/vmlinuz-linux
@@ -191,18 +250,12 @@ else
     echo 'Kernel not found, skipping'
 fi
 
-# Cleanup
-umount /tmp/squashfs-root
-rmdir /tmp/squashfs-root
-
 # Verify installation
 test -d /mnt/etc || (echo 'System installation failed - /mnt/etc missing' && exit 1)
 test -d /mnt/usr || (echo 'System installation failed - /mnt/usr missing' && exit 1)
 )";
-    
-    executeCommand("bash", QStringList() << "-c" << installScript);
 }
 
 QString VMInstaller::getRootPartition() const {
-    return config.selectedDisk + "1";
+    return createdPartitions.value("root", config.selectedDisk + "1");
 }
\ No newline at end of file
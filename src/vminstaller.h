@@ -7,12 +7,18 @@ class VMInstaller : public Installer {
 public:
     VMInstaller(const InstallConfig &config, QObject *parent = nullptr);
 
+protected:
+    QList<InstallTask> buildTaskGraph() override;
+    BootBackend::Kind bootBackend() const override;
+
 private:
-    void partitionDisk() override;
-    void formatPartitions() override;
-    void mountPartitions() override;
-    void installBaseSystem() override;
+    // MBR layout with a single root partition and no EFI system partition
+    void partitionDisk();
+    void formatPartitions();
+    void mountPartitions();
+    void installBaseSystem();
     void installBootloader() override;
     
     QString getRootPartition() const;
+    static QString postCopyScript();
 };
\ No newline at end of file
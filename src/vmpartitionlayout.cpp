@@ -1,6 +1,8 @@
 #include "vmpartitionlayout.h"
 #include "userconfig.h"
 #include "installconfig.h"
+#include "earlystart.h"
+#include "storageprofile.h"
 #include <QApplication>
 #include <QHBoxLayout>
 #include <QMessageBox>
@@ -41,12 +43,18 @@ void VMPartitionLayoutWindow::setupUI() {
     
     QLabel *diskInfo = new QLabel(QString("Selected Disk: %1 (%2)").arg(selectedDisk).arg(diskSize), this);
     diskInfo->setAlignment(Qt::AlignCenter);
-    diskInfo->setStyleSheet("font-size: 14px; color: #18e8ec; margin-bottom: 30px;");
+    diskInfo->setStyleSheet("font-size: 14px; color: #18e8ec; margin-bottom: 5px;");
+    
+    // Filesystems are created and mounted with options for this kind of storage
+    QLabel *storageInfo = new QLabel(QString("Storage profile: %1").arg(StorageProfile::detect(selectedDisk).summary()), this);
+    storageInfo->setAlignment(Qt::AlignCenter);
+    storageInfo->setStyleSheet("font-size: 12px; color: #888; margin-bottom: 30px;");
     
     mainLayout->addWidget(title);
     mainLayout->addWidget(logo);
     mainLayout->addWidget(subtitle);
     mainLayout->addWidget(diskInfo);
+    mainLayout->addWidget(storageInfo);
     
     // Filesystem selection
     QLabel *fsLabel = new QLabel("Root Filesystem:", this);
@@ -171,8 +179,11 @@ void VMPartitionLayoutWindow::updatePartitionTable() {
 void VMPartitionLayoutWindow::onContinue() {
     // Save settings to global config
     g_installConfig.enableSwap = false; // No swap for VMs
+    g_installConfig.swapMode = SwapMode::None;
     g_installConfig.filesystem = btrfsRadio->isChecked() ? "btrfs" : "ext4";
     
+    EarlyStart::offer(this, g_installConfig);
+    
     UserConfigWindow *userConfigWindow = new UserConfigWindow();
     userConfigWindow->setPreviousWindow(this);
     userConfigWindow->setWindowTitle("Arch7z Installer");
@@ -0,0 +1,148 @@
+#include "fstabgenerator.h"
+#include <QFile>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QtTest>
+
+// Formats small image files with the real mkfs tools, each told which UUID
+// (or vfat serial) to use, and reads it back from the superblock
+class FstabGeneratorTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void readUuid_data();
+    void readUuid();
+    void rejectsUnformatted_data();
+    void rejectsUnformatted();
+    void rejectsOtherFilesystem();
+
+private:
+    bool createImage(int sizeMiB);
+    QString format(const QString &tool, const QStringList &arguments);
+
+    QTemporaryDir directory;
+    QString image;
+};
+
+namespace {
+
+// mkfs tools usually live in sbin, which may not be on PATH
+QString findTool(const QString &name) {
+    QString path = QStandardPaths::findExecutable(name);
+    if (path.isEmpty()) {
+        path = QStandardPaths::findExecutable(name, {"/usr/sbin", "/sbin", "/usr/bin"});
+    }
+    return path;
+}
+
+} // namespace
+
+void FstabGeneratorTest::init() {
+    QVERIFY(directory.isValid());
+    image = directory.filePath("volume.img");
+    QFile::remove(image);
+}
+
+bool FstabGeneratorTest::createImage(int sizeMiB) {
+    QFile file(image);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.resize(qint64(sizeMiB) * 1024 * 1024);
+}
+
+// Returns the tool's output on failure, an empty string on success
+QString FstabGeneratorTest::format(const QString &tool, const QStringList &arguments) {
+    QProcess process;
+    process.setProcessChannelMode(QProcess::MergedChannels);
+    process.start(tool, QStringList(arguments) << image);
+    if (!process.waitForFinished(60000) || process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0) {
+        QString output = QString::fromLocal8Bit(process.readAll()).trimmed();
+        return QString("%1 failed: %2").arg(tool).arg(output.isEmpty() ? process.errorString() : output);
+    }
+    return QString();
+}
+
+void FstabGeneratorTest::readUuid_data() {
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<QString>("tool");
+    QTest::addColumn<QStringList>("arguments");
+    QTest::addColumn<int>("sizeMiB");
+    QTest::addColumn<QString>("expected");
+
+    QTest::newRow("ext4") << "ext4" << "mkfs.ext4"
+                          << QStringList{"-q", "-F", "-U", "3f2a9c4e-5b6d-4e7f-8a9b-0c1d2e3f4a5b"}
+                          << 16 << "3f2a9c4e-5b6d-4e7f-8a9b-0c1d2e3f4a5b";
+    // Below about 110 MiB mkfs.btrfs refuses the default profiles
+    QTest::newRow("btrfs") << "btrfs" << "mkfs.btrfs"
+                           << QStringList{"-q", "-f", "-U", "b7d0e1f2-0a1b-4c2d-9e3f-4a5b6c7d8e9f"}
+                           << 256 << "b7d0e1f2-0a1b-4c2d-9e3f-4a5b6c7d8e9f";
+    QTest::newRow("swap") << "swap" << "mkswap"
+                          << QStringList{"-U", "6c5d4e3f-2a1b-4c0d-8e9f-a0b1c2d3e4f5"}
+                          << 16 << "6c5d4e3f-2a1b-4c0d-8e9f-a0b1c2d3e4f5";
+    QTest::newRow("vfat (FAT16)") << "vfat" << "mkfs.fat"
+                                  << QStringList{"-F", "16", "-i", "1A2B3C4D"}
+                                  << 16 << "1A2B-3C4D";
+    // One sector per cluster gives FAT32 enough clusters on a small image
+    QTest::newRow("vfat (FAT32)") << "vfat" << "mkfs.fat"
+                                  << QStringList{"-F", "32", "-s", "1", "-i", "5E6F7A8B"}
+                                  << 64 << "5E6F-7A8B";
+}
+
+void FstabGeneratorTest::readUuid() {
+    QFETCH(QString, type);
+    QFETCH(QString, tool);
+    QFETCH(QStringList, arguments);
+    QFETCH(int, sizeMiB);
+    QFETCH(QString, expected);
+
+    QString toolPath = findTool(tool);
+    if (toolPath.isEmpty()) {
+        QSKIP(qPrintable(tool + " is not installed"));
+    }
+    QVERIFY(createImage(sizeMiB));
+    QString failure = format(toolPath, arguments);
+    QVERIFY2(failure.isEmpty(), qPrintable(failure));
+
+    QString uuid;
+    QString error;
+    QVERIFY2(FstabGenerator::readUuid(image, type, &uuid, &error), qPrintable(error));
+    QCOMPARE(uuid, expected);
+}
+
+void FstabGeneratorTest::rejectsUnformatted_data() {
+    QTest::addColumn<QString>("type");
+    for (const char *type : {"ext4", "btrfs", "swap", "vfat"}) {
+        QTest::newRow(type) << QString(type);
+    }
+}
+
+void FstabGeneratorTest::rejectsUnformatted() {
+    QFETCH(QString, type);
+    QVERIFY(createImage(1));
+
+    QString uuid;
+    QString error;
+    QVERIFY(!FstabGenerator::readUuid(image, type, &uuid, &error));
+    QVERIFY(error.contains(image));
+}
+
+void FstabGeneratorTest::rejectsOtherFilesystem() {
+    // Only the superblock of the requested type counts
+    QString toolPath = findTool("mkfs.ext4");
+    if (toolPath.isEmpty()) {
+        QSKIP("mkfs.ext4 is not installed");
+    }
+    QVERIFY(createImage(16));
+    QString failure = format(toolPath, {"-q", "-F"});
+    QVERIFY2(failure.isEmpty(), qPrintable(failure));
+
+    QString uuid;
+    QString error;
+    QVERIFY(FstabGenerator::readUuid(image, "ext4", &uuid, &error));
+    for (const char *type : {"btrfs", "swap", "vfat"}) {
+        QVERIFY2(!FstabGenerator::readUuid(image, type, &uuid, &error), type);
+    }
+}
+
+QTEST_GUILESS_MAIN(FstabGeneratorTest)
+#include "fstabgeneratortest.moc"
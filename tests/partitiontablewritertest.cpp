@@ -0,0 +1,206 @@
+#include "partitiontablewriter.h"
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+#include <zlib.h>
+
+// Writes tables into sparse image files and reads them back byte by byte,
+// independently of the writer's own helpers
+class PartitionTableWriterTest : public QObject {
+    Q_OBJECT
+
+private slots:
+    void init();
+    void gpt();
+    void mbr();
+    void rejectsBadLayouts();
+
+private:
+    QByteArray writeImage(PartitionTableWriter::Scheme scheme, const QList<PartitionSpec> &partitions);
+
+    QTemporaryDir directory;
+    QString image;
+};
+
+namespace {
+
+constexpr qint64 IMAGE_SIZE = 64 * 1024 * 1024;
+constexpr qint64 SECTORS = IMAGE_SIZE / 512;
+
+quint64 le(const QByteArray &data, qint64 offset, int bytes) {
+    quint64 value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | static_cast<unsigned char>(data[static_cast<int>(offset + i)]);
+    }
+    return value;
+}
+
+// Mixed-endian on disk: the first three fields are little-endian
+QString guid(const QByteArray &data, qint64 offset) {
+    static const int order[16] = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+    QString text;
+    for (int i = 0; i < 16; ++i) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            text += '-';
+        }
+        text += QString("%1").arg(static_cast<unsigned char>(data[static_cast<int>(offset + order[i])]), 2, 16, QChar('0'));
+    }
+    return text.toUpper();
+}
+
+quint32 crc(const QByteArray &data, qint64 offset, qint64 length) {
+    return crc32(0, reinterpret_cast<const Bytef *>(data.constData() + offset), static_cast<uInt>(length));
+}
+
+QList<PartitionSpec> standardLayout() {
+    return {
+        {PartitionSpec::Type::EfiSystem, "EFI", 8, true},
+        {PartitionSpec::Type::LinuxSwap, "swap", 8, false},
+        {PartitionSpec::Type::LinuxFilesystem, "root", 0, false},
+    };
+}
+
+} // namespace
+
+void PartitionTableWriterTest::init() {
+    QVERIFY(directory.isValid());
+    image = directory.filePath("disk.img");
+    QFile file(image);
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    // Leftovers of an older table that must not survive
+    file.seek(512);
+    file.write("EFI PART");
+    QVERIFY(file.resize(IMAGE_SIZE));
+}
+
+QByteArray PartitionTableWriterTest::writeImage(PartitionTableWriter::Scheme scheme, const QList<PartitionSpec> &partitions) {
+    QStringList devicePaths;
+    QString error;
+    if (!PartitionTableWriter::write(image, scheme, partitions, &devicePaths, &error)) {
+        qWarning() << error;
+        return QByteArray();
+    }
+    if (!devicePaths.isEmpty()) {
+        qWarning() << "image files have no partition nodes:" << devicePaths;
+        return QByteArray();
+    }
+    QFile file(image);
+    if (!file.open(QIODevice::ReadOnly) || file.size() != IMAGE_SIZE) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+void PartitionTableWriterTest::gpt() {
+    QByteArray disk = writeImage(PartitionTableWriter::Scheme::Gpt, standardLayout());
+    QCOMPARE(qint64(disk.size()), IMAGE_SIZE);
+
+    // Protective MBR covering the whole disk
+    QCOMPARE(le(disk, 510, 2), quint64(0xAA55));
+    QCOMPARE(le(disk, 446 + 4, 1), quint64(0xEE));
+    QCOMPARE(le(disk, 446 + 8, 4), quint64(1));
+    QCOMPARE(le(disk, 446 + 12, 4), static_cast<quint64>(SECTORS - 1));
+    QCOMPARE(le(disk, 446 + 16 + 4, 1), quint64(0));
+
+    const qint64 lastLba = SECTORS - 1;
+    const qint64 backupEntries = lastLba - 32;
+    struct Header {
+        qint64 lba;
+        qint64 alternate;
+        qint64 entries;
+    };
+    for (const Header &expected : {Header{1, lastLba, 2}, Header{lastLba, 1, backupEntries}}) {
+        const qint64 offset = expected.lba * 512;
+        QCOMPARE(disk.mid(static_cast<int>(offset), 8), QByteArray("EFI PART"));
+        QCOMPARE(le(disk, offset + 8, 4), quint64(0x00010000));
+        QCOMPARE(le(disk, offset + 12, 4), quint64(92));
+        QByteArray header = disk.mid(static_cast<int>(offset), 92);
+        header.replace(16, 4, QByteArray(4, '\0'));
+        QCOMPARE(le(disk, offset + 16, 4), static_cast<quint64>(crc(header, 0, 92)));
+        QCOMPARE(le(disk, offset + 24, 8), static_cast<quint64>(expected.lba));
+        QCOMPARE(le(disk, offset + 32, 8), static_cast<quint64>(expected.alternate));
+        QCOMPARE(le(disk, offset + 40, 8), quint64(34));
+        QCOMPARE(le(disk, offset + 48, 8), static_cast<quint64>(backupEntries - 1));
+        QCOMPARE(le(disk, offset + 72, 8), static_cast<quint64>(expected.entries));
+        QCOMPARE(le(disk, offset + 80, 4), quint64(128));
+        QCOMPARE(le(disk, offset + 84, 4), quint64(128));
+        QCOMPARE(le(disk, offset + 88, 4), static_cast<quint64>(crc(disk, expected.entries * 512, 128 * 128)));
+        QCOMPARE(disk.mid(static_cast<int>(expected.entries * 512), 128 * 128), disk.mid(2 * 512, 128 * 128));
+    }
+    QCOMPARE(disk.mid(1 * 512 + 56, 16), disk.mid(static_cast<int>(lastLba * 512 + 56), 16));
+
+    // 1 MiB aligned, back to back, the last one ending on a MiB boundary
+    struct Entry {
+        const char *type;
+        quint64 first;
+        quint64 last;
+        const char *name;
+    };
+    const Entry entries[] = {
+        {"C12A7328-F81F-11D2-BA4B-00A0C93EC93B", 2048, 18431, "EFI"},
+        {"0657FD6D-A4AB-43C4-84E5-0933C84B4F4F", 18432, 34815, "swap"},
+        {"0FC63DAF-8483-4772-8E79-3D69D8477DE4", 34816, 129023, "root"},
+    };
+    QStringList uniqueGuids;
+    for (int i = 0; i < 3; ++i) {
+        const qint64 offset = 2 * 512 + i * 128;
+        QCOMPARE(guid(disk, offset), QString(entries[i].type));
+        uniqueGuids << guid(disk, offset + 16);
+        QCOMPARE(le(disk, offset + 32, 8), entries[i].first);
+        QCOMPARE(le(disk, offset + 40, 8), entries[i].last);
+        QCOMPARE(QString::fromUtf16(reinterpret_cast<const char16_t *>(disk.constData() + offset + 56)),
+                 QString(entries[i].name));
+    }
+    uniqueGuids.removeDuplicates();
+    QCOMPARE(uniqueGuids.size(), qsizetype(3));
+    QCOMPARE(disk.mid(2 * 512 + 3 * 128, 128), QByteArray(128, '\0'));
+}
+
+void PartitionTableWriterTest::mbr() {
+    QByteArray disk = writeImage(PartitionTableWriter::Scheme::Mbr, standardLayout());
+    QCOMPARE(qint64(disk.size()), IMAGE_SIZE);
+
+    QCOMPARE(le(disk, 510, 2), quint64(0xAA55));
+    // The stale GPT header is gone
+    QCOMPARE(disk.mid(512, 8), QByteArray(8, '\0'));
+
+    struct Entry {
+        quint64 boot;
+        quint64 type;
+        quint64 first;
+        quint64 sectors;
+    };
+    const Entry entries[] = {
+        {0x80, 0xEF, 2048, 16384},
+        {0x00, 0x82, 18432, 16384},
+        {0x00, 0x83, 34816, SECTORS - 34816},
+    };
+    for (int i = 0; i < 3; ++i) {
+        const qint64 offset = 446 + i * 16;
+        QCOMPARE(le(disk, offset, 1), entries[i].boot);
+        QCOMPARE(le(disk, offset + 4, 1), entries[i].type);
+        QCOMPARE(le(disk, offset + 8, 4), entries[i].first);
+        QCOMPARE(le(disk, offset + 12, 4), entries[i].sectors);
+    }
+    QCOMPARE(disk.mid(446 + 3 * 16, 16), QByteArray(16, '\0'));
+}
+
+void PartitionTableWriterTest::rejectsBadLayouts() {
+    QStringList devicePaths;
+    QString error;
+    PartitionSpec root{PartitionSpec::Type::LinuxFilesystem, "root", 0, false};
+    PartitionSpec small{PartitionSpec::Type::LinuxFilesystem, "data", 4, false};
+
+    QVERIFY(!PartitionTableWriter::write(image, PartitionTableWriter::Scheme::Mbr,
+                                         {small, small, small, small, root}, &devicePaths, &error));
+    QVERIFY(!PartitionTableWriter::write(image, PartitionTableWriter::Scheme::Gpt, {root, small}, &devicePaths, &error));
+    QVERIFY(!error.isEmpty());
+
+    PartitionSpec huge{PartitionSpec::Type::LinuxFilesystem, "huge", 128, false};
+    error.clear();
+    QVERIFY(!PartitionTableWriter::write(image, PartitionTableWriter::Scheme::Gpt, {huge}, &devicePaths, &error));
+    QVERIFY(error.contains("too small"));
+}
+
+QTEST_GUILESS_MAIN(PartitionTableWriterTest)
+#include "partitiontablewritertest.moc"